@@ -0,0 +1,102 @@
+#!/usr/bin/python
+
+# Copyright (C) 2013-2015 by Massachusetts Institute of Technology
+#
+# This file is part of zsim.
+#
+# zsim is free software; you can redistribute it and/or modify it under the
+# terms of the GNU General Public License as published by the Free Software
+# Foundation, version 2.
+#
+# If you use this software in your research, we request that you reference
+# the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+# Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+# source of the simulator in any publications that use this software, and that
+# you send us a citation of your work.
+#
+# zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+# WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+# details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program. If not, see <http://www.gnu.org/licenses/>.
+
+# Checks sim.batchMemOps against per-operand memory op instrumentation: runs
+# each config with batching off (twice, to find the stats that vary from run
+# to run anyway) and on, compares the final stats dumps, and reports MIPS.
+# Run from the zsim root, e.g.: ./misc/batchMemOpsCheck.py tests/*.cfg
+
+from __future__ import print_function
+import os, re, shutil, subprocess, sys
+from optparse import OptionParser
+
+parser = OptionParser(usage="%prog [options] config...")
+parser.add_option("--zsim", default="./build/opt/zsim", dest="zsim", help="zsim harness binary")
+parser.add_option("--outDir", default="batchMemOpsCheck", dest="outDir", help="Directory for each run's outputs")
+parser.add_option("--ignore", dest="ignore",
+        default=r"(^|\.)(time|waitNs|contended|bblCache|syncRetries|syncTimed|syncCycles|steals|wakeLat|wakeLatHist|doneLat|doneLatHist|weaveWait)(\.|$)",
+        help="Regex of stats that measure the host, not the simulated system, and are not compared")
+(opts, args) = parser.parse_args()
+if not args: parser.error("no configs given")
+
+# zsim writes its outputs to the current directory, and test commands use paths relative to the zsim root
+OUTPUTS = re.compile(r"^(zsim.*\.(out|h5|log.*)|out\.cfg|heartbeat|zsim\.log\..*)$")
+
+def writeConfig(cfg, dst, batch):
+    text = open(cfg).read()
+    setting = "batchMemOps = %s;" % ("true" if batch else "false")
+    (text, n) = re.subn(r"^sim\s*=\s*{", "sim = {\n    " + setting, text, count=1, flags=re.M)
+    if n == 0: text += "\nsim = {\n    %s\n};\n" % setting
+    open(dst, "w").write(text)
+
+# Returns {stat path: value} for the last dump in a zsim.out
+def parseStats(path):
+    dumps = [d for d in open(path).read().split("===\n") if d.strip()]
+    lines = [l for l in dumps[-1].split("\n") if l.strip()]
+    stats = {}
+    stack = []
+    for l in lines:
+        level = len(l) - len(l.lstrip(" "))
+        (name, rest) = l.strip().split(":", 1)
+        del stack[level:]
+        stack.append(name)
+        value = rest.split("#")[0].strip()
+        if value: stats[".".join(stack)] = int(value)
+    return stats
+
+def run(cfg, name, batch):
+    runDir = os.path.join(opts.outDir, name)
+    if os.path.exists(runDir): shutil.rmtree(runDir)
+    os.makedirs(runDir)
+    runCfg = os.path.join(runDir, os.path.basename(cfg))
+    writeConfig(cfg, runCfg, batch)
+    log = open(os.path.join(runDir, "stdout.log"), "w")
+    ret = subprocess.call([opts.zsim, runCfg], stdout=log, stderr=subprocess.STDOUT)
+    for f in os.listdir("."):
+        if OUTPUTS.match(f): shutil.move(f, os.path.join(runDir, f))
+    if ret != 0: print("  %s: zsim exited with %d, see %s" % (name, ret, log.name))
+    return parseStats(os.path.join(runDir, "zsim.out"))
+
+def mips(stats):
+    instrs = sum(v for (k, v) in stats.items() if k.endswith(".instrs"))
+    ns = sum(stats.get("root.time." + s, 0) for s in ("bound", "weave"))
+    return instrs*1e3/ns if ns else 0.0
+
+ignore = re.compile(opts.ignore)
+allMatch = True
+for cfg in args:
+    base = os.path.splitext(os.path.basename(cfg))[0]
+    print("%s:" % cfg)
+    off1 = run(cfg, base + "-off1", False)
+    off2 = run(cfg, base + "-off2", False)
+    on = run(cfg, base + "-on", True)
+    compared = set(k for k in set(off1) | set(on) if not ignore.search(k))
+    noisy = set(k for k in compared if off1.get(k) != off2.get(k))
+    diffs = sorted(k for k in compared - noisy if off1.get(k) != on.get(k))
+    for k in diffs: print("  MISMATCH %s: off %s, on %s" % (k, off1.get(k), on.get(k)))
+    if noisy: print("  %d stats differ between the two runs without batching and were not compared" % len(noisy))
+    print("  %s, MIPS off %.2f/%.2f, on %.2f" % ("stats match" if not diffs else "%d stats differ" % len(diffs),
+            mips(off1), mips(off2), mips(on)))
+    allMatch = allMatch and not diffs
+sys.exit(0 if allMatch else 1)
@@ -14,6 +14,7 @@
 #define ZSIM_MAGIC_OP_HEARTBEAT         (1028)
 #define ZSIM_MAGIC_OP_WORK_BEGIN        (1029) //ubik
 #define ZSIM_MAGIC_OP_WORK_END          (1030) //ubik
+#define ZSIM_MAGIC_OP_SNAPSHOT          (1034)
 
 #ifdef __x86_64__
 #define HOOKS_STR  "HOOKS"
@@ -43,6 +44,12 @@ static inline void zsim_heartbeat() {
     zsim_magic_op(ZSIM_MAGIC_OP_HEARTBEAT);
 }
 
+//Saves the cache hierarchy's state to sim.snapshotFile at the end of the current phase
+static inline void zsim_snapshot() {
+    zsim_magic_op(ZSIM_MAGIC_OP_SNAPSHOT);
+    printf("[" HOOKS_STR "] Snapshot\n");
+}
+
 static inline void zsim_work_begin() { zsim_magic_op(ZSIM_MAGIC_OP_WORK_BEGIN); }
 static inline void zsim_work_end() { zsim_magic_op(ZSIM_MAGIC_OP_WORK_END); }
 
@@ -0,0 +1,184 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Microbenchmark of set-associative array lookups with each tag matching
+ * implementation (see tag_match.h), without Pin or the rest of the simulator.
+ *
+ * Arrays are warmed up with random lines and then probed with a stream that
+ * hits resident lines with the given probability and misses otherwise, so
+ * that hits land on random ways, as they do in arrays filled by replacements.
+ * Arrays are unhashed, as with the default config. All implementations must
+ * return the same lines.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "cache_arrays.h"
+#include "galloc.h"
+#include "hash.h"
+#include "log.h"
+#include "profile_stats.h"
+#include "repl_policies.h"
+#include "tag_match.h"
+#include "zsim.h"
+
+using std::vector;
+
+GlobSimInfo* zinfo;
+
+struct ArrayConfig {
+    uint32_t lines;
+    uint32_t ways;
+};
+
+//LRUReplPolicy without the coherence controller, which it asks for line validity
+class BenchLRUReplPolicy : public ReplPolicy {
+    private:
+        uint64_t timestamp;
+        uint64_t* array;
+
+    public:
+        explicit BenchLRUReplPolicy(uint32_t numLines) : timestamp(1) {
+            array = gm_calloc<uint64_t>(numLines);
+        }
+
+        void update(uint32_t id, const MemReq* req) {array[id] = timestamp++;}
+        void replaced(uint32_t id) {array[id] = 0;}
+
+        template <typename C> inline uint32_t rank(const MemReq* req, C cands) {
+            uint32_t bestCand = -1;
+            uint64_t bestScore = (uint64_t)-1L;
+            for (auto ci = cands.begin(); ci != cands.end(); ci.inc()) {
+                if (array[*ci] < bestScore) {
+                    bestCand = *ci;
+                    bestScore = array[*ci];
+                }
+            }
+            return bestCand;
+        }
+
+        DECL_RANK_BINDINGS;
+};
+
+static uint64_t rngState = 0x2545F4914F6CDD1DL;
+
+static uint64_t rnd() {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+static CacheArray* buildArray(const ArrayConfig& cfg, TagMatchImpl impl) {
+    return new SetAssocArray(cfg.lines, cfg.ways, new BenchLRUReplPolicy(cfg.lines), new IdHashFamily(), impl);
+}
+
+//Inserts the same 2x lines-worth of random lines in every run, so all arrays end up with the same contents
+static void fill(CacheArray* array, uint32_t lines) {
+    rngState = 0x2545F4914F6CDD1DL;
+    for (uint32_t i = 0; i < 2*lines; i++) {
+        Address lineAddr = 1 + (rnd() & ((1ul << 40) - 1));
+        if (array->lookup(lineAddr, nullptr, false) != -1) continue;
+        Address wbLineAddr;
+        uint32_t lineId = array->preinsert(lineAddr, nullptr, &wbLineAddr);
+        array->postinsert(lineAddr, nullptr, lineId);
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    InitLog(""); //no log header
+    if (argc > 2) {
+        info("Benchmarks cache array lookups with each tag matching implementation");
+        info("Usage: %s [lookups]", argv[0]);
+        exit(1);
+    }
+    uint32_t numLookups = (argc > 1)? atoi(argv[1]) : 4*1024*1024;
+
+    gm_init(1ul << 30);
+
+    const ArrayConfig configs[] = {
+        {512, 8}, //L1
+        {4096, 8}, //L2
+        {32768, 16}, //L3 bank
+        {32768, 32},
+    };
+    const double hitRates[] = {0.0, 0.5, 0.9};
+
+    vector<TagMatchImpl> impls;
+    for (uint32_t i = 0; i < TM_NUM_IMPLS; i++) {
+        if (TagMatchSupported((TagMatchImpl)i)) impls.push_back((TagMatchImpl)i);
+    }
+
+    info("%6s %5s %5s %8s %10s %8s", "Lines", "Ways", "Hits", "Impl", "ns/lookup", "Speedup");
+    for (const ArrayConfig& cfg : configs) {
+        vector<CacheArray*> arrays;
+        for (TagMatchImpl impl : impls) {
+            arrays.push_back(buildArray(cfg, impl));
+            fill(arrays.back(), cfg.lines);
+        }
+
+        vector<Address> resident;
+        rngState = 0x2545F4914F6CDD1DL;
+        for (uint32_t i = 0; i < 2*cfg.lines; i++) {
+            Address lineAddr = 1 + (rnd() & ((1ul << 40) - 1));
+            if (arrays[0]->lookup(lineAddr, nullptr, false) != -1) resident.push_back(lineAddr);
+        }
+
+        for (double hitRate : hitRates) {
+            vector<Address> stream(numLookups);
+            for (Address& lineAddr : stream) {
+                bool hit = (rnd() % 1000) < hitRate*1000;
+                lineAddr = hit? resident[rnd() % resident.size()] : (1ul << 41) + (rnd() & ((1ul << 40) - 1));
+            }
+
+            double scalarNs = 0.0;
+            int64_t refSum = 0;
+            for (uint32_t i = 0; i < impls.size(); i++) {
+                CacheArray* array = arrays[i];
+                //Best of a few runs, to filter out noise from other host processes
+                int64_t sum = 0;
+                double ns = 0.0;
+                for (uint32_t run = 0; run < 3; run++) {
+                    sum = 0;
+                    uint64_t startNs = getNs();
+                    for (Address lineAddr : stream) sum += array->lookup(lineAddr, nullptr, true);
+                    double runNs = ((double)(getNs() - startNs))/numLookups;
+                    ns = run? MIN(ns, runNs) : runNs;
+                }
+
+                if (i == 0) {
+                    scalarNs = ns;
+                    refSum = sum;
+                } else if (sum != refSum) {
+                    panic("%s lookups differ from scalar ones", TagMatchImplName(impls[i]));
+                }
+                info("%6d %5d %4.0f%% %8s %10.2f %7.2fx", cfg.lines, cfg.ways, hitRate*100,
+                        TagMatchImplName(impls[i]), ns, scalarNs/ns);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,246 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bbl_cache.h"
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/file.h>
+#include <unistd.h>
+#include "bithacks.h"
+#include "core.h"
+#include "decoder.h"
+#include "log.h"
+#include "version.h"  // NOLINT(build/include)
+
+//Sizes the table for entries of about this many bytes (code, uops, and entry), so that chains stay short at capacity
+#define BBL_CACHE_AVG_ENTRY_BYTES 1024
+
+#define UOP_CACHE_MAGIC "ZUOPC001"
+//Decoded uops are only valid for the build that produced them
+#define UOP_CACHE_BUILD (ZSIM_BUILDVERSION " " ZSIM_BUILDDATE)
+
+static uint64_t HashCode(const uint8_t* code, uint32_t bytes, uint32_t flags) {
+    //FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull ^ flags;
+    for (uint32_t i = 0; i < bytes; i++) hash = (hash ^ code[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+BblCache::BblCache(uint64_t _maxBytes, const char* _persistFile) : maxBytes(_maxBytes), persistFile(_persistFile) {
+    numBuckets = 1024;
+    while (numBuckets < maxBytes/BBL_CACHE_AVG_ENTRY_BYTES) numBuckets *= 2;
+    buckets = gm_calloc<Bucket>(numBuckets);
+    for (uint32_t i = 0; i < numBuckets; i++) futex_init(&buckets[i].lock);
+    usedBytes = numBuckets*sizeof(Bucket);
+    hits = misses = races = uncached = loaded = 0;
+
+    if (persistFile) {
+        int64_t entries = load(persistFile);
+        if (entries >= 0) info("Loaded %ld decoded bbls from %s", entries, persistFile);
+    }
+}
+
+void BblCache::initStats(AggregateStat* parentStat) {
+    AggregateStat* cacheStat = new AggregateStat();
+    cacheStat->init("bblCache", "Decoded basic block cache stats");
+    profHits.init("hits", "Basic blocks found already decoded", (uint64_t*)&hits);
+    profMisses.init("misses", "Basic blocks decoded", (uint64_t*)&misses);
+    profRaces.init("races", "Basic blocks decoded concurrently by another process", (uint64_t*)&races);
+    profUncached.init("uncached", "Basic blocks decoded but not cached, as the cache was full", (uint64_t*)&uncached);
+    profBytes.init("bytes", "Global heap bytes used by the cache", (uint64_t*)&usedBytes);
+    profLoaded.init("loaded", "Decoded basic blocks loaded from the persistent cache file", (uint64_t*)&loaded);
+    cacheStat->append(&profHits);
+    cacheStat->append(&profMisses);
+    cacheStat->append(&profRaces);
+    cacheStat->append(&profUncached);
+    cacheStat->append(&profBytes);
+    cacheStat->append(&profLoaded);
+    parentStat->append(cacheStat);
+}
+
+BblCache::Entry* BblCache::find(Bucket& b, uint64_t hash, uint32_t bytes, uint32_t flags, const uint8_t* code) const {
+    for (Entry* e = b.head; e; e = e->next) {
+        if (e->hash == hash && e->bytes == bytes && e->flags == flags && memcmp(e->code, code, bytes) == 0) return e;
+    }
+    return nullptr;
+}
+
+BblInfo* BblCache::insert(uint64_t hash, uint32_t bytes, uint32_t flags, const uint8_t* code, BblInfo* bblInfo, uint32_t infoBytes) {
+    uint64_t entryBytes = sizeof(Entry) + bytes;
+    if (usedBytes + infoBytes + entryBytes > maxBytes) return nullptr;
+
+    Bucket& b = buckets[hash & (numBuckets - 1)];
+    futex_lock(&b.lock);
+    Entry* winner = find(b, hash, bytes, flags, code);
+    if (winner) {
+        futex_unlock(&b.lock);
+        return winner->bblInfo;
+    }
+    Entry* e = static_cast<Entry*>(gm_malloc(entryBytes));
+    e->hash = hash;
+    e->bytes = bytes;
+    e->flags = flags;
+    e->bblInfo = bblInfo;
+    e->infoBytes = infoBytes;
+    memcpy(e->code, code, bytes);
+    e->next = b.head;
+    __sync_synchronize(); //publish a complete entry to lock-free readers
+    b.head = e;
+    futex_unlock(&b.lock);
+    __sync_fetch_and_add(&usedBytes, infoBytes + entryBytes);
+    return bblInfo;
+}
+
+BblInfo* BblCache::get(BBL bbl, bool oooDecoding) {
+    ADDRINT addr = BBL_Address(bbl);
+    uint32_t bytes = BBL_Size(bbl);
+    uint8_t code[bytes];
+    size_t copied = PIN_SafeCopy(code, (const void*)addr, bytes);
+    if (unlikely(copied != bytes)) return Decoder::decodeBbl(bbl, oooDecoding);
+
+    uint32_t flags = ((addr & 0xf) << 1) | (oooDecoding? 1 : 0);
+    uint64_t hash = HashCode(code, bytes, flags);
+
+    Entry* e = find(buckets[hash & (numBuckets - 1)], hash, bytes, flags, code);
+    if (e) {
+        __sync_fetch_and_add(&hits, 1);
+        return e->bblInfo;
+    }
+
+    BblInfo* bblInfo = Decoder::decodeBbl(bbl, oooDecoding);
+    __sync_fetch_and_add(&misses, 1);
+
+    uint32_t infoBytes = oooDecoding? offsetof(BblInfo, oooBbl) + DynBbl::bytes(bblInfo->oooBbl[0].uops) : sizeof(BblInfo);
+    BblInfo* cached = insert(hash, bytes, flags, code, bblInfo, infoBytes);
+    if (!cached) {
+        __sync_fetch_and_add(&uncached, 1);
+        return bblInfo;
+    } else if (cached != bblInfo) {
+        __sync_fetch_and_add(&races, 1);
+        gm_free(bblInfo); //nobody has seen ours yet
+    }
+    return cached;
+}
+
+/* Persistent cache file: the magic, the length and string of the build that
+ * wrote it, and then one record per entry: code bytes, flags, and BblInfo
+ * bytes (uint32_t each), the code, and the BblInfo (a POD, with its DynBbl).
+ */
+
+int64_t BblCache::load(const char* file) {
+    FILE* f = fopen(file, "r");
+    if (!f) return -1;
+
+    char magic[sizeof(UOP_CACHE_MAGIC)] = {0};
+    uint32_t buildLen = 0;
+    std::string build;
+    bool valid = fread(magic, 1, strlen(UOP_CACHE_MAGIC), f) == strlen(UOP_CACHE_MAGIC) && strcmp(magic, UOP_CACHE_MAGIC) == 0 &&
+        fread(&buildLen, sizeof(buildLen), 1, f) == 1 && buildLen < 1024;
+    if (valid) {
+        build.resize(buildLen);
+        valid = fread(&build[0], 1, buildLen, f) == buildLen;
+    }
+    if (!valid || build != UOP_CACHE_BUILD) {
+        info("%s is from another zsim build or not a uop cache, ignoring it", file);
+        fclose(f);
+        return -1;
+    }
+
+    int64_t entries = 0;
+    while (true) {
+        uint32_t hdr[3]; //code bytes, flags, BblInfo bytes
+        if (fread(hdr, sizeof(hdr), 1, f) != 1) break; //EOF
+        uint32_t bytes = hdr[0], flags = hdr[1], infoBytes = hdr[2];
+        bool ooo = flags & 1;
+        if (bytes == 0 || bytes > 64*1024 || infoBytes > 1024*1024 || infoBytes < (ooo? offsetof(BblInfo, oooBbl) + DynBbl::bytes(0) : sizeof(BblInfo))) {
+            warn("%s: corrupt entry %ld, ignoring the rest of the file", file, entries);
+            break;
+        }
+        uint8_t code[bytes];
+        BblInfo* bblInfo = static_cast<BblInfo*>(gm_malloc(infoBytes));
+        if (fread(code, bytes, 1, f) != 1 || fread(bblInfo, infoBytes, 1, f) != 1 || bblInfo->bytes != bytes ||
+                (ooo && infoBytes != offsetof(BblInfo, oooBbl) + DynBbl::bytes(bblInfo->oooBbl[0].uops)) ||
+                (!ooo && infoBytes != sizeof(BblInfo))) {
+            warn("%s: corrupt entry %ld, ignoring the rest of the file", file, entries);
+            gm_free(bblInfo);
+            break;
+        }
+
+        BblInfo* cached = insert(HashCode(code, bytes, flags), bytes, flags, code, bblInfo, infoBytes);
+        if (cached != bblInfo) gm_free(bblInfo);
+        if (!cached) break; //full
+        if (cached == bblInfo) __sync_fetch_and_add(&loaded, 1);
+        entries++;
+    }
+    fclose(f);
+    return entries;
+}
+
+void BblCache::save() {
+    if (!persistFile) return;
+    if (misses == races + uncached) return; //nothing new since we loaded
+
+    //Serialize writers; readers never see partial files, as we write a temporary one and rename it
+    std::string lockFile = std::string(persistFile) + ".lock";
+    int lockFd = open(lockFile.c_str(), O_CREAT | O_RDWR, 0644);
+    if (lockFd < 0 || flock(lockFd, LOCK_EX) != 0) {
+        warn("Could not lock %s, not saving the uop cache", lockFile.c_str());
+        if (lockFd >= 0) close(lockFd);
+        return;
+    }
+
+    load(persistFile); //merge what other simulations saved since we started
+
+    std::string tmpFile = std::string(persistFile) + ".tmp." + std::to_string(getpid());
+    FILE* f = fopen(tmpFile.c_str(), "w");
+    if (!f) {
+        warn("Could not write %s, not saving the uop cache", tmpFile.c_str());
+    } else {
+        uint32_t buildLen = strlen(UOP_CACHE_BUILD);
+        bool ok = fwrite(UOP_CACHE_MAGIC, strlen(UOP_CACHE_MAGIC), 1, f) == 1 && fwrite(&buildLen, sizeof(buildLen), 1, f) == 1 &&
+            fwrite(UOP_CACHE_BUILD, buildLen, 1, f) == 1;
+        uint64_t entries = 0;
+        for (uint32_t i = 0; i < numBuckets && ok; i++) {
+            for (Entry* e = buckets[i].head; e && ok; e = e->next) {
+                uint32_t hdr[3] = {e->bytes, e->flags, e->infoBytes};
+                ok = fwrite(hdr, sizeof(hdr), 1, f) == 1 && fwrite(e->code, e->bytes, 1, f) == 1 && fwrite(e->bblInfo, e->infoBytes, 1, f) == 1;
+                entries++;
+            }
+        }
+        ok = (fclose(f) == 0) && ok;
+        if (ok && rename(tmpFile.c_str(), persistFile) == 0) {
+            info("Saved %ld decoded bbls to %s", entries, persistFile);
+        } else {
+            warn("Could not write %s, not saving the uop cache", tmpFile.c_str());
+            unlink(tmpFile.c_str());
+        }
+    }
+
+    flock(lockFd, LOCK_UN);
+    close(lockFd);
+}
@@ -0,0 +1,115 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BBL_CACHE_H_
+#define BBL_CACHE_H_
+
+/* Cross-process cache of decoded basic blocks (sim.bblCacheMB)
+ *
+ * Decoding a basic block into a BblInfo (and its uops, with OOO cores) is
+ * deterministic given its code bytes, the alignment of its start within a
+ * 16-byte fetch block (which affects predecoding), and whether uops are
+ * decoded. Processes running the same binary, and processes that re-instrument
+ * code after exec, fork, or a code cache flush, thus decode the same blocks
+ * over and over. The cache lives in the global heap and is keyed by those
+ * three, and all processes consult it before decoding.
+ *
+ * Instrumented code embeds BblInfo pointers, so entries are never evicted:
+ * once the cache reaches its capacity, new blocks are decoded privately, as
+ * without the cache. Lookups are lock-free; inserts lock their bucket.
+ * Cached DynBbls keep the address of the first process that decoded them.
+ *
+ * The cache can also persist across simulations (sim.uopCacheFile): it is
+ * loaded at startup and saved, merged with the file's current contents, when
+ * the simulation ends. Since entries are keyed by code contents, a loaded
+ * block is only reused if the code matches byte for byte, whichever binary
+ * and offset it came from. The file is tied to the zsim build that wrote it,
+ * and is replaced atomically (rename) by writers that serialize on a lock
+ * file, so concurrent simulations can share it.
+ */
+
+#include <stdint.h>
+#include "galloc.h"
+#include "locks.h"
+#include "pin.H"
+#include "stats.h"
+
+struct BblInfo;
+
+class BblCache : public GlobAlloc {
+    private:
+        struct Entry {
+            Entry* volatile next;
+            uint64_t hash;
+            uint32_t bytes;
+            uint32_t flags; //start offset within its 16-byte fetch block, and whether it has uops
+            BblInfo* bblInfo;
+            uint32_t infoBytes;
+            uint8_t code[0];
+        };
+
+        struct Bucket {
+            lock_t lock; //only taken by inserts
+            Entry* volatile head;
+        };
+
+        Bucket* buckets;
+        uint32_t numBuckets; //power of 2
+        const uint64_t maxBytes;
+
+        //Updated atomically, as all processes share them
+        volatile uint64_t usedBytes;
+        volatile uint64_t hits;
+        volatile uint64_t misses;
+        volatile uint64_t races; //misses whose block was cached by another process while we decoded it
+        volatile uint64_t uncached; //misses not cached due to capacity
+        volatile uint64_t loaded; //entries loaded from the persistent cache
+
+        const char* persistFile; //nullptr if not persistent
+
+        ProxyStat profHits, profMisses, profRaces, profUncached, profBytes, profLoaded;
+
+    public:
+        //If _persistFile is non-null, the cache is loaded from it (if it exists) and saved to it by save()
+        BblCache(uint64_t _maxBytes, const char* _persistFile);
+        void initStats(AggregateStat* parentStat);
+
+        //Returns the decoded bbl, decoding it (see Decoder::decodeBbl) if it is not cached
+        BblInfo* get(BBL bbl, bool oooDecoding);
+
+        //Writes the cache to the persistent file, if any. Call once, at the end of the simulation
+        void save();
+
+    private:
+        Entry* find(Bucket& b, uint64_t hash, uint32_t bytes, uint32_t flags, const uint8_t* code) const;
+
+        //Returns the cached BblInfo for this block, which is bblInfo unless it was already cached, or nullptr if the cache is full
+        BblInfo* insert(uint64_t hash, uint32_t bytes, uint32_t flags, const uint8_t* code, BblInfo* bblInfo, uint32_t infoBytes);
+
+        //Returns the number of entries read, or -1 if the file is missing, stale, or corrupt
+        int64_t load(const char* file);
+};
+
+#endif  // BBL_CACHE_H_
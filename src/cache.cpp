@@ -53,15 +53,23 @@ void Cache::initStats(AggregateStat* parentStat) {
 }
 
 void Cache::initCacheStats(AggregateStat* cacheStat) {
+    profWarmAccesses.init("warmAcc", "Functional warming accesses");
+    cacheStat->append(&profWarmAccesses);
     cc->initStats(cacheStat);
     array->initStats(cacheStat);
     rp->initStats(cacheStat);
+
+    auto replBytes = [this]() { return rp->getStateBytes(); };
+    auto replBytesStat = makeLambdaStat(replBytes);
+    replBytesStat->init("replBytes", "Host memory footprint of the replacement state (bytes)");
+    cacheStat->append(replBytesStat);
 }
 
 uint64_t Cache::access(MemReq& req) {
     uint64_t respCycle = req.cycle;
     bool skipAccess = cc->startAccess(req); //may need to skip access due to races (NOTE: may change req.type!)
     if (likely(!skipAccess)) {
+        if (unlikely(req.is(MemReq::WARMUP))) profWarmAccesses.atomicInc(); //atomic, as accesses to a striped cache run in parallel
         bool updateReplacement = (req.type == GETS) || (req.type == GETX);
         int32_t lineId = array->lookup(req.lineAddr, &req, updateReplacement);
         respCycle += accLat;
@@ -79,11 +87,13 @@ uint64_t Cache::access(MemReq& req) {
             array->postinsert(req.lineAddr, &req, lineId); //do the actual insertion. NOTE: Now we must split insert into a 2-phase thing because cc unlocks us.
         }
         // Enforce single-record invariant: Writeback access may have a timing
-        // record. If so, read it.
+        // record. If so, read it. Warming accesses never produce records, and
+        // may come from a thread other than the core's, so they must not touch
+        // its recorder.
         EventRecorder* evRec = zinfo->eventRecorders[req.srcId];
         TimingRecord wbAcc;
         wbAcc.clear();
-        if (unlikely(evRec && evRec->hasRecord())) {
+        if (unlikely(!req.is(MemReq::WARMUP) && evRec && evRec->hasRecord())) {
             wbAcc = evRec->popRecord();
         }
 
@@ -125,8 +135,22 @@ uint64_t Cache::access(MemReq& req) {
     return respCycle;
 }
 
-void Cache::startInvalidate() {
-    cc->startInv(); //note we don't grab tcc; tcc serializes multiple up accesses, down accesses don't see it
+void Cache::saveState(SnapshotWriter& w) {
+    w.put(numLines);
+    array->saveState(w);
+    rp->saveState(w);
+    cc->saveState(w);
+}
+
+void Cache::restoreState(SnapshotReader& r) {
+    r.expect(numLines, "lines");
+    array->restoreState(r);
+    rp->restoreState(r);
+    cc->restoreState(r);
+}
+
+void Cache::startInvalidate(const InvReq& req) {
+    cc->startInv(req); //note we don't grab tcc; tcc serializes multiple up accesses, down accesses don't see it
 }
 
 uint64_t Cache::finishInvalidate(const InvReq& req) {
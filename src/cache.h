@@ -32,6 +32,7 @@
 #include "g_std/g_vector.h"
 #include "memory_hierarchy.h"
 #include "repl_policies.h"
+#include "snapshot.h"
 #include "stats.h"
 
 class Network;
@@ -55,6 +56,8 @@ class Cache : public BaseCache {
 
         g_string name;
 
+        Counter profWarmAccesses; //functional warming accesses (fast-forward warming and sampled simulation)
+
     public:
         Cache(uint32_t _numLines, CC* _cc, CacheArray* _array, ReplPolicy* _rp, uint32_t _accLat, uint32_t _invLat, const g_string& _name);
 
@@ -67,14 +70,18 @@ class Cache : public BaseCache {
 
         //NOTE: reqWriteback is pulled up to true, but not pulled down to false.
         virtual uint64_t invalidate(const InvReq& req) {
-            startInvalidate();
+            startInvalidate(req);
             return finishInvalidate(req);
         }
 
+        //Saves and restores the array, replacement and coherence state (see snapshot.h). Only call at the end of a phase.
+        virtual void saveState(SnapshotWriter& w);
+        virtual void restoreState(SnapshotReader& r);
+
     protected:
         void initCacheStats(AggregateStat* cacheStat);
 
-        void startInvalidate(); // grabs cc's downLock
+        void startInvalidate(const InvReq& req); // grabs cc's downLock
         uint64_t finishInvalidate(const InvReq& req); // performs inv and releases downLock
 };
 
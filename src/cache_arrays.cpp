@@ -24,12 +24,15 @@
  */
 
 #include "cache_arrays.h"
+#include <vector>
 #include "hash.h"
 #include "repl_policies.h"
 
 /* Set-associative array implementation */
 
-SetAssocArray::SetAssocArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy* _rp, HashFamily* _hf) : rp(_rp), hf(_hf), numLines(_numLines), assoc(_assoc)  {
+SetAssocArray::SetAssocArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy* _rp, HashFamily* _hf, TagMatchImpl _tagMatchImpl)
+    : rp(_rp), hf(_hf), numLines(_numLines), assoc(_assoc), tagMatch(GetTagMatchFunc(_tagMatchImpl))
+{
     array = gm_calloc<Address>(numLines);
     numSets = numLines/assoc;
     setMask = numSets - 1;
@@ -39,13 +42,11 @@ SetAssocArray::SetAssocArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy* _r
 int32_t SetAssocArray::lookup(const Address lineAddr, const MemReq* req, bool updateReplacement) {
     uint32_t set = hf->hash(0, lineAddr) & setMask;
     uint32_t first = set*assoc;
-    for (uint32_t id = first; id < first + assoc; id++) {
-        if (array[id] ==  lineAddr) {
-            if (updateReplacement) rp->update(id, req);
-            return id;
-        }
-    }
-    return -1;
+    int32_t way = tagMatch(&array[first], assoc, lineAddr);
+    if (way < 0) return -1;
+    uint32_t id = first + way;
+    if (updateReplacement) rp->update(id, req);
+    return id;
 }
 
 uint32_t SetAssocArray::preinsert(const Address lineAddr, const MemReq* req, Address* wbLineAddr) { //TODO: Give out valid bit of wb cand?
@@ -64,6 +65,24 @@ void SetAssocArray::postinsert(const Address lineAddr, const MemReq* req, uint32
     rp->update(candidate, req);
 }
 
+void SetAssocArray::saveState(SnapshotWriter& w) {
+    w.putTag("SetAssocArray");
+    w.put(assoc);
+    w.putArray(array, numLines);
+}
+
+void SetAssocArray::restoreState(SnapshotReader& r) {
+    r.expectTag("SetAssocArray");
+    r.expect(assoc, "ways");
+    r.getArray(array, numLines, "lines");
+    //Lines must be in the set our hash function maps them to (catches different hash functions)
+    for (uint32_t id = 0; id < numLines; id++) {
+        if (array[id] && (hf->hash(0, array[id]) & setMask) != id/assoc) {
+            panic("Snapshot section %s: line 0x%lx is in the wrong set, was the snapshot taken with a different hash function?", r.getSection(), array[id]);
+        }
+    }
+}
+
 
 /* ZCache implementation */
 
@@ -124,9 +143,12 @@ uint32_t ZArray::preinsert(const Address lineAddr, const MemReq* req, Address* w
 
     //info("Replacement for incoming 0x%lx", lineAddr);
 
+    uint64_t hvals[ways];
+
     //Seeds
+    hf->hashAll(lineAddr, hvals, ways);
     for (uint32_t w = 0; w < ways; w++) {
-        uint32_t pos = w*numSets + (hf->hash(w, lineAddr) & setMask);
+        uint32_t pos = w*numSets + (hvals[w] & setMask);
         uint32_t lineId = lookupArray[pos];
         candidates[w].set(pos, lineId, -1);
         all_valid &= (array[lineId] != 0);
@@ -138,9 +160,9 @@ uint32_t ZArray::preinsert(const Address lineAddr, const MemReq* req, Address* w
         uint32_t fringeId = candidates[fringeStart].lineId;
         Address fringeAddr = array[fringeId];
         assert(fringeAddr);
+        hf->hashAll(fringeAddr, hvals, ways);
         for (uint32_t w = 0; w < ways; w++) {
-            uint32_t hval = hf->hash(w, fringeAddr) & setMask;
-            uint32_t pos = w*numSets + hval;
+            uint32_t pos = w*numSets + (hvals[w] & setMask);
             uint32_t lineId = lookupArray[pos];
 
             // Logically, you want to do this...
@@ -216,3 +238,27 @@ void ZArray::postinsert(const Address lineAddr, const MemReq* req, uint32_t cand
     statSwaps.inc(swapArrayLen-1);
 }
 
+void ZArray::saveState(SnapshotWriter& w) {
+    w.putTag("ZArray");
+    w.put(ways);
+    w.putArray(array, numLines);
+    w.putArray(lookupArray, numLines);
+}
+
+void ZArray::restoreState(SnapshotReader& r) {
+    r.expectTag("ZArray");
+    r.expect(ways, "ways");
+    r.getArray(array, numLines, "lines");
+    r.getArray(lookupArray, numLines, "positions");
+    //Every position must hold a distinct line that our hash function for that way maps there
+    std::vector<bool> seen(numLines, false);
+    for (uint32_t pos = 0; pos < numLines; pos++) {
+        uint32_t lineId = lookupArray[pos];
+        if (lineId >= numLines || seen[lineId]) panic("Snapshot section %s: corrupted lookup array", r.getSection());
+        seen[lineId] = true;
+        Address lineAddr = array[lineId];
+        if (lineAddr && (hf->hash(pos/numSets, lineAddr) & setMask) != pos % numSets) {
+            panic("Snapshot section %s: line 0x%lx is in the wrong position, was the snapshot taken with a different hash function?", r.getSection(), lineAddr);
+        }
+    }
+}
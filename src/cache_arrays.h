@@ -27,7 +27,9 @@
 #define CACHE_ARRAYS_H_
 
 #include "memory_hierarchy.h"
+#include "snapshot.h"
 #include "stats.h"
+#include "tag_match.h"
 
 /* General interface of a cache array. The array is a fixed-size associative container that
  * translates addresses to line IDs. A line ID represents the position of the tag. The other
@@ -49,6 +51,10 @@ class CacheArray : public GlobAlloc {
         virtual void postinsert(const Address lineAddr, const MemReq* req, uint32_t lineId) = 0;
 
         virtual void initStats(AggregateStat* parent) {}
+
+        //Saves and restores tags (see snapshot.h); restoring checks that the geometry matches
+        virtual void saveState(SnapshotWriter& w) {panic("%s: cache array does not support snapshots", w.getSection());}
+        virtual void restoreState(SnapshotReader& r) {panic("%s: cache array does not support snapshots", r.getSection());}
 };
 
 class ReplPolicy;
@@ -64,13 +70,17 @@ class SetAssocArray : public CacheArray {
         uint32_t numSets;
         uint32_t assoc;
         uint32_t setMask;
+        TagMatchFunc tagMatch;
 
     public:
-        SetAssocArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy* _rp, HashFamily* _hf);
+        SetAssocArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy* _rp, HashFamily* _hf, TagMatchImpl _tagMatchImpl = BestTagMatchImpl());
 
         int32_t lookup(const Address lineAddr, const MemReq* req, bool updateReplacement);
         uint32_t preinsert(const Address lineAddr, const MemReq* req, Address* wbLineAddr);
         void postinsert(const Address lineAddr, const MemReq* req, uint32_t candidate);
+
+        void saveState(SnapshotWriter& w);
+        void restoreState(SnapshotReader& r);
 };
 
 /* The cache array that started this simulator :) */
@@ -106,6 +116,9 @@ class ZArray : public CacheArray {
         uint32_t getLastCandIdx() const {return lastCandIdx;}
 
         void initStats(AggregateStat* parentStat);
+
+        void saveState(SnapshotWriter& w);
+        void restoreState(SnapshotReader& r);
 };
 
 // Simple wrapper classes and iterators for candidates in each case; simplifies replacement policy interface without sacrificing performance
@@ -27,6 +27,38 @@
 #include "cache.h"
 #include "network.h"
 
+/* CCLock implementation */
+
+void CCLock::initStats(AggregateStat* parentStat, const char* name, const char* desc) {
+    AggregateStat* lockStat = new AggregateStat();
+    lockStat->init(name, desc);
+
+    auto acquires = [this]() { return sum(&Stripe::acquires); };
+    auto acquiresStat = makeLambdaStat(acquires);
+    acquiresStat->init("acquires", "Lock acquisitions");
+    lockStat->append(acquiresStat);
+
+    auto contended = [this]() { return sum(&Stripe::contended); };
+    auto contendedStat = makeLambdaStat(contended);
+    contendedStat->init("contended", "Acquisitions that had to wait");
+    lockStat->append(contendedStat);
+
+    auto waitNs = [this]() { return sum(&Stripe::waitNs); };
+    auto waitNsStat = makeLambdaStat(waitNs);
+    waitNsStat->init("waitNs", "Host time spent waiting on the lock (ns)");
+    lockStat->append(waitNsStat);
+
+    auto numStripes = [this]() { return (uint64_t)stripeMask + 1; };
+    auto numStripesStat = makeLambdaStat(numStripes);
+    numStripesStat->init("stripes", "Lock stripes (1 if the whole bank has one lock)");
+    lockStat->append(numStripesStat);
+
+    parentStat->append(lockStat);
+}
+
+
+/* MESIBottomCC implementation */
+
 /* Do a simple XOR block hash on address to determine its bank. Hacky for now,
  * should probably have a class that deals with this with a real hash function
  * (TODO)
@@ -53,7 +85,7 @@ void MESIBottomCC::init(const g_vector<MemObject*>& _parents, Network* network,
 }
 
 
-uint64_t MESIBottomCC::processEviction(Address wbLineAddr, uint32_t lineId, bool lowerLevelWriteback, uint64_t cycle, uint32_t srcId) {
+uint64_t MESIBottomCC::processEviction(Address wbLineAddr, uint32_t lineId, bool lowerLevelWriteback, uint64_t cycle, uint32_t srcId, uint32_t flags) {
     MESIState* state = &array[lineId];
     if (lowerLevelWriteback) {
         //If this happens, when tcc issued the invalidations, it got a writeback. This means we have to do a PUTX, i.e. we have to transition to M if we are in E
@@ -67,13 +99,13 @@ uint64_t MESIBottomCC::processEviction(Address wbLineAddr, uint32_t lineId, bool
         case S:
         case E:
             {
-                MemReq req = {wbLineAddr, PUTS, selfId, state, cycle, &ccLock, *state, srcId, 0 /*no flags*/};
+                MemReq req = {wbLineAddr, PUTS, selfId, state, cycle, ccLock.get(wbLineAddr), *state, srcId, flags};
                 respCycle = parents[getParentId(wbLineAddr)]->access(req);
             }
             break;
         case M:
             {
-                MemReq req = {wbLineAddr, PUTX, selfId, state, cycle, &ccLock, *state, srcId, 0 /*no flags*/};
+                MemReq req = {wbLineAddr, PUTX, selfId, state, cycle, ccLock.get(wbLineAddr), *state, srcId, flags};
                 respCycle = parents[getParentId(wbLineAddr)]->access(req);
             }
             break;
@@ -91,7 +123,7 @@ uint64_t MESIBottomCC::processAccess(Address lineAddr, uint32_t lineId, AccessTy
         // A PUTS/PUTX does nothing w.r.t. higher coherence levels --- it dies here
         case PUTS: //Clean writeback, nothing to do (except profiling)
             assert(*state != I);
-            profPUTS.inc();
+            prof(profPUTS);
             break;
         case PUTX: //Dirty writeback
             assert(*state == M || *state == E);
@@ -99,34 +131,34 @@ uint64_t MESIBottomCC::processAccess(Address lineAddr, uint32_t lineId, AccessTy
                 //Silent transition, record that block was written to
                 *state = M;
             }
-            profPUTX.inc();
+            prof(profPUTX);
             break;
         case GETS:
             if (*state == I) {
                 uint32_t parentId = getParentId(lineAddr);
-                MemReq req = {lineAddr, GETS, selfId, state, cycle, &ccLock, *state, srcId, flags};
+                MemReq req = {lineAddr, GETS, selfId, state, cycle, ccLock.get(lineAddr), *state, srcId, flags};
                 uint32_t nextLevelLat = parents[parentId]->access(req) - cycle;
                 uint32_t netLat = parentRTTs[parentId];
-                profGETNextLevelLat.inc(nextLevelLat);
-                profGETNetLat.inc(netLat);
+                prof(profGETNextLevelLat, nextLevelLat);
+                prof(profGETNetLat, netLat);
                 respCycle += nextLevelLat + netLat;
-                profGETSMiss.inc();
+                prof(profGETSMiss);
                 assert(*state == S || *state == E);
             } else {
-                profGETSHit.inc();
+                prof(profGETSHit);
             }
             break;
         case GETX:
             if (*state == I || *state == S) {
                 //Profile before access, state changes
-                if (*state == I) profGETXMissIM.inc();
-                else profGETXMissSM.inc();
+                if (*state == I) prof(profGETXMissIM);
+                else prof(profGETXMissSM);
                 uint32_t parentId = getParentId(lineAddr);
-                MemReq req = {lineAddr, GETX, selfId, state, cycle, &ccLock, *state, srcId, flags};
+                MemReq req = {lineAddr, GETX, selfId, state, cycle, ccLock.get(lineAddr), *state, srcId, flags};
                 uint32_t nextLevelLat = parents[parentId]->access(req) - cycle;
                 uint32_t netLat = parentRTTs[parentId];
-                profGETNextLevelLat.inc(nextLevelLat);
-                profGETNetLat.inc(netLat);
+                prof(profGETNextLevelLat, nextLevelLat);
+                prof(profGETNetLat, netLat);
                 respCycle += nextLevelLat + netLat;
             } else {
                 if (*state == E) {
@@ -139,7 +171,7 @@ uint64_t MESIBottomCC::processAccess(Address lineAddr, uint32_t lineId, AccessTy
                      */
                     *state = M;
                 }
-                profGETXHit.inc();
+                prof(profGETXHit);
             }
             assert_msg(*state == M, "Wrong final state on GETX, lineId %d numLines %d, finalState %s", lineId, numLines, MESIStateName(*state));
             break;
@@ -168,17 +200,17 @@ void MESIBottomCC::processInval(Address lineAddr, uint32_t lineId, InvType type,
             assert_msg(*state == E || *state == M, "Invalid state %s", MESIStateName(*state));
             if (*state == M) *reqWriteback = true;
             *state = S;
-            profINVX.inc();
+            prof(profINVX);
             break;
         case INV: //invalidate
             assert(*state != I);
             if (*state == M) *reqWriteback = true;
             *state = I;
-            profINV.inc();
+            prof(profINV);
             break;
         case FWD: //forward
             assert_msg(*state == S, "Invalid state %s on FWD", MESIStateName(*state));
-            profFWD.inc();
+            prof(profFWD);
             break;
         default: panic("!?");
     }
@@ -190,7 +222,7 @@ uint64_t MESIBottomCC::processNonInclusiveWriteback(Address lineAddr, AccessType
     if (!nonInclusiveHack) panic("Non-inclusive %s on line 0x%lx, this cache should be inclusive", AccessTypeName(type), lineAddr);
 
     //info("Non-inclusive wback, forwarding");
-    MemReq req = {lineAddr, type, selfId, state, cycle, &ccLock, *state, srcId, flags | MemReq::NONINCLWB};
+    MemReq req = {lineAddr, type, selfId, state, cycle, ccLock.get(lineAddr), *state, srcId, flags | MemReq::NONINCLWB};
     uint64_t respCycle = parents[getParentId(lineAddr)]->access(req);
     return respCycle;
 }
@@ -208,6 +240,131 @@ void MESITopCC::init(const g_vector<BaseCache*>& _children, Network* network, co
         children[c] = _children[c];
         childrenRTTs[c] = (network)? network->getRTT(name, children[c]->getName()) : 0;
     }
+
+    //At most one overflow bitmap per line, so the chunk table never needs to grow
+    bitmapWords = (children.size() + 63)/64;
+    uint32_t numChunks = (numLines + (1 << POOL_CHUNK_BITS) - 1) >> POOL_CHUNK_BITS;
+    poolChunks = gm_calloc<uint64_t*>(numChunks);
+}
+
+void MESITopCC::initStats(AggregateStat* parentStat) {
+    auto dirBytes = [this]() { return getDirBytes(); };
+    auto dirBytesStat = makeLambdaStat(dirBytes);
+    dirBytesStat->init("dirBytes", "Host memory footprint of the sharer directory (bytes)");
+    parentStat->append(dirBytesStat);
+
+    auto dirOverflows = [this]() { return (uint64_t)poolUsed; };
+    auto dirOverflowsStat = makeLambdaStat(dirOverflows);
+    dirOverflowsStat->init("dirOvfl", "Directory entries whose sharers overflowed to a bitmap");
+    parentStat->append(dirOverflowsStat);
+
+    ccLock.initStats(parentStat, "topLock", "Top CC lock (held for the whole access to this cache)");
+}
+
+uint32_t MESITopCC::allocBitmap() {
+    futex_lock(&poolLock);
+    uint32_t idx = poolFree;
+    if (idx != (uint32_t)-1) {
+        poolFree = getBitmap(idx)[0];
+    } else {
+        idx = poolSize++;
+        assert(idx < numLines);
+        uint64_t*& chunk = poolChunks[idx >> POOL_CHUNK_BITS];
+        if (!chunk) chunk = gm_calloc<uint64_t>(bitmapWords << POOL_CHUNK_BITS);
+    }
+    poolUsed++;
+    futex_unlock(&poolLock);
+
+    uint64_t* bitmap = getBitmap(idx);
+    for (uint32_t w = 0; w < bitmapWords; w++) bitmap[w] = 0;
+    return idx;
+}
+
+void MESITopCC::freeBitmap(uint32_t idx) {
+    futex_lock(&poolLock);
+    getBitmap(idx)[0] = poolFree;
+    poolFree = idx;
+    poolUsed--;
+    futex_unlock(&poolLock);
+}
+
+void MESITopCC::addSharer(Entry* e, uint32_t childId) {
+    assert(!isSharer(e, childId));
+    if (!e->overflow && e->numSharers == DIR_PTRS) {
+        uint32_t idx = allocBitmap();
+        uint64_t* bitmap = getBitmap(idx);
+        for (uint32_t i = 0; i < DIR_PTRS; i++) {
+            bitmap[e->ptrs[i]/64] |= 1ul << (e->ptrs[i] % 64);
+        }
+        e->overflow = true;
+        e->bitmap = idx;
+    }
+
+    if (e->overflow) {
+        getBitmap(e->bitmap)[childId/64] |= 1ul << (childId % 64);
+    } else {
+        //Insertion sort, keeps ptrs in child order
+        uint32_t i = e->numSharers;
+        while (i > 0 && e->ptrs[i-1] > childId) {
+            e->ptrs[i] = e->ptrs[i-1];
+            i--;
+        }
+        e->ptrs[i] = childId;
+    }
+    e->numSharers++;
+}
+
+void MESITopCC::removeSharer(Entry* e, uint32_t childId) {
+    assert(isSharer(e, childId));
+    e->numSharers--;
+    if (e->overflow) {
+        getBitmap(e->bitmap)[childId/64] &= ~(1ul << (childId % 64));
+        if (e->numSharers == 0) {
+            freeBitmap(e->bitmap);
+            e->overflow = false;
+        }
+    } else {
+        uint32_t i = 0;
+        while (e->ptrs[i] != childId) i++;
+        for (; i < e->numSharers; i++) e->ptrs[i] = e->ptrs[i+1];
+    }
+}
+
+void MESITopCC::clearEntry(Entry* e) {
+    if (e->overflow) freeBitmap(e->bitmap);
+    e->overflow = false;
+    e->exclusive = false;
+    e->numSharers = 0;
+}
+
+void MESITopCC::saveState(SnapshotWriter& w) {
+    uint32_t numChildren = children.size();
+    w.put(numChildren);
+    for (uint32_t i = 0; i < numLines; i++) {
+        Entry& e = array[i];
+        w.put((uint32_t)e.numSharers);
+        if (!e.numSharers) continue;
+        w.put(e.exclusive);
+        forEachSharer(&e, [&w](uint32_t c) { w.put(c); });
+    }
+}
+
+void MESITopCC::restoreState(SnapshotReader& r) {
+    uint32_t numChildren = children.size();
+    r.expect(numChildren, "children");
+    for (uint32_t i = 0; i < numLines; i++) {
+        Entry& e = array[i];
+        clearEntry(&e);
+        uint32_t numSharers = r.get<uint32_t>();
+        if (!numSharers) continue;
+        bool exclusive = r.get<bool>();
+        for (uint32_t s = 0; s < numSharers; s++) {
+            uint32_t c = r.get<uint32_t>();
+            if (c >= numChildren || isSharer(&e, c)) panic("Snapshot section %s: invalid sharer %d", r.getSection(), c);
+            addSharer(&e, c);
+        }
+        e.exclusive = exclusive;
+    }
 }
 
 uint64_t MESITopCC::sendInvalidates(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId) {
@@ -221,21 +378,17 @@ uint64_t MESITopCC::sendInvalidates(Address lineAddr, uint32_t lineId, InvType t
 
     uint64_t maxCycle = cycle; //keep maximum cycle only, we assume all invals are sent in parallel
     if (!e->isEmpty()) {
-        uint32_t numChildren = children.size();
         uint32_t sentInvs = 0;
-        for (uint32_t c = 0; c < numChildren; c++) {
-            if (e->sharers[c]) {
-                InvReq req = {lineAddr, type, reqWriteback, cycle, srcId};
-                uint64_t respCycle = children[c]->invalidate(req);
-                respCycle += childrenRTTs[c];
-                maxCycle = MAX(respCycle, maxCycle);
-                if (type == INV) e->sharers[c] = false;
-                sentInvs++;
-            }
-        }
+        forEachSharer(e, [&](uint32_t c) {
+            InvReq req = {lineAddr, type, reqWriteback, cycle, srcId};
+            uint64_t respCycle = children[c]->invalidate(req);
+            respCycle += childrenRTTs[c];
+            maxCycle = MAX(respCycle, maxCycle);
+            sentInvs++;
+        });
         assert(sentInvs == e->numSharers);
         if (type == INV) {
-            e->numSharers = 0;
+            clearEntry(e);
         } else {
             //TODO: This is kludgy -- once the sharers format is more sophisticated, handle downgrades with a different codepath
             assert(e->exclusive);
@@ -250,7 +403,7 @@ uint64_t MESITopCC::sendInvalidates(Address lineAddr, uint32_t lineId, InvType t
 uint64_t MESITopCC::processEviction(Address wbLineAddr, uint32_t lineId, bool* reqWriteback, uint64_t cycle, uint32_t srcId) {
     if (nonInclusiveHack) {
         // Don't invalidate anything, just clear our entry
-        array[lineId].clear();
+        clearEntry(&array[lineId]);
         return cycle;
     } else {
         //Send down invalidates
@@ -266,28 +419,25 @@ uint64_t MESITopCC::processAccess(Address lineAddr, uint32_t lineId, AccessType
         case PUTX:
             assert(e->isExclusive());
             if (flags & MemReq::PUTX_KEEPEXCL) {
-                assert(e->sharers[childId]);
+                assert(isSharer(e, childId));
                 assert(*childState == M);
                 *childState = E; //they don't hold dirty data anymore
                 break; //don't remove from sharer set. It'll keep exclusive perms.
             }
             //note NO break in general
         case PUTS:
-            assert(e->sharers[childId]);
-            e->sharers[childId] = false;
-            e->numSharers--;
+            removeSharer(e, childId);
             *childState = I;
             break;
         case GETS:
             if (e->isEmpty() && haveExclusive && !(flags & MemReq::NOEXCL)) {
                 //Give in E state
                 e->exclusive = true;
-                e->sharers[childId] = true;
-                e->numSharers = 1;
+                addSharer(e, childId);
                 *childState = E;
             } else {
                 //Give in S state
-                assert(e->sharers[childId] == false);
+                assert(!isSharer(e, childId));
 
                 if (e->isExclusive()) {
                     //Downgrade the exclusive sharer
@@ -296,8 +446,7 @@ uint64_t MESITopCC::processAccess(Address lineAddr, uint32_t lineId, AccessType
 
                 assert_msg(!e->isExclusive(), "Can't have exclusivity here. isExcl=%d excl=%d numSharers=%d", e->isExclusive(), e->exclusive, e->numSharers);
 
-                e->sharers[childId] = true;
-                e->numSharers++;
+                addSharer(e, childId);
                 e->exclusive = false; //dsm: Must set, we're explicitly non-exclusive
                 *childState = S;
             }
@@ -306,18 +455,16 @@ uint64_t MESITopCC::processAccess(Address lineAddr, uint32_t lineId, AccessType
             assert(haveExclusive); //the current cache better have exclusive access to this line
 
             // If child is in sharers list (this is an upgrade miss), take it out
-            if (e->sharers[childId]) {
+            if (isSharer(e, childId)) {
                 assert_msg(!e->isExclusive(), "Spurious GETX, childId=%d numSharers=%d isExcl=%d excl=%d", childId, e->numSharers, e->isExclusive(), e->exclusive);
-                e->sharers[childId] = false;
-                e->numSharers--;
+                removeSharer(e, childId);
             }
 
             // Invalidate all other copies
             respCycle = sendInvalidates(lineAddr, lineId, INV, inducedWriteback, cycle, srcId);
 
             // Set current sharer, mark exclusive
-            e->sharers[childId] = true;
-            e->numSharers++;
+            addSharer(e, childId);
             e->exclusive = true;
 
             assert(e->numSharers == 1);
@@ -26,13 +26,16 @@
 #ifndef COHERENCE_CTRLS_H_
 #define COHERENCE_CTRLS_H_
 
-#include <bitset>
+#include "bithacks.h"
 #include "constants.h"
 #include "g_std/g_string.h"
 #include "g_std/g_vector.h"
+#include "hash.h"
 #include "locks.h"
 #include "memory_hierarchy.h"
 #include "pad.h"
+#include "profile_stats.h"
+#include "snapshot.h"
 #include "stats.h"
 
 //TODO: Now that we have a pure CC interface, the MESI controllers should go on different files.
@@ -53,12 +56,16 @@ class CC : public GlobAlloc {
         virtual void endAccess(const MemReq& req) = 0;
 
         //Inv methods
-        virtual void startInv() = 0;
+        virtual void startInv(const InvReq& req) = 0;
         virtual uint64_t processInv(const InvReq& req, int32_t lineId, uint64_t startCycle) = 0;
 
         //Repl policy interface
         virtual uint32_t numSharers(uint32_t lineId) = 0;
         virtual bool isValid(uint32_t lineId) = 0;
+
+        //Snapshots (see snapshot.h)
+        virtual void saveState(SnapshotWriter& w) = 0;
+        virtual void restoreState(SnapshotReader& r) = 0;
 };
 
 
@@ -76,6 +83,78 @@ class CC : public GlobAlloc {
 class Cache;
 class Network;
 
+/* Lock for one side (top or bottom) of a coherence controller. By default, it is a single lock for the whole bank.
+ * With stripes, it is split into independent locks selected by the line's set (stripe = set hash & (stripes-1)), so
+ * accesses to different sets of a shared cache proceed in parallel. Since an access only touches its own set (its
+ * victim is in the same set), the per-line locking protocol, and thus race handling, is the same as with one lock.
+ *
+ * Each stripe sits in its own cache line and keeps its own acquisition and wait time counters, which are only
+ * updated while holding it. Only contended acquisitions are timed.
+ */
+class CCLock {
+    private:
+        struct Stripe {
+            uint64_t acquires;
+            uint64_t contended;
+            uint64_t waitNs;
+            lock_t lock;
+            PAD_SZ(3*sizeof(uint64_t) + sizeof(lock_t));
+        };
+
+        Stripe* stripes;
+        uint32_t stripeMask;
+        HashFamily* hf; //the array's set hash, only used if striped
+
+    public:
+        CCLock(uint32_t numStripes, HashFamily* _hf) : stripeMask(numStripes - 1), hf(_hf) {
+            assert(isPow2(numStripes));
+            assert(numStripes == 1 || hf);
+            stripes = gm_memalign<Stripe>(CACHE_LINE_BYTES, numStripes);
+            for (uint32_t i = 0; i < numStripes; i++) {
+                futex_init(&stripes[i].lock);
+                stripes[i].acquires = 0;
+                stripes[i].contended = 0;
+                stripes[i].waitNs = 0;
+            }
+        }
+
+        inline bool isStriped() const {
+            return stripeMask;
+        }
+
+        inline lock_t* get(Address lineAddr) {
+            return &getStripe(lineAddr)->lock;
+        }
+
+        inline void lock(Address lineAddr) {
+            Stripe* s = getStripe(lineAddr);
+            if (unlikely(!(s->lock == 0 && __sync_bool_compare_and_swap(&s->lock, 0, 1)))) {
+                uint64_t startNs = getNs();
+                futex_lock(&s->lock);
+                s->waitNs += getNs() - startNs;
+                s->contended++;
+            }
+            s->acquires++;
+        }
+
+        inline void unlock(Address lineAddr) {
+            futex_unlock(&getStripe(lineAddr)->lock);
+        }
+
+        void initStats(AggregateStat* parentStat, const char* name, const char* desc);
+
+    private:
+        inline Stripe* getStripe(Address lineAddr) {
+            return &stripes[stripeMask? (hf->hash(0, lineAddr) & stripeMask) : 0];
+        }
+
+        uint64_t sum(uint64_t Stripe::* field) const {
+            uint64_t res = 0;
+            for (uint32_t i = 0; i <= stripeMask; i++) res += stripes[i].*field;
+            return res;
+        }
+};
+
 /* NOTE: To avoid virtual function overheads, there is no BottomCC interface, since we only have a MESI controller for now */
 
 class MESIBottomCC : public GlobAlloc {
@@ -96,17 +175,16 @@ class MESIBottomCC : public GlobAlloc {
 
         bool nonInclusiveHack;
 
-        PAD();
-        lock_t ccLock;
-        PAD();
+        CCLock ccLock;
 
     public:
-        MESIBottomCC(uint32_t _numLines, uint32_t _selfId, bool _nonInclusiveHack) : numLines(_numLines), selfId(_selfId), nonInclusiveHack(_nonInclusiveHack) {
+        MESIBottomCC(uint32_t _numLines, uint32_t _selfId, bool _nonInclusiveHack, uint32_t lockStripes = 1, HashFamily* stripeHash = nullptr)
+            : numLines(_numLines), selfId(_selfId), nonInclusiveHack(_nonInclusiveHack), ccLock(lockStripes, stripeHash)
+        {
             array = gm_calloc<MESIState>(numLines);
             for (uint32_t i = 0; i < numLines; i++) {
                 array[i] = I;
             }
-            futex_init(&ccLock);
         }
 
         void init(const g_vector<MemObject*>& _parents, Network* network, const char* name);
@@ -142,9 +220,11 @@ class MESIBottomCC : public GlobAlloc {
             parentStat->append(&profFWD);
             parentStat->append(&profGETNextLevelLat);
             parentStat->append(&profGETNetLat);
+
+            ccLock.initStats(parentStat, "botLock", "Bottom CC lock (held while accessing this cache and on invalidates)");
         }
 
-        uint64_t processEviction(Address wbLineAddr, uint32_t lineId, bool lowerLevelWriteback, uint64_t cycle, uint32_t srcId);
+        uint64_t processEviction(Address wbLineAddr, uint32_t lineId, bool lowerLevelWriteback, uint64_t cycle, uint32_t srcId, uint32_t flags);
 
         uint64_t processAccess(Address lineAddr, uint32_t lineId, AccessType type, uint64_t cycle, uint32_t srcId, uint32_t flags);
 
@@ -154,12 +234,12 @@ class MESIBottomCC : public GlobAlloc {
 
         uint64_t processNonInclusiveWriteback(Address lineAddr, AccessType type, uint64_t cycle, MESIState* state, uint32_t srcId, uint32_t flags);
 
-        inline void lock() {
-            futex_lock(&ccLock);
+        inline void lock(Address lineAddr) {
+            ccLock.lock(lineAddr);
         }
 
-        inline void unlock() {
-            futex_unlock(&ccLock);
+        inline void unlock(Address lineAddr) {
+            ccLock.unlock(lineAddr);
         }
 
         /* Replacement policy query interface */
@@ -169,24 +249,45 @@ class MESIBottomCC : public GlobAlloc {
 
         //Could extend with isExclusive, isDirty, etc, but not needed for now.
 
+        void saveState(SnapshotWriter& w) {
+            w.putArray(array, numLines);
+        }
+
+        void restoreState(SnapshotReader& r) {
+            r.getArray(array, numLines, "lines");
+        }
+
     private:
         uint32_t getParentId(Address lineAddr);
+
+        //With striped locks, accesses to different sets update stats concurrently
+        inline void prof(Counter& c, uint64_t delta = 1) {
+            if (unlikely(ccLock.isStriped())) c.atomicInc(delta);
+            else c.inc(delta);
+        }
 };
 
 
 //Implements the "top" part: Keeps directory information, handles downgrades and invalidates
 class MESITopCC : public GlobAlloc {
     private:
+        /* Sharer sets use a limited-pointer format: most lines have zero or one sharers, so each entry holds up
+         * to DIR_PTRS child ids inline (sorted, so invalidates go out in child order), and switches to a
+         * full bitmap from a per-directory pool when it overflows. The bitmap is returned to the pool when the
+         * line has no sharers left. This keeps entries at 12 bytes regardless of the number of children.
+         */
+        static const uint32_t DIR_PTRS = 4;
+        static const uint32_t POOL_CHUNK_BITS = 6; //bitmaps per pool chunk, log2
+        static_assert(MAX_CACHE_CHILDREN <= (1 << 16), "Sharer pointers are 16 bits");
+
         struct Entry {
-            uint32_t numSharers;
-            std::bitset<MAX_CACHE_CHILDREN> sharers;
+            uint16_t numSharers;
             bool exclusive;
-
-            void clear() {
-                exclusive = false;
-                numSharers = 0;
-                sharers.reset();
-            }
+            bool overflow; //if set, sharers are in bitmap, else in ptrs
+            union {
+                uint16_t ptrs[DIR_PTRS];
+                uint32_t bitmap; //pool index
+            };
 
             bool isEmpty() {
                 return numSharers == 0;
@@ -204,22 +305,31 @@ class MESITopCC : public GlobAlloc {
 
         bool nonInclusiveHack;
 
-        PAD();
-        lock_t ccLock;
-        PAD();
+        //Overflow bitmap pool. Chunks are allocated on demand and never move; free bitmaps are linked through
+        //their first word
+        uint64_t** poolChunks;
+        uint32_t bitmapWords;
+        uint32_t poolSize; //bitmaps allocated
+        uint32_t poolUsed; //bitmaps in use
+        uint32_t poolFree; //head of the free list, or -1
+        lock_t poolLock;
+
+        CCLock ccLock;
 
     public:
-        MESITopCC(uint32_t _numLines, bool _nonInclusiveHack) : numLines(_numLines), nonInclusiveHack(_nonInclusiveHack) {
-            array = gm_calloc<Entry>(numLines);
-            for (uint32_t i = 0; i < numLines; i++) {
-                array[i].clear();
-            }
+        MESITopCC(uint32_t _numLines, bool _nonInclusiveHack, uint32_t lockStripes = 1, HashFamily* stripeHash = nullptr)
+            : numLines(_numLines), nonInclusiveHack(_nonInclusiveHack),
+              poolChunks(nullptr), bitmapWords(0), poolSize(0), poolUsed(0), poolFree(-1), ccLock(lockStripes, stripeHash)
+        {
+            array = gm_calloc<Entry>(numLines); //all zeroes is an empty entry
 
-            futex_init(&ccLock);
+            futex_init(&poolLock);
         }
 
         void init(const g_vector<BaseCache*>& _children, Network* network, const char* name);
 
+        void initStats(AggregateStat* parentStat);
+
         uint64_t processEviction(Address wbLineAddr, uint32_t lineId, bool* reqWriteback, uint64_t cycle, uint32_t srcId);
 
         uint64_t processAccess(Address lineAddr, uint32_t lineId, AccessType type, uint32_t childId, bool haveExclusive,
@@ -227,12 +337,12 @@ class MESITopCC : public GlobAlloc {
 
         uint64_t processInval(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId);
 
-        inline void lock() {
-            futex_lock(&ccLock);
+        inline void lock(Address lineAddr) {
+            ccLock.lock(lineAddr);
         }
 
-        inline void unlock() {
-            futex_unlock(&ccLock);
+        inline void unlock(Address lineAddr) {
+            ccLock.unlock(lineAddr);
         }
 
         /* Replacement policy query interface */
@@ -240,8 +350,58 @@ class MESITopCC : public GlobAlloc {
             return array[lineId].numSharers;
         }
 
+        //Host memory used by sharer sets, including the overflow pool
+        uint64_t getDirBytes() const {
+            uint32_t chunkBitmaps = 1 << POOL_CHUNK_BITS;
+            uint64_t chunks = (poolSize + chunkBitmaps - 1) / chunkBitmaps;
+            return numLines*sizeof(Entry) + chunks*chunkBitmaps*bitmapWords*sizeof(uint64_t);
+        }
+
+        //Sharers are saved as lists of child ids
+        void saveState(SnapshotWriter& w);
+        void restoreState(SnapshotReader& r);
+
     private:
         uint64_t sendInvalidates(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId);
+
+        //Sharer set manipulation; these keep numSharers up to date
+        inline uint64_t* getBitmap(uint32_t idx) {
+            return &poolChunks[idx >> POOL_CHUNK_BITS][(idx & ((1 << POOL_CHUNK_BITS) - 1))*bitmapWords];
+        }
+
+        inline bool isSharer(Entry* e, uint32_t childId) {
+            if (e->overflow) {
+                return (getBitmap(e->bitmap)[childId/64] >> (childId % 64)) & 1;
+            } else {
+                for (uint32_t i = 0; i < e->numSharers; i++) {
+                    if (e->ptrs[i] == childId) return true;
+                }
+                return false;
+            }
+        }
+
+        void addSharer(Entry* e, uint32_t childId);
+        void removeSharer(Entry* e, uint32_t childId);
+        void clearEntry(Entry* e);
+
+        uint32_t allocBitmap();
+        void freeBitmap(uint32_t idx);
+
+        //Calls f(childId) for every sharer, in increasing child order
+        template <typename F> inline void forEachSharer(Entry* e, F f) {
+            if (e->overflow) {
+                uint64_t* bitmap = getBitmap(e->bitmap);
+                for (uint32_t w = 0; w < bitmapWords; w++) {
+                    uint64_t bits = bitmap[w];
+                    while (bits) {
+                        f(w*64 + __builtin_ctzl(bits));
+                        bits &= bits - 1;
+                    }
+                }
+            } else {
+                for (uint32_t i = 0; i < e->numSharers; i++) f(e->ptrs[i]);
+            }
+        }
 };
 
 static inline bool CheckForMESIRace(AccessType& type, MESIState* state, MESIState initialState) {
@@ -282,24 +442,35 @@ class MESICC : public CC {
         bool nonInclusiveHack;
         g_string name;
 
+        uint32_t lockStripes;
+        HashFamily* stripeHash;
+
     public:
         //Initialization
         MESICC(uint32_t _numLines, bool _nonInclusiveHack, g_string& _name) : tcc(nullptr), bcc(nullptr),
-            numLines(_numLines), nonInclusiveHack(_nonInclusiveHack), name(_name) {}
+            numLines(_numLines), nonInclusiveHack(_nonInclusiveHack), name(_name), lockStripes(1), stripeHash(nullptr) {}
+
+        //Splits the top and bottom locks in stripes by set (see CCLock). Call before setParents/setChildren.
+        //setHash must be the array's set hash, and the array must not spread a set's candidates across stripes.
+        void setLockStripes(uint32_t _lockStripes, HashFamily* setHash) {
+            assert(!tcc && !bcc);
+            lockStripes = _lockStripes;
+            stripeHash = setHash;
+        }
 
         void setParents(uint32_t childId, const g_vector<MemObject*>& parents, Network* network) {
-            bcc = new MESIBottomCC(numLines, childId, nonInclusiveHack);
+            bcc = new MESIBottomCC(numLines, childId, nonInclusiveHack, lockStripes, stripeHash);
             bcc->init(parents, network, name.c_str());
         }
 
         void setChildren(const g_vector<BaseCache*>& children, Network* network) {
-            tcc = new MESITopCC(numLines, nonInclusiveHack);
+            tcc = new MESITopCC(numLines, nonInclusiveHack, lockStripes, stripeHash);
             tcc->init(children, network, name.c_str());
         }
 
         void initStats(AggregateStat* cacheStat) {
-            //no tcc stats
             bcc->initStats(cacheStat);
+            tcc->initStats(cacheStat);
         }
 
         //Access methods
@@ -314,8 +485,8 @@ class MESICC : public CC {
                 futex_unlock(req.childLock);
             }
 
-            tcc->lock(); //must lock tcc FIRST
-            bcc->lock();
+            tcc->lock(req.lineAddr); //must lock tcc FIRST
+            bcc->lock(req.lineAddr);
 
             /* The situation is now stable, true race-wise. No one can touch the child state, because we hold
              * both parent's locks. So, we first handle races, which may cause us to skip the access.
@@ -340,7 +511,7 @@ class MESICC : public CC {
         uint64_t processEviction(const MemReq& triggerReq, Address wbLineAddr, int32_t lineId, uint64_t startCycle) {
             bool lowerLevelWriteback = false;
             uint64_t evCycle = tcc->processEviction(wbLineAddr, lineId, &lowerLevelWriteback, startCycle, triggerReq.srcId); //1. if needed, send invalidates/downgrades to lower level
-            evCycle = bcc->processEviction(wbLineAddr, lineId, lowerLevelWriteback, evCycle, triggerReq.srcId); //2. if needed, write back line to upper level
+            evCycle = bcc->processEviction(wbLineAddr, lineId, lowerLevelWriteback, evCycle, triggerReq.srcId, triggerReq.flags & MemReq::WARMUP); //2. if needed, write back line to upper level
             return evCycle;
         }
 
@@ -385,26 +556,38 @@ class MESICC : public CC {
                 futex_lock(req.childLock);
             }
 
-            bcc->unlock();
-            tcc->unlock();
+            bcc->unlock(req.lineAddr);
+            tcc->unlock(req.lineAddr);
         }
 
         //Inv methods
-        void startInv() {
-            bcc->lock(); //note we don't grab tcc; tcc serializes multiple up accesses, down accesses don't see it
+        void startInv(const InvReq& req) {
+            bcc->lock(req.lineAddr); //note we don't grab tcc; tcc serializes multiple up accesses, down accesses don't see it
         }
 
         uint64_t processInv(const InvReq& req, int32_t lineId, uint64_t startCycle) {
             uint64_t respCycle = tcc->processInval(req.lineAddr, lineId, req.type, req.writeback, startCycle, req.srcId); //send invalidates or downgrades to children
             bcc->processInval(req.lineAddr, lineId, req.type, req.writeback); //adjust our own state
 
-            bcc->unlock();
+            bcc->unlock(req.lineAddr);
             return respCycle;
         }
 
         //Repl policy interface
         uint32_t numSharers(uint32_t lineId) {return tcc->numSharers(lineId);}
         bool isValid(uint32_t lineId) {return bcc->isValid(lineId);}
+
+        void saveState(SnapshotWriter& w) {
+            w.putTag("MESI");
+            bcc->saveState(w);
+            tcc->saveState(w);
+        }
+
+        void restoreState(SnapshotReader& r) {
+            r.expectTag("MESI");
+            bcc->restoreState(r);
+            tcc->restoreState(r);
+        }
 };
 
 // Terminal CC, i.e., without children --- accepts GETS/X, but not PUTS/X
@@ -443,7 +626,7 @@ class MESITerminalCC : public CC {
                 futex_unlock(req.childLock);
             }
 
-            bcc->lock();
+            bcc->lock(req.lineAddr);
 
             /* The situation is now stable, true race-wise. No one can touch the child state, because we hold
              * both parent's locks. So, we first handle races, which may cause us to skip the access.
@@ -458,7 +641,7 @@ class MESITerminalCC : public CC {
 
         uint64_t processEviction(const MemReq& triggerReq, Address wbLineAddr, int32_t lineId, uint64_t startCycle) {
             bool lowerLevelWriteback = false;
-            uint64_t endCycle = bcc->processEviction(wbLineAddr, lineId, lowerLevelWriteback, startCycle, triggerReq.srcId); //2. if needed, write back line to upper level
+            uint64_t endCycle = bcc->processEviction(wbLineAddr, lineId, lowerLevelWriteback, startCycle, triggerReq.srcId, triggerReq.flags & MemReq::WARMUP); //2. if needed, write back line to upper level
             return endCycle;  // critical path unaffected, but TimingCache needs it
         }
 
@@ -476,23 +659,33 @@ class MESITerminalCC : public CC {
             if (req.childLock) {
                 futex_lock(req.childLock);
             }
-            bcc->unlock();
+            bcc->unlock(req.lineAddr);
         }
 
         //Inv methods
-        void startInv() {
-            bcc->lock();
+        void startInv(const InvReq& req) {
+            bcc->lock(req.lineAddr);
         }
 
         uint64_t processInv(const InvReq& req, int32_t lineId, uint64_t startCycle) {
             bcc->processInval(req.lineAddr, lineId, req.type, req.writeback); //adjust our own state
-            bcc->unlock();
+            bcc->unlock(req.lineAddr);
             return startCycle; //no extra delay in terminal caches
         }
 
         //Repl policy interface
         uint32_t numSharers(uint32_t lineId) {return 0;} //no sharers
         bool isValid(uint32_t lineId) {return bcc->isValid(lineId);}
+
+        void saveState(SnapshotWriter& w) {
+            w.putTag("MESITerminal");
+            bcc->saveState(w);
+        }
+
+        void restoreState(SnapshotReader& r) {
+            r.expectTag("MESITerminal");
+            bcc->restoreState(r);
+        }
 };
 
 #endif  // COHERENCE_CTRLS_H_
@@ -31,12 +31,17 @@
 #include <typeinfo>
 #include <unordered_map>
 #include <vector>
+#include "core.h"
+#include "cpu_affinity.h"
 #include "log.h"
-#include "ooo_core.h"
-#include "timing_core.h"
+#include "rdtsc.h"
 #include "timing_event.h"
+#include "weave_capture.h"
 #include "zsim.h"
 
+//Owner value of domains that have finished the current phase (work stealing only)
+#define DOMAIN_DONE ((uint32_t)-1)
+
 //Set to 1 to produce a post-mortem analysis log
 #define POST_MORTEM 0
 //#define POST_MORTEM 1
@@ -58,13 +63,25 @@ void ContentionSim::SimThreadTrampoline(void* arg) {
     csim->simThreadLoop(thid);
 }
 
-ContentionSim::ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads) {
+ContentionSim::ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads, bool _stealing, bool _pipelined, uint32_t _xingSampleRate) {
     numDomains = _numDomains;
     numSimThreads = _numSimThreads;
+    stealing = _stealing;
+    pipelined = _pipelined;
+    xingSampleRate = _xingSampleRate;
+    if (numDomains > (1 << 15)) panic("%d domains, TimingEvent supports up to %d", numDomains, 1 << 15);
     threadsDone = 0;
     limit = 0;
+    lastSimCycle = 0;
     lastLimit = 0;
+    weaveStart = 0;
     inCSim = false;
+    weaveInFlight = false;
+    capture = nullptr;
+    wakeSpins = 0;
+    waitSpins = 0;
+    wakeNs = 0;
+    doneNs = 0;
 
     domains = gm_calloc<DomainData>(numDomains);
     simThreads = gm_calloc<SimThreadData>(numSimThreads);
@@ -72,16 +89,25 @@ ContentionSim::ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads) {
     for (uint32_t i = 0; i < numDomains; i++) {
         new (&domains[i].pq) PrioQueue<TimingEvent, PQ_BLOCKS>();
         domains[i].curCycle = 0;
-        futex_init(&domains[i].pqLock);
+        domains[i].inbox = nullptr;
+        domains[i].inboxRetries = 0;
+        domains[i].inboxTimed = 0;
+        domains[i].inboxCycles = 0;
+        domains[i].xingSampleLeft = xingSampleRate;
+        domains[i].xingSampleRng = 0x9E3779B97F4A7C15ull * (i + 1);
     }
 
-    if ((numDomains % numSimThreads) != 0) panic("numDomains(%d) must be a multiple of numSimThreads(%d) for now", numDomains, numSimThreads);
+    //NOTE: Without stealing, threads get contiguous ranges of domains, which may be uneven if numSimThreads does not divide numDomains
+    if (!stealing && (numDomains % numSimThreads) != 0) {
+        warn("numDomains(%d) is not a multiple of numSimThreads(%d), weave load will be unbalanced; consider sim.contentionStealing", numDomains, numSimThreads);
+    }
 
     for (uint32_t i = 0; i < numSimThreads; i++) {
         futex_init(&simThreads[i].wakeLock);
         futex_lock(&simThreads[i].wakeLock); //starts locked, so first actual call to lock blocks
         simThreads[i].firstDomain = i*numDomains/numSimThreads;
         simThreads[i].supDomain = (i+1)*numDomains/numSimThreads;
+        simThreads[i].cpu = -1;
     }
 
     futex_init(&waitLock);
@@ -97,18 +123,14 @@ ContentionSim::ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads) {
         PIN_SpawnInternalThread(SimThreadTrampoline, this, 1024*1024, nullptr);
     }
 
-    lastCrossing = gm_calloc<CrossingEventInfo>(numDomains*numDomains*MAX_THREADS); //TODO: refine... this allocs too much
+    //Sources are the cores' event recorders, and srcIds are core indices
+    numSources = MAX(zinfo->numCores, (uint32_t)1);
+    lastCrossing = gm_calloc<CrossingEventInfo*>(numSources*numDomains);
 }
 
 void ContentionSim::postInit() {
     for (uint32_t i = 0; i < zinfo->numCores; i++) {
-        TimingCore* tcore = dynamic_cast<TimingCore*>(zinfo->cores[i]);
-        if (tcore) {
-            skipContention = false;
-            return;
-        }
-        OOOCore* ocore = dynamic_cast<OOOCore*>(zinfo->cores[i]);
-        if (ocore) {
+        if (zinfo->cores[i]->getEventRecorder()) {
             skipContention = false;
             return;
         }
@@ -124,70 +146,199 @@ void ContentionSim::initStats(AggregateStat* parentStat) {
         ss << "domain-" << i;
         AggregateStat* domStat = new AggregateStat();
         domStat->init(gm_strdup(ss.str().c_str()), "Domain stats");
-#if PROFILE_CROSSINGS
-        new (&domains[i].profIncomingCrossings) VectorCounter();
-        new (&domains[i].profIncomingCrossingSims) VectorCounter();
-        new (&domains[i].profIncomingCrossingHist) VectorCounter();
-        domains[i].profIncomingCrossings.init("ixe", "Incoming crossing events", numDomains);
-        domains[i].profIncomingCrossingSims.init("ixs", "Incoming crossings simulated but held", numDomains);
-        domains[i].profIncomingCrossingHist.init("ixh", "Incoming crossings held count histogram", 33 /*32 means >31*/);
-        domStat->append(&domains[i].profIncomingCrossings);
-        domStat->append(&domains[i].profIncomingCrossingSims);
-        domStat->append(&domains[i].profIncomingCrossingHist);
-#endif
+        if (xingSampleRate) {
+            //All sampled; multiply by xingSampleRate to estimate totals
+            new (&domains[i].profIncomingCrossings) VectorCounter();
+            new (&domains[i].profIncomingCrossingSims) VectorCounter();
+            new (&domains[i].profIncomingCrossingHist) VectorCounter();
+            new (&domains[i].profIncomingCrossingLag) VectorCounter();
+            domains[i].profIncomingCrossings.init("ixe", "Incoming crossings per source domain (sampled)", numDomains);
+            domains[i].profIncomingCrossingSims.init("ixs", "Times incoming crossings were held, per source domain (sampled)", numDomains);
+            domains[i].profIncomingCrossingHist.init("ixh", "Incoming crossings by times held (sampled, last bucket is 32 or more)", XING_HOLD_BUCKETS);
+            domains[i].profIncomingCrossingLag.init("ixl", "Incoming crossings by cycles simulated after the source finished, bucket i+1 is [2^i, 2^(i+1)) (sampled)", XING_LAG_BUCKETS);
+            domStat->append(&domains[i].profIncomingCrossings);
+            domStat->append(&domains[i].profIncomingCrossingSims);
+            domStat->append(&domains[i].profIncomingCrossingHist);
+            domStat->append(&domains[i].profIncomingCrossingLag);
+        }
         new (&domains[i].profTime) ClockStat();
         domains[i].profTime.init("time", "Weave simulation time");
         domStat->append(&domains[i].profTime);
+        new (&domains[i].profInboxEvents) Counter();
+        new (&domains[i].profInboxRetries) ProxyStat();
+        domains[i].profInboxEvents.init("syncEnqs", "Bound-phase events enqueued through the inbox");
+        domains[i].profInboxRetries.init("syncRetries", "Inbox pushes retried due to concurrent bound-phase enqueues", &domains[i].inboxRetries);
+        domStat->append(&domains[i].profInboxEvents);
+        domStat->append(&domains[i].profInboxRetries);
+        new (&domains[i].profInboxTimed) ProxyStat();
+        new (&domains[i].profInboxCycles) ProxyStat();
+        domains[i].profInboxTimed.init("syncTimed", "Bound-phase inbox pushes sampled for syncCycles", &domains[i].inboxTimed);
+        domains[i].profInboxCycles.init("syncCycles", "Host TSC cycles spent pushing sampled events to the inbox (CAS loop, including retries)", &domains[i].inboxCycles);
+        domStat->append(&domains[i].profInboxTimed);
+        domStat->append(&domains[i].profInboxCycles);
+        new (&domains[i].profCrossings) Counter();
+        new (&domains[i].profCrossingHolds) Counter();
+        domains[i].profCrossings.init("xings", "Incoming crossings simulated");
+        domains[i].profCrossingHolds.init("xingHolds", "Times an incoming crossing was held waiting for its source domain");
+        domStat->append(&domains[i].profCrossings);
+        domStat->append(&domains[i].profCrossingHolds);
+        new (&domains[i].profChildren) VectorCounter();
+        domains[i].profChildren.init("childHist", "Children per finished event (last bucket is 8 or more)", CHILD_HIST_BUCKETS);
+        domStat->append(&domains[i].profChildren);
+        if (stealing) {
+            new (&domains[i].profSteals) Counter();
+            domains[i].profSteals.init("steals", "Times this domain was stolen by an idle weave thread");
+            domStat->append(&domains[i].profSteals);
+        }
         objStat->append(domStat);
     }
+    new (&profWakeLat) Counter();
+    new (&profWakeLatHist) VectorCounter();
+    new (&profDoneLat) Counter();
+    new (&profDoneLatHist) VectorCounter();
+    profWakeLat.init("wakeLat", "Time from the phase driver waking up weave threads to them running (ns, summed over threads)");
+    profWakeLatHist.init("wakeLatHist", "Weave thread wakeups by latency, bucket i+1 is [2^i, 2^(i+1)) ns", HANDOFF_LAT_BUCKETS);
+    profDoneLat.init("doneLat", "Time from the last weave thread finishing a phase to the waiting phase driver running (ns, only phases the driver waited for)");
+    profDoneLatHist.init("doneLatHist", "Weave phases the driver waited for, by driver wakeup latency, bucket i+1 is [2^i, 2^(i+1)) ns", HANDOFF_LAT_BUCKETS);
+    objStat->append(&profWakeLat);
+    objStat->append(&profWakeLatHist);
+    objStat->append(&profDoneLat);
+    objStat->append(&profDoneLatHist);
+    if (pipelined) {
+        new (&profPipelinedPhases) Counter();
+        new (&profWeaveWait) ClockStat();
+        new (&profLateSkew) Counter();
+        profPipelinedPhases.init("pipePhases", "Weave phases overlapped with the next bound phase");
+        profWeaveWait.init("weaveWait", "Time the phase driver waited for the previous weave phase");
+        profLateSkew.init("lateSkew", "Contention cycles applied to cores one phase late");
+        objStat->append(&profPipelinedPhases);
+        objStat->append(&profWeaveWait);
+        objStat->append(&profLateSkew);
+    }
     parentStat->append(objStat);
 }
 
 void ContentionSim::simulatePhase(uint64_t limit) {
     if (skipContention) return; //fastpath when there are no cores to simulate
+    if (pipelined) {
+        simulatePhasePipelined(limit);
+        return;
+    }
 
     this->limit = limit;
+    lastSimCycle = limit;
     assert(limit >= lastLimit);
+    weaveStart = lastLimit;
 
     //info("simulatePhase limit %ld", limit);
-    for (uint32_t i = 0; i < zinfo->numCores; i++) {
-        TimingCore* tcore = dynamic_cast<TimingCore*>(zinfo->cores[i]);
-        if (tcore) tcore->cSimStart();
-        OOOCore* ocore = dynamic_cast<OOOCore*>(zinfo->cores[i]);
-        if (ocore) ocore->cSimStart();
-    }
+    coresSimStart();
+
+    if (stealing) rebalanceDomains();
 
     inCSim = true;
     __sync_synchronize();
 
-    //Wake up sim threads
-    for (uint32_t i = 0; i < numSimThreads; i++) {
-        futex_unlock(&simThreads[i].wakeLock);
-    }
-
-    //Sleep until phase is simulated
-    futex_lock_nospin(&waitLock);
+    wakeSimThreads();
+    waitSimThreads(); //until phase is simulated
 
     inCSim = false;
     __sync_synchronize();
 
-    for (uint32_t i = 0; i < zinfo->numCores; i++) {
-        TimingCore* tcore = dynamic_cast<TimingCore*>(zinfo->cores[i]);
-        if (tcore) tcore->cSimEnd();
-        OOOCore* ocore = dynamic_cast<OOOCore*>(zinfo->cores[i]);
-        if (ocore) ocore->cSimEnd();
-    }
+    coresSimEnd();
 
     lastLimit = limit;
     __sync_synchronize();
 }
 
+/* Pipelined weave: Instead of waiting for the weave phase to finish, the
+ * driver returns as soon as the weave threads are woken up, so the weave of
+ * phase N overlaps with the bound phase of phase N+1. At the end of N+1, the
+ * driver waits for weave N, applies its delays to the cores (so each core
+ * sees its contention delays one phase late), and starts weave N+1.
+ *
+ * The bound phase only touches events that the weave in flight cannot run:
+ * synced enqueues start at or after limit, which pipelined threads do not
+ * reach, crossings only chain to crossings of the same bound phase, and the
+ * core recorders taper or detach their event sequences at phase boundaries
+ * (see cSimStart() and notifyJoin() in CoreRecorder and OOOCoreRecorder).
+ */
+void ContentionSim::simulatePhasePipelined(uint64_t limit) {
+    assert(limit >= lastLimit);
+
+    //Collect the previous weave and feed back its delays
+    drainWeave();
+
+    //Start the weave for the bound phase that just finished
+    this->limit = limit;
+    lastSimCycle = limit - 1;
+    weaveStart = lastLimit;
+    coresSimStart();
+
+    if (stealing) rebalanceDomains();
+
+    lastLimit = limit;  // bound-phase enqueues from now on are for the next weave
+    weaveInFlight = true;
+    inCSim = true;
+    profPipelinedPhases.inc();
+    __sync_synchronize();
+
+    wakeSimThreads();
+}
+
+void ContentionSim::drainWeave() {
+    if (!__sync_bool_compare_and_swap(&weaveInFlight, true, false)) return;
+    profWeaveWait.start();
+    waitSimThreads();
+    profWeaveWait.end();
+    inCSim = false;
+    __sync_synchronize();
+    profLateSkew.inc(coresSimEnd());
+}
+
+static inline uint32_t handoffLatBucket(uint64_t ns) {
+    return MIN(ns? ilog2(ns)+1 : 0, (uint32_t)HANDOFF_LAT_BUCKETS-1);
+}
+
+void ContentionSim::wakeSimThreads() {
+    wakeNs = getNs();
+    for (uint32_t i = 0; i < numSimThreads; i++) {
+        futex_unlock(&simThreads[i].wakeLock);
+    }
+}
+
+void ContentionSim::waitSimThreads() {
+    //If the weave already finished (e.g., with sim.pipelinedWeave, while the bound phase ran), the time since doneNs
+    //is overlap, not handoff latency, so only phases where the driver actually waits count towards doneLat
+    bool weaveDone = waitLock == 0 && __sync_bool_compare_and_swap(&waitLock, 0, 1);
+    if (!weaveDone) {
+        futex_lock_spin(&waitLock, waitSpins);
+        uint64_t doneLat = getNs() - doneNs;
+        profDoneLat.inc(doneLat);
+        profDoneLatHist.inc(handoffLatBucket(doneLat));
+    }
+    for (uint32_t i = 0; i < numSimThreads; i++) {
+        uint64_t wakeLat = simThreads[i].wakeLatNs;
+        profWakeLat.inc(wakeLat);
+        profWakeLatHist.inc(handoffLatBucket(wakeLat));
+    }
+}
+
+void ContentionSim::coresSimStart() {
+    for (uint32_t i = 0; i < zinfo->numCores; i++) zinfo->cores[i]->cSimStart();
+}
+
+uint64_t ContentionSim::coresSimEnd() {
+    uint64_t skew = 0;
+    for (uint32_t i = 0; i < zinfo->numCores; i++) skew += zinfo->cores[i]->cSimEnd();
+    return skew;
+}
+
 void ContentionSim::enqueue(TimingEvent* ev, uint64_t cycle) {
     assert(inCSim);
     assert(ev);
-    assert_msg(cycle >= lastLimit, "Enqueued event before last limit! cycle %ld min %ld", cycle, lastLimit);
+    assert_msg(cycle >= weaveStart, "Enqueued event before last limit! cycle %ld min %ld", cycle, weaveStart);
     //Hacky, but helpful to chase events scheduled too far ahead due to bugs (e.g., cycle -1). We should probably formalize this a bit more
-    assert_msg(cycle < lastLimit+10*zinfo->phaseLength+1000000, "Queued event too far into the future, cycle %ld lastLimit %ld", cycle, lastLimit);
+    assert_msg(cycle < weaveStart+10*zinfo->maxPhaseLength+1000000, "Queued event too far into the future, cycle %ld lastLimit %ld", cycle, weaveStart);
 
     assert_msg(cycle >= domains[ev->domain].curCycle, "Queued event goes back in time, cycle %ld curCycle %ld", cycle, domains[ev->domain].curCycle);
     ev->privCycle = cycle;
@@ -199,21 +350,71 @@ void ContentionSim::enqueue(TimingEvent* ev, uint64_t cycle) {
 }
 
 void ContentionSim::enqueueSynced(TimingEvent* ev, uint64_t cycle) {
-    assert(!inCSim);
+    assert(!inCSim || pipelined);
     assert(ev && ev->domain != -1);
     assert(ev->domain < (int32_t)numDomains);
-    uint32_t domain = ev->domain;
-
-    futex_lock(&domains[domain].pqLock);
 
     assert_msg(cycle >= lastLimit, "Enqueued (synced) event before last limit! cycle %ld min %ld", cycle, lastLimit);
     //Hacky, but helpful to chase events scheduled too far ahead due to bugs (e.g., cycle -1). We should probably formalize this a bit more
-    assert_msg(cycle < lastLimit+10*zinfo->phaseLength+10000, "Queued  (synced) event too far into the future, cycle %ld lastLimit %ld", cycle, lastLimit);
+    assert_msg(cycle < lastLimit+10*zinfo->maxPhaseLength+10000, "Queued  (synced) event too far into the future, cycle %ld lastLimit %ld", cycle, lastLimit);
     ev->privCycle = cycle;
     assert(ev->numParents == 0);
-    domains[ev->domain].pq.enqueue(ev, cycle);
 
-    futex_unlock(&domains[domain].pqLock);
+    //Push to the domain's inbox; many cores may be enqueuing on the same domain, so this is lock-free
+    //Only 1 in SYNC_TIMING_SAMPLE pushes is timed, picked by a hash of event address and cycle, so untimed pushes need
+    //no rdtsc's or extra atomics, and timed ones write the domain's stats, not the inbox line
+    DomainData& dom = domains[ev->domain];
+    bool timed = (((((uintptr_t)ev) >> 6) ^ cycle) * 0x9E3779B97F4A7C15ull) < (~0ull / SYNC_TIMING_SAMPLE);
+    uint64_t startTsc = 0;
+    if (unlikely(timed)) startTsc = rdtsc();
+    TimingEvent* head = dom.inbox;
+    while (true) {
+        ev->next = head;
+        TimingEvent* prev = __sync_val_compare_and_swap(&dom.inbox, head, ev);
+        if (prev == head) break;
+        head = prev;
+        __sync_fetch_and_add(&dom.inboxRetries, 1);
+    }
+    if (unlikely(timed)) {
+        __sync_fetch_and_add(&dom.inboxTimed, 1);
+        __sync_fetch_and_add(&dom.inboxCycles, rdtsc() - startTsc);
+    }
+}
+
+//Must be called by the thread simulating the domain, before it looks at the PQ
+inline void ContentionSim::drainInbox(DomainData* dom) {
+    if (!dom->inbox) return;
+    TimingEvent* ev = __sync_lock_test_and_set(&dom->inbox, nullptr);
+
+    //The inbox is LIFO; reverse it so that same-cycle events enter the PQ in enqueue order
+    TimingEvent* fifo = nullptr;
+    while (ev) {
+        TimingEvent* next = ev->next;
+        ev->next = fifo;
+        fifo = ev;
+        ev = next;
+    }
+
+    uint64_t events = 0;
+    while (fifo) {
+        TimingEvent* next = fifo->next;
+        fifo->next = nullptr;
+        assert(fifo->privCycle >= dom->curCycle);
+        if (unlikely(capture != nullptr)) capture->recordRoot(fifo, fifo->privCycle);
+        dom->pq.enqueue(fifo, fifo->privCycle);
+        fifo = next;
+        events++;
+    }
+    dom->profInboxEvents.inc(events);
+}
+
+//Rows are only touched by enqueueCrossing() calls of the same source, which are serialized, so allocation needs no sync
+inline ContentionSim::CrossingEventInfo* ContentionSim::getLastCrossing(uint32_t srcId, uint32_t srcDomain, uint32_t dstDomain) {
+    assert_msg(srcId < numSources, "Crossing from srcId %d, only %d sources", srcId, numSources);
+    assert(srcDomain < numDomains && dstDomain < numDomains);
+    CrossingEventInfo*& row = lastCrossing[srcId*numDomains + srcDomain];
+    if (unlikely(!row)) row = gm_calloc<CrossingEventInfo>(numDomains);
+    return &row[dstDomain];
 }
 
 void ContentionSim::enqueueCrossing(CrossingEvent* ev, uint64_t cycle, uint32_t srcId, uint32_t srcDomain, uint32_t dstDomain, EventRecorder* evRec) {
@@ -236,9 +437,11 @@ void ContentionSim::enqueueCrossing(CrossingEvent* ev, uint64_t cycle, uint32_t
     if (isResp) {
         req->parentEv->addChild(ev, evRec);
     } else {
-        CrossingEventInfo* last = &lastCrossing[(srcId*numDomains + srcDomain)*numDomains + dstDomain];
+        CrossingEventInfo* last = getLastCrossing(srcId, srcDomain, dstDomain);
         uint64_t srcDomCycle = domains[srcDomain].curCycle;
-        if (last->cycle > srcDomCycle && last->cycle <= cycle) { //NOTE: With the OOO model, last->cycle > cycle is now possible, since requests are issued in instruction order -> ooo
+        //With a pipelined weave, crossings from past phases may be running concurrently even if they are ahead of srcDomCycle
+        bool chainable = pipelined? (last->ev && last->phase == zinfo->numPhases) : (last->cycle > srcDomCycle);
+        if (chainable && last->cycle <= cycle) { //NOTE: With the OOO model, last->cycle > cycle is now possible, since requests are issued in instruction order -> ooo
             //Chain to previous req
             assert_msg(last->cycle <= cycle, "last->cycle (%ld) > cycle (%ld)", last->cycle, cycle);
             last->ev->addChild(ev, evRec);
@@ -251,47 +454,68 @@ void ContentionSim::enqueueCrossing(CrossingEvent* ev, uint64_t cycle, uint32_t
         //Store this one as the last req
         last->cycle = cycle;
         last->ev = ev;
+        last->phase = zinfo->numPhases;
     }
 }
 
 void ContentionSim::simThreadLoop(uint32_t thid) {
     info("Started contention simulation thread %d", thid);
-#if 0
-    //Pin
-    uint32_t nprocs = sysconf(_SC_NPROCESSORS_ONLN);
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    //CPU_SET(domain % nprocs, cpuset); //basically no difference
-    //CPU_SET(0, cpuset); CPU_SET(1, cpuset); CPU_SET(2, cpuset); CPU_SET(3, cpuset); //don't use hyperthreads; confuses the scheduler to no end, does worse
-    CPU_SET(thid % nprocs, &cpuset); CPU_SET((thid % nprocs) + (nprocs/2), &cpuset); //pin to a single core but can use both its hyperthreads, works best (~20% gain)
-    //TODO: Must make this optional, or multiple simulations/machine will work horribly
-    int r = sched_setaffinity(0 /*calling thread, equiv to syscall(SYS_gettid)*/, sizeof(cpuset), &cpuset);
-    assert_msg(r == 0, "sched_setaffinity failed (%d)", r);
-#endif
+    bool placed = false;
     while (true) {
-        futex_lock_nospin(&simThreads[thid].wakeLock);
+        futex_lock_spin(&simThreads[thid].wakeLock, wakeSpins);
 
         if (terminate) {
             break;
         }
+        simThreads[thid].wakeLatNs = getNs() - wakeNs;
+
+        if (unlikely(!placed)) {
+            placeThread(thid);
+            placed = true;
+        }
 
         //info("%d --- phase start", domain);
-        simulatePhaseThread(thid);
+        if (unlikely(capture != nullptr)) capture->beginPhase(limit);
+        if (stealing) simulatePhaseThreadStealing(thid);
+        else simulatePhaseThread(thid);
         //info("%d --- phase end", domain);
 
         uint32_t val = __sync_add_and_fetch(&threadsDone, 1);
         if (val == numSimThreads) {
             threadsDone = 0;
+            if (unlikely(capture != nullptr)) capture->endPhase();
+            doneNs = getNs();
             futex_unlock(&waitLock); //unblock caller
         }
     }
     info("Finished contention simulation thread %d", thid);
 }
 
+void ContentionSim::setThreadCpus(const std::vector<int32_t>& cpus) {
+    assert(cpus.empty() || cpus.size() == numSimThreads);
+    for (uint32_t i = 0; i < cpus.size(); i++) simThreads[i].cpu = cpus[i];
+}
+
+void ContentionSim::placeThread(uint32_t thid) {
+    int32_t cpu = simThreads[thid].cpu;
+    if (cpu < 0 || !PinCurrentThread(cpu)) return;
+    //Most of a domain is its PrioQueue, so have its pages local to the thread that simulates it. With stealing,
+    //this is the static assignment, which the rebalanced and stolen ones only approximate. Domains are in the shared
+    //heap and already touched, so this only has an effect if we may move shared pages (see BindToLocalNode)
+    uint32_t first = simThreads[thid].firstDomain;
+    uint32_t sup = simThreads[thid].supDomain;
+    for (uint32_t i = first; i < sup; i++) BindToLocalNode(&domains[i], sizeof(DomainData));
+    info("Contention simulation thread %d pinned to CPU %d, domains [%d, %d)", thid, cpu, first, sup);
+}
+
 void ContentionSim::simulatePhaseThread(uint32_t thid) {
     uint32_t thDomains = simThreads[thid].supDomain - simThreads[thid].firstDomain;
     uint32_t numFinished = 0;
 
+    for (uint32_t i = simThreads[thid].firstDomain; i < simThreads[thid].supDomain; i++) {
+        drainInbox(&domains[i]);
+    }
+
     if (thDomains == 1) {
         DomainData& domain = domains[simThreads[thid].firstDomain];
         domain.profTime.start();
@@ -305,6 +529,7 @@ void ContentionSim::simulatePhaseThread(uint32_t thid) {
                 domCycle = cycle;
                 domain.curCycle = cycle;
             }
+            if (unlikely(capture != nullptr)) capture->recordRun(te, cycle);
             te->run(cycle);
             uint64_t newCycle = pq.size()? pq.firstCycle() : limit;
             assert(newCycle >= domCycle);
@@ -364,7 +589,7 @@ void ContentionSim::simulatePhaseThread(uint32_t thid) {
                 DomainData* domain = domPq.top();
                 domPq.pop();
                 PrioQueue<TimingEvent, PQ_BLOCKS>& pq = domain->pq;
-                if (!pq.size() || pq.firstCycle() > limit) {
+                if (!pq.size() || pq.firstCycle() > lastSimCycle) {
                     numFinished++;
                     domain->curCycle = limit;
                 } else {
@@ -373,6 +598,7 @@ void ContentionSim::simulatePhaseThread(uint32_t thid) {
                     TimingEvent* te = pq.dequeue(cycle);
                     //uint64_t nextCycle = pq.size()? pq.firstCycle() : cycle;
                     if (cycle != domain->curCycle) domain->curCycle = cycle;
+                    if (unlikely(capture != nullptr)) capture->recordRun(te, cycle);
                     te->run(cycle);
                     domain->curCycle = pq.size()? pq.firstCycle() : limit;
                     domain->queuePrio = domain->curCycle;
@@ -385,7 +611,7 @@ void ContentionSim::simulatePhaseThread(uint32_t thid) {
                 DomainData* domain = stalledQueue.back();
                 stalledQueue.pop_back();
                 PrioQueue<TimingEvent, PQ_BLOCKS>& pq = domain->pq;
-                if (!pq.size() || pq.firstCycle() > limit) {
+                if (!pq.size() || pq.firstCycle() > lastSimCycle) {
                     numFinished++;
                     domain->curCycle = limit;
                 } else {
@@ -410,6 +636,203 @@ void ContentionSim::simulatePhaseThread(uint32_t thid) {
     __sync_synchronize();
 }
 
+/* Work stealing: Each phase starts with an assignment of domains to threads,
+ * computed by rebalanceDomains() from the weave time of each domain in past
+ * phases. Threads simulate their domains as in the multi-domain case of
+ * simulatePhaseThread, but must claim a domain (set its busy bit) before
+ * running any of its events. Once a thread runs out of domains, it steals an
+ * idle (unclaimed) domain from the thread with most unfinished domains. Each
+ * domain is simulated by a single thread at a time, and a thread only stops
+ * simulating a domain between events, so per-domain curCycle ordering is
+ * preserved. Threads only steal from threads with multiple domains, so a
+ * thread with a single domain is never stalled by thieves.
+ */
+
+void ContentionSim::rebalanceDomains() {
+    //Smooth per-domain weave time, then assign heaviest domains first to the least-loaded thread (LPT)
+    std::vector<uint32_t> order(numDomains);
+    for (uint32_t i = 0; i < numDomains; i++) {
+        DomainData& dom = domains[i];
+        uint64_t t = dom.profTime.get();
+        dom.load = (dom.load + (t - dom.lastProfTime))/2;
+        dom.lastProfTime = t;
+        order[i] = i;
+    }
+    //+1 so that domains with no measured time (e.g., in the first phase) are spread evenly
+    auto weight = [this](uint32_t d) { return domains[d].load + 1; };
+    std::stable_sort(order.begin(), order.end(), [&weight](uint32_t d1, uint32_t d2) { return weight(d1) > weight(d2); });
+
+    std::vector<uint64_t> thLoad(numSimThreads, 0);
+    for (uint32_t i = 0; i < numSimThreads; i++) simThreads[i].activeDomains = 0;
+    for (uint32_t d : order) {
+        uint32_t th = std::min_element(thLoad.begin(), thLoad.end()) - thLoad.begin();
+        thLoad[th] += weight(d);
+        domains[d].owner = th << 1;
+        simThreads[th].activeDomains++;
+    }
+}
+
+ContentionSim::DomainData* ContentionSim::stealDomain(uint32_t thid) {
+    while (true) {
+        //Pick the victim with the most unfinished domains; stealing a thread's only domain would not help
+        uint32_t victim = numSimThreads;
+        uint32_t victimDomains = 1;
+        for (uint32_t i = 0; i < numSimThreads; i++) {
+            uint32_t active = simThreads[i].activeDomains;
+            if (i != thid && active > victimDomains) {
+                victim = i;
+                victimDomains = active;
+            }
+        }
+        if (victim == numSimThreads) return nullptr;
+
+        //Take its idle domain that lags the most
+        DomainData* dom = nullptr;
+        for (uint32_t i = 0; i < numDomains; i++) {
+            if (domains[i].owner == (victim << 1) && (!dom || domains[i].curCycle < dom->curCycle)) dom = &domains[i];
+        }
+
+        if (dom && __sync_bool_compare_and_swap(&dom->owner, victim << 1, thid << 1)) {
+            __sync_fetch_and_sub(&simThreads[victim].activeDomains, 1);
+            __sync_fetch_and_add(&simThreads[thid].activeDomains, 1);
+            dom->profSteals.inc();
+            return dom;
+        }
+        //Raced with the owner or another thief, retry
+        _mm_pause();
+    }
+}
+
+void ContentionSim::simulatePhaseThreadStealing(uint32_t thid) {
+    const uint32_t idle = thid << 1;
+    const uint32_t busy = idle | 1;
+
+    std::priority_queue<DomainData*, std::vector<DomainData*>, CompareDomains> domPq;
+    std::vector<DomainData*> sq1;
+    std::vector<DomainData*> sq2;
+
+    std::vector<DomainData*>& stalledQueue = sq1;
+    std::vector<DomainData*>& nextStalledQueue = sq2;
+
+    //Returns false if the domain was stolen while queued
+    //Also drains the inbox, as a thief may take a domain before its initial owner got to it
+    auto claim = [&](DomainData* domain) {
+        if (domain->owner != idle || !__sync_bool_compare_and_swap(&domain->owner, idle, busy)) return false;
+        drainInbox(domain);
+        return true;
+    };
+
+    auto release = [&](DomainData* domain) {
+        __sync_synchronize(); //all of the domain's updates must be visible before a thief can take it
+        domain->owner = idle;
+    };
+
+    //Called with the domain claimed
+    auto finishDomain = [&](DomainData* domain) {
+        domain->curCycle = limit;
+        __sync_fetch_and_sub(&simThreads[thid].activeDomains, 1);
+        __sync_synchronize();
+        domain->owner = DOMAIN_DONE;
+    };
+
+    auto enqueueDomain = [&](DomainData* domain) {
+        PrioQueue<TimingEvent, PQ_BLOCKS>& pq = domain->pq;
+        domain->queuePrio = pq.size()? pq.firstCycle() : limit;
+        if (domain->prio == 0) domPq.push(domain);
+        else stalledQueue.push_back(domain);
+    };
+
+    for (uint32_t i = 0; i < numDomains; i++) {
+        if (claim(&domains[i])) {
+            enqueueDomain(&domains[i]);
+            release(&domains[i]);
+        }
+    }
+
+    while (true) {
+        while (domPq.size() || stalledQueue.size() || nextStalledQueue.size()) {
+            while (domPq.size()) {
+                DomainData* domain = domPq.top();
+                domPq.pop();
+                if (!claim(domain)) continue;
+
+                //Run events until this domain is no longer the one furthest behind
+                uint64_t nextPrio = domPq.size()? domPq.top()->queuePrio : ((uint64_t)-1L);
+                PrioQueue<TimingEvent, PQ_BLOCKS>& pq = domain->pq;
+                domain->profTime.start();
+                bool finished = false;
+                while (true) {
+                    if (!pq.size() || pq.firstCycle() > lastSimCycle) {
+                        finished = true;
+                        break;
+                    }
+                    uint64_t cycle;
+                    TimingEvent* te = pq.dequeue(cycle);
+                    if (cycle != domain->curCycle) domain->curCycle = cycle;
+                    if (unlikely(capture != nullptr)) capture->recordRun(te, cycle);
+                    te->run(cycle);
+                    domain->curCycle = pq.size()? pq.firstCycle() : limit;
+                    if (domain->prio != 0 || domain->curCycle > nextPrio) break;
+                }
+                domain->profTime.end();
+                domain->queuePrio = domain->curCycle;
+
+                if (finished) {
+                    finishDomain(domain);
+                } else {
+                    release(domain);
+                    if (domain->prio == 0) domPq.push(domain);
+                    else stalledQueue.push_back(domain);
+                }
+            }
+
+            while (stalledQueue.size()) {
+                DomainData* domain = stalledQueue.back();
+                stalledQueue.pop_back();
+                if (!claim(domain)) continue;
+                PrioQueue<TimingEvent, PQ_BLOCKS>& pq = domain->pq;
+                if (!pq.size() || pq.firstCycle() > lastSimCycle) {
+                    finishDomain(domain);
+                } else {
+                    domain->profTime.start();
+                    uint64_t cycle;
+                    TimingEvent* te = pq.dequeue(cycle);
+                    if (cycle != domain->curCycle) domain->curCycle = cycle;
+                    te->state = EV_RUNNING;
+                    te->simulate(cycle);
+                    domain->curCycle = pq.size()? pq.firstCycle() : limit;
+                    domain->queuePrio = domain->curCycle;
+                    domain->profTime.end();
+                    release(domain);
+                    if (domain->prio == 0) domPq.push(domain);
+                    else nextStalledQueue.push_back(domain);
+                }
+                if (domPq.size()) break;
+            }
+            if (!stalledQueue.size()) std::swap(stalledQueue, nextStalledQueue);
+        }
+
+        //Out of domains, try to steal one
+        DomainData* stolen = stealDomain(thid);
+        if (!stolen) break;
+        enqueueDomain(stolen);
+    }
+
+    __sync_synchronize();
+}
+
+uint64_t ContentionSim::getCrossings() const {
+    uint64_t xings = 0;
+    for (uint32_t i = 0; i < numDomains; i++) xings += domains[i].profCrossings.get();
+    return xings;
+}
+
+uint64_t ContentionSim::getCrossingHolds() const {
+    uint64_t holds = 0;
+    for (uint32_t i = 0; i < numDomains; i++) holds += domains[i].profCrossingHolds.get();
+    return holds;
+}
+
 void ContentionSim::finish() {
     assert(!terminate);
     terminate = true;
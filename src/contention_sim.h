@@ -39,15 +39,20 @@
 #include "profile_stats.h"
 #include "stats.h"
 
-//Set to 1 to produce stats of how many event crossings are generated and run. Useful for debugging, but adds overhead.
-#define PROFILE_CROSSINGS 0
-//#define PROFILE_CROSSINGS 1
+//Buckets of the sampled crossing profiler's histograms; the last one holds the overflow
+#define XING_HOLD_BUCKETS 33
+#define XING_LAG_BUCKETS 24
+//Buckets of the phase handoff latency histograms, bucket i+1 is [2^i, 2^(i+1)) ns; the last one holds the overflow
+#define HANDOFF_LAT_BUCKETS 28
 
 class TimingEvent;
 class DelayEvent;
 class CrossingEvent;
+class WeaveCapture;
 
 #define PQ_BLOCKS 1024
+#define CHILD_HIST_BUCKETS 9 //last bucket counts events with 8 or more children
+#define SYNC_TIMING_SAMPLE 64 //1 in this many synced enqueues is timed for the syncCycles stat
 
 class ContentionSim : public GlobAlloc {
     private:
@@ -58,9 +63,13 @@ class ContentionSim : public GlobAlloc {
         struct CrossingEventInfo {
             uint64_t cycle;
             CrossingEvent* ev; //only valid if the source's curCycle < cycle (otherwise this may be already executed or recycled)
+            uint64_t phase; //bound phase that produced ev; with a pipelined weave, only crossings from the current phase can be chained
         };
 
-        CrossingEventInfo* lastCrossing; //indexed by [srcId*doms*doms + srcDom*doms + dstDom]
+        //Last crossing per (srcId, srcDom, dstDom). Each source (core) crosses from a handful of domains, so rows are
+        //allocated on first use; use getLastCrossing()
+        CrossingEventInfo** lastCrossing; //indexed by [srcId*doms + srcDom], each row has numDomains entries
+        uint32_t numSources;
 
         struct DomainData : public GlobAlloc {
             PrioQueue<TimingEvent, PQ_BLOCKS> pq;
@@ -68,21 +77,46 @@ class ContentionSim : public GlobAlloc {
             PAD();
 
             volatile uint64_t curCycle;
-            lock_t pqLock; //used on phase 1 enqueues
+            //Phase 1 enqueues go to this lock-free stack, linked through TimingEvent::next, and are moved
+            //to pq by the weave thread that simulates the domain (see drainInbox)
+            TimingEvent* volatile inbox;
+            uint64_t inboxRetries; //failed pushes due to concurrent enqueues, updated atomically
             //lock_t domainLock; //used by simulation thread
 
+            //With work stealing, (owner thread id << 1) | busy bit, or DOMAIN_DONE once finished for this phase
+            volatile uint32_t owner;
+
             uint32_t prio;
             uint64_t queuePrio;
 
             PAD();
 
             ClockStat profTime;
-
-#if PROFILE_CROSSINGS
-            VectorCounter profIncomingCrossingSims;
+            Counter profSteals;
+            Counter profInboxEvents;
+            ProxyStat profInboxRetries;
+            ProxyStat profInboxTimed;
+            ProxyStat profInboxCycles;
+            //Sampled inbox push timing (see enqueueSynced), updated atomically by the pushing cores. Kept here rather than
+            //next to inbox so that timing does not add writes to the line every push contends on
+            uint64_t inboxTimed; //pushes timed
+            uint64_t inboxCycles; //host TSC cycles spent in timed pushes, including retries
+            Counter profCrossings; //incoming crossings simulated
+            Counter profCrossingHolds; //times an incoming crossing was requeued to wait for its source domain
+            VectorCounter profChildren; //children per finished event, to size TimingEvent's inline children
+
+            //Used by the phase driver to rebalance the initial assignment (work stealing only)
+            uint64_t lastProfTime; //profTime at the last rebalance
+            uint64_t load; //smoothed weave time per phase
+
+            //Sampled crossing profile (sim.crossingProfileRate > 0), of crossings into this domain. Only the thread
+            //simulating the domain updates these, so they need no sync.
+            uint32_t xingSampleLeft; //crossings to skip before the next sample
+            uint64_t xingSampleRng; //xorshift state; randomized intervals avoid aliasing with periodic crossing patterns
             VectorCounter profIncomingCrossings;
+            VectorCounter profIncomingCrossingSims;
             VectorCounter profIncomingCrossingHist;
-#endif
+            VectorCounter profIncomingCrossingLag;
         };
 
         struct CompareDomains : public std::binary_function<DomainData*, DomainData*, bool> {
@@ -93,6 +127,9 @@ class ContentionSim : public GlobAlloc {
             lock_t wakeLock; //used to sleep/wake up simulation thread
             uint32_t firstDomain;
             uint32_t supDomain; //supreme, ie first not included
+            volatile uint32_t activeDomains; //with work stealing, unfinished domains this thread owns; advisory, used to pick victims
+            int32_t cpu; //host CPU to pin to, -1 if unpinned (see setThreadCpus)
+            uint64_t wakeLatNs; //time from the driver waking this thread to it running, last phase; collected by the driver
 
             std::vector<std::pair<uint64_t, TimingEvent*> > logVec;
         };
@@ -106,19 +143,42 @@ class ContentionSim : public GlobAlloc {
         uint32_t numDomains;
         uint32_t numSimThreads;
         bool skipContention;
+        bool stealing; //if true, domains are assigned dynamically and idle threads steal domains from busy ones
+        bool pipelined; //if true, the weave phase of a phase overlaps with the bound phase of the next one
+        uint32_t xingSampleRate; //if non-zero, profile one in every xingSampleRate crossings
+        uint32_t wakeSpins; //pause iterations weave threads spin for the next phase before blocking
+        uint32_t waitSpins; //pause iterations the phase driver spins for the weave phase to finish before blocking
 
         PAD();
 
         //RW
         lock_t waitLock;
         volatile uint64_t limit;
+        volatile uint64_t lastSimCycle; //last cycle simulated by multi-domain threads; limit-1 when pipelined, as events at limit belong to the bound phase in flight
         volatile uint64_t lastLimit;
+        volatile uint64_t weaveStart; //first cycle of the weave phase being simulated; lags lastLimit by a phase when pipelined
         volatile bool terminate;
 
         volatile uint32_t threadsDone;
         volatile uint32_t threadTicket; //used only at init
 
         volatile bool inCSim; //true when inside contention simulation
+        volatile bool weaveInFlight; //pipelined only, true from the time a weave phase starts until the driver collects it
+        volatile uint64_t wakeNs; //when the driver started waking up weave threads
+        volatile uint64_t doneNs; //when the last weave thread finished the phase
+
+        WeaveCapture* capture; //if non-null, weave threads record the event DAGs they simulate (see weave_capture.h)
+
+        //Pipelined weave stats
+        Counter profPipelinedPhases;
+        ClockStat profWeaveWait;
+        Counter profLateSkew;
+
+        //Phase handoff latencies, to tune wakeSpins and waitSpins
+        Counter profWakeLat;
+        VectorCounter profWakeLatHist;
+        Counter profDoneLat;
+        VectorCounter profDoneLatHist;
 
         PAD();
 
@@ -126,7 +186,7 @@ class ContentionSim : public GlobAlloc {
         lock_t postMortemLock;
 
     public:
-        ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads);
+        ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads, bool _stealing, bool _pipelined, uint32_t _xingSampleRate);
 
         void initStats(AggregateStat* parentStat);
 
@@ -138,6 +198,11 @@ class ContentionSim : public GlobAlloc {
 
         void simulatePhase(uint64_t limit);
 
+        //Pipelined weave only: waits for the weave phase in flight (if any) and applies its delays to the cores. Call before reading final stats.
+        void drainWeave();
+
+        bool isPipelined() const {return pipelined;}
+
         void finish();
 
         uint64_t getLastLimit() {return lastLimit;}
@@ -151,18 +216,63 @@ class ContentionSim : public GlobAlloc {
 
         void setPrio(uint32_t domain, uint32_t prio) {domains[domain].prio = prio;}
 
-#if PROFILE_CROSSINGS
-        void profileCrossing(uint32_t srcDomain, uint32_t dstDomain, uint32_t count) {
-            domains[dstDomain].profIncomingCrossings.inc(srcDomain);
-            domains[dstDomain].profIncomingCrossingSims.inc(srcDomain, count);
-            domains[dstDomain].profIncomingCrossingHist.inc(MIN(count, (unsigned)32));
+        //Called by CrossingEvent in the weave phase, by the thread simulating the destination domain
+        //holds is the number of times the crossing was requeued, lag how many cycles the destination simulated it after its source finished
+        void countCrossing(uint32_t srcDomain, uint32_t dstDomain, uint32_t holds, uint64_t lag) {
+            DomainData& dom = domains[dstDomain];
+            dom.profCrossings.inc();
+            if (likely(!xingSampleRate) || --dom.xingSampleLeft) return;
+            //Next interval is uniform in [1, 2*rate-1], so the mean is rate
+            uint64_t& x = dom.xingSampleRng;
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            dom.xingSampleLeft = 1 + x % (2*xingSampleRate - 1);
+            dom.profIncomingCrossings.inc(srcDomain);
+            dom.profIncomingCrossingSims.inc(srcDomain, holds);
+            dom.profIncomingCrossingHist.inc(MIN(holds, (uint32_t)XING_HOLD_BUCKETS-1));
+            dom.profIncomingCrossingLag.inc(MIN(lag? ilog2(lag)+1 : 0, (uint32_t)XING_LAG_BUCKETS-1));
         }
-#endif
+        void countCrossingHold(uint32_t domain) {domains[domain].profCrossingHolds.inc();}
+
+        //Called by TimingEvent::done(), in the weave phase
+        void countChildren(uint32_t domain, uint32_t numChildren) {
+            domains[domain].profChildren.inc(MIN(numChildren, (uint32_t)CHILD_HIST_BUCKETS-1));
+        }
+
+        //Host CPU of each weave thread (from AffinityPlaceThreads), empty to leave them unpinned. Threads pin
+        //themselves and try to move their domains to their NUMA node when first woken up, so this must be called
+        //before the first weave phase, from the process that created the ContentionSim
+        void setThreadCpus(const std::vector<int32_t>& cpus);
+
+        //Spin-then-park handoff between the phase driver and weave threads: each waits for up to this many pause
+        //iterations before blocking on a futex. 0 blocks right away, which is best when host CPUs are oversubscribed
+        void setHandoffSpins(uint32_t _wakeSpins, uint32_t _waitSpins) {wakeSpins = _wakeSpins; waitSpins = _waitSpins;}
+
+        //Must be set before the first weave phase, from the process that created the ContentionSim
+        void setCapture(WeaveCapture* _capture) {capture = _capture;}
+        WeaveCapture* getCapture() const {return capture;}
+
+        //Totals across domains, e.g., for the phase length controller
+        uint64_t getCrossings() const;
+        uint64_t getCrossingHolds() const;
 
     private:
+        void simulatePhasePipelined(uint64_t limit);
+        void wakeSimThreads();
+        void waitSimThreads();
+        inline void drainInbox(DomainData* dom);
+        inline CrossingEventInfo* getLastCrossing(uint32_t srcId, uint32_t srcDomain, uint32_t dstDomain);
+        void coresSimStart();
+        uint64_t coresSimEnd(); //returns the sum of cycles that cores were delayed by
+
         void simThreadLoop(uint32_t thid);
+        void placeThread(uint32_t thid);
         void simulatePhaseThread(uint32_t thid);
 
+        //Work-stealing variant of simulatePhaseThread, and its helpers
+        void simulatePhaseThreadStealing(uint32_t thid);
+        void rebalanceDomains();
+        DomainData* stealDomain(uint32_t thid);
+
         static void SimThreadTrampoline(void* arg);
 };
 
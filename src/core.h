@@ -31,12 +31,34 @@
 #include "g_std/g_string.h"
 #include "stats.h"
 
+class EventRecorder;
+class SnapshotReader;
+class SnapshotWriter;
+
 struct BblInfo {
     uint32_t instrs;
     uint32_t bytes;
     DynBbl oooBbl[0]; //0 bytes, but will be 1-sized when we have an element (and that element has variable size as well)
 };
 
+/* Memory operands of the basic block being executed, in program order, when
+ * memory ops are batched (sim.batchMemOps). Simple analysis routines that Pin
+ * inlines append to a per-thread batch, and the batch is handed to the core
+ * in one call before the next basic block (or before the thread stops
+ * running simulated code, e.g., on a syscall). Basic blocks with more memory
+ * operands, or with predicated or REP instructions, are not batched.
+ */
+#define MAX_BATCH_MEMOPS 127 //makes MemOpBatch 1KB
+
+struct MemOpBatch {
+    uint64_t numOps;
+    uint64_t ops[MAX_BATCH_MEMOPS]; //(address << 1) | isStore
+
+    static inline bool isStore(uint64_t op) {return op & 1;}
+    //Arithmetic shift, so that canonical upper-half addresses (e.g., vsyscall) survive
+    static inline ADDRINT addr(uint64_t op) {return ((int64_t)op) >> 1;}
+};
+
 /* Analysis function pointer struct
  * As an artifact of having a shared code cache, we need these to be the same for different core types.
  */
@@ -48,8 +70,8 @@ struct InstrFuncPtrs {  // NOLINT(whitespace)
     // Same as load/store functions, but last arg indicated whether op is executing
     void (*predLoadPtr)(THREADID, ADDRINT, BOOL);
     void (*predStorePtr)(THREADID, ADDRINT, BOOL);
+    void (*memBatchPtr)(THREADID, MemOpBatch*);
     uint64_t type;
-    uint64_t pad[1];
     //NOTE: By having the struct be a power of 2 bytes, indirect calls are simpler (w/ gcc 4.4 -O3, 6->5 instructions, and those instructions are simpler)
 };
 
@@ -84,7 +106,24 @@ class Core : public GlobAlloc {
         virtual void leave() {}
         virtual void join() {}
 
+        const char* getName() const {return name.c_str();}
+
         virtual InstrFuncPtrs GetFuncPtrs() = 0;
+
+        //Functional warming pointers, used while the thread's process is between detailed units in sampled simulation
+        //(see sampler.h). They keep caches and branch predictors warm and advance the core's clock at IPC=1, without
+        //modeling timing or recording events. Cores without a timing model just simulate normally.
+        virtual InstrFuncPtrs GetWarmFuncPtrs() {return GetFuncPtrs();}
+
+        //Contention simulation interface, only implemented by cores that record timing events (TimingCore, OOOCore)
+        virtual EventRecorder* getEventRecorder() {return nullptr;}
+        virtual void cSimStart() {}
+        virtual uint64_t cSimEnd() {return 0;} //returns the cycles this core was delayed by
+
+        //Snapshots (see snapshot.h) of warmed-up state, e.g., branch predictors. A core may ignore saved state it
+        //cannot use (e.g., a predictor of a different size), in which case that state starts cold.
+        virtual void saveState(SnapshotWriter& w) {}
+        virtual void restoreState(SnapshotReader& r) {}
 };
 
 #endif  // CORE_H_
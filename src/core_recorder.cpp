@@ -24,6 +24,7 @@
  */
 
 #include "core_recorder.h"
+#include "contention_sim.h"
 #include "timing_event.h"
 #include "zsim.h"
 
@@ -53,6 +54,7 @@ CoreRecorder::CoreRecorder(uint32_t _domain, g_string& _name)
     : domain(_domain), name(_name + "-rec")
 {
     prevRespEvent = nullptr;
+    drainInFlight = false;
     state = HALTED;
     gapCycles = 0;
     eventRecorder.setGapCycles(gapCycles);
@@ -83,6 +85,15 @@ uint64_t CoreRecorder::notifyJoin(uint64_t curCycle) {
     } else if (state == DRAINING) {
         assert(curCycle >= zinfo->globPhaseCycles); //should not have gone out of sync...
         DEBUG_MSG("[%s] Joined, was DRAINING, curCycle %ld", name.c_str(), curCycle);
+        if (drainInFlight) {
+            // The weave phase in flight may be simulating the drain sequence, so start a new one.
+            // Both sequences are unordered, a small inaccuracy of the pipelined weave.
+            prevRespEvent = new (eventRecorder) TimingCoreEvent(0, curCycle - gapCycles, this, domain);
+            prevRespCycle = curCycle;
+            prevRespEvent->setMinStartCycle(curCycle);
+            prevRespEvent->queue(curCycle);
+            drainInFlight = false;
+        }
     } else {
         panic("[%s] Invalid state %d on join()", name.c_str(), state);
     }
@@ -173,6 +184,7 @@ uint64_t CoreRecorder::cSimStart(uint64_t curCycle) {
         prevRespEvent = ev;
     } else if (state == DRAINING) { // add no event --- that's how we detect we're done draining
          if (curCycle < nextPhaseCycle) curCycle = nextPhaseCycle; // bring cycle up
+         drainInFlight = zinfo->contentionSim->isPipelined();
     }
     return curCycle;
 }
@@ -211,6 +223,7 @@ uint64_t CoreRecorder::cSimEnd(uint64_t curCycle) {
         assert_msg(state == DRAINING, "[%s] state %d lastEventSimulated startCycle %ld curCycle %ld", name.c_str(), state, lastEventSimulatedStartCycle, curCycle);
         lastUnhaltedCycle = lastEventSimulatedStartCycle; //the taper is a 0-delay event
         state = HALTED;
+        drainInFlight = false;
         DEBUG_MSG("[%s] lastEventSimulated reached (startCycle %ld), DRAINING -> HALTED", name.c_str(), lastEventSimulatedStartCycle);
     }
     return curCycle;
@@ -220,9 +233,10 @@ void CoreRecorder::reportEventSimulated(TimingCoreEvent* ev) {
     lastEventSimulatedStartCycle = ev->startCycle;
     lastEventSimulatedOrigStartCycle = ev->origStartCycle;
     if (unlikely(ev == prevRespEvent)) {
-        // This is the last event in the sequence
-        assert(state == DRAINING);
-        prevRespEvent = nullptr;
+        // This is the last event in the sequence. With a pipelined weave, notifyJoin() may be
+        // replacing it concurrently, so only clear it if it has not changed.
+        assert(state == DRAINING || zinfo->contentionSim->isPipelined());
+        __sync_bool_compare_and_swap(&prevRespEvent, ev, nullptr);
     }
     eventRecorder.setStartSlack(ev->startCycle - ev->origStartCycle);
 }
@@ -57,6 +57,7 @@ class CoreRecorder {
         TimingEvent* prevRespEvent;
         uint64_t lastEventSimulatedStartCycle;
         uint64_t lastEventSimulatedOrigStartCycle;
+        bool drainInFlight; //pipelined weave only: our DRAINING sequence may be being simulated, so it can't be extended
 
         //Cycle accounting
         uint64_t totalGapCycles; //does not include gapCycles
@@ -0,0 +1,216 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpu_affinity.h"
+#include <algorithm>
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "log.h"
+
+#define MAX_NUMA_NODES 1024
+
+AffinityPolicy ParseAffinityPolicy(const std::string& str) {
+    if (str == "None") return AFF_NONE;
+    else if (str == "Compact") return AFF_COMPACT;
+    else if (str == "Scatter") return AFF_SCATTER;
+    else if (str == "List") return AFF_LIST;
+    panic("Invalid affinity policy %s (must be None, Compact, Scatter, or List)", str.c_str());
+}
+
+std::vector<uint32_t> ParseCpuList(const std::string& str) {
+    std::vector<uint32_t> res;
+    const char* s = str.c_str();
+    while (*s) {
+        if (*s == ',' || *s == ' ') {
+            s++;
+            continue;
+        }
+        char* end;
+        uint32_t first = strtoul(s, &end, 10);
+        if (end == s) panic("Invalid CPU list '%s'", str.c_str());
+        uint32_t last = first;
+        if (*end == '-') {
+            s = end + 1;
+            last = strtoul(s, &end, 10);
+            if (end == s || last < first) panic("Invalid CPU list '%s'", str.c_str());
+        }
+        if (last >= CPU_SETSIZE) panic("CPU list '%s' has CPUs beyond %d", str.c_str(), CPU_SETSIZE-1);
+        for (uint32_t c = first; c <= last; c++) res.push_back(c);
+        s = end;
+    }
+    return res;
+}
+
+static int32_t ReadTopologyValue(uint32_t cpu, const char* field, int32_t defValue) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, field);
+    FILE* f = fopen(path, "r");
+    if (!f) return defValue;
+    int32_t val;
+    if (fscanf(f, "%d", &val) != 1) val = defValue;
+    fclose(f);
+    return val;
+}
+
+struct HostCpu {
+    uint32_t cpu;
+    int32_t pkg;
+    int32_t core;
+    uint32_t smt; //index among the CPUs of its core
+};
+
+// Compact order: sockets, then cores, then SMT siblings
+static bool CompactLess(const HostCpu& a, const HostCpu& b) {
+    if (a.pkg != b.pkg) return a.pkg < b.pkg;
+    if (a.core != b.core) return a.core < b.core;
+    return a.cpu < b.cpu;
+}
+
+static std::vector<HostCpu> ReadTopology(const std::vector<uint32_t>& cpus) {
+    std::vector<HostCpu> res;
+    for (uint32_t c : cpus) res.push_back({c, ReadTopologyValue(c, "physical_package_id", 0), ReadTopologyValue(c, "core_id", (int32_t)c), 0});
+    std::sort(res.begin(), res.end(), CompactLess);
+    for (uint32_t i = 1; i < res.size(); i++) {
+        if (res[i].pkg == res[i-1].pkg && res[i].core == res[i-1].core) res[i].smt = res[i-1].smt + 1;
+    }
+    return res;
+}
+
+// Round-robin across sockets; within each, the first SMT sibling of every core before any second one
+static std::vector<uint32_t> ScatterOrder(const std::vector<HostCpu>& compact) {
+    std::vector<std::vector<HostCpu>> pkgs;
+    for (uint32_t i = 0; i < compact.size(); i++) {
+        if (i == 0 || compact[i].pkg != compact[i-1].pkg) pkgs.push_back(std::vector<HostCpu>());
+        pkgs.back().push_back(compact[i]);
+    }
+    for (std::vector<HostCpu>& p : pkgs) {
+        std::stable_sort(p.begin(), p.end(), [](const HostCpu& a, const HostCpu& b) { return a.smt < b.smt; });
+    }
+    std::vector<uint32_t> res;
+    for (uint32_t i = 0; res.size() < compact.size(); i++) {
+        for (std::vector<HostCpu>& p : pkgs) {
+            if (i < p.size()) res.push_back(p[i].cpu);
+        }
+    }
+    return res;
+}
+
+std::vector<int32_t> AffinityPlaceThreads(AffinityPolicy policy, const std::string& cpuList, uint32_t numThreads, uint32_t reservedCpus) {
+    std::vector<int32_t> res;
+    if (policy == AFF_NONE) return res;
+
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) != 0) {
+        warn("sched_getaffinity failed, weave threads will not be pinned");
+        return res;
+    }
+
+    std::vector<uint32_t> pool;
+    if (cpuList.empty()) {
+        if (policy == AFF_LIST) panic("List affinity policy needs a CPU list");
+        for (uint32_t c = 0; c < CPU_SETSIZE; c++) if (CPU_ISSET(c, &mask)) pool.push_back(c);
+    } else {
+        pool = ParseCpuList(cpuList);
+        for (uint32_t c : pool) {
+            if (!CPU_ISSET(c, &mask)) panic("CPU %d in list '%s' is not in the process's affinity mask", c, cpuList.c_str());
+        }
+    }
+    if (pool.empty()) panic("Empty CPU pool for weave threads");
+
+    std::vector<HostCpu> compact = ReadTopology(pool);
+
+    //Leave the first CPUs in compact order (i.e., whole cores and sockets) to app threads
+    if (reservedCpus) {
+        if (reservedCpus >= compact.size()) {
+            warn("Cannot reserve %d CPUs for app threads out of %ld, weave threads will share them", reservedCpus, compact.size());
+        } else {
+            compact.erase(compact.begin(), compact.begin() + reservedCpus);
+            auto reserved = [&compact](uint32_t c) {
+                return std::none_of(compact.begin(), compact.end(), [c](const HostCpu& hc) { return hc.cpu == c; });
+            };
+            pool.erase(std::remove_if(pool.begin(), pool.end(), reserved), pool.end());
+        }
+    }
+
+    std::vector<uint32_t> order;
+    if (policy == AFF_LIST) {
+        order = pool;
+    } else if (policy == AFF_COMPACT) {
+        for (const HostCpu& hc : compact) order.push_back(hc.cpu);
+    } else {
+        order = ScatterOrder(compact);
+    }
+
+    if (order.size() < numThreads) warn("%d weave threads, but only %ld CPUs to pin them to; some will share CPUs", numThreads, order.size());
+    for (uint32_t i = 0; i < numThreads; i++) res.push_back(order[i % order.size()]);
+    return res;
+}
+
+bool PinCurrentThread(uint32_t cpu) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    int r = sched_setaffinity(0 /*calling thread*/, sizeof(cpuset), &cpuset);
+    if (r != 0) {
+        warn("Could not pin thread to CPU %d (%d)", cpu, r);
+        return false;
+    }
+    return true;
+}
+
+void BindToLocalNode(void* start, size_t len) {
+    static volatile bool unsupported = false;
+    if (unsupported) return;
+
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0 || node >= MAX_NUMA_NODES) return;
+
+    //mbind works on whole pages; the boundary pages stay where they are
+    uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)start + pageSize - 1) & ~(pageSize - 1);
+    uintptr_t sup = ((uintptr_t)start + len) & ~(pageSize - 1);
+    if (first >= sup) return;
+
+    unsigned long nodemask[MAX_NUMA_NODES/(8*sizeof(unsigned long))] = {0};
+    nodemask[node/(8*sizeof(unsigned long))] = 1ul << (node % (8*sizeof(unsigned long)));
+    //Domains live in the shared global heap, which was first touched (and placed) by the harness, and every
+    //zsim process maps it. MPOL_MF_MOVE skips pages mapped by more than one process, so only MPOL_MF_MOVE_ALL
+    //actually moves them, and that needs CAP_SYS_NICE. maxnode is one past the last bit the kernel reads.
+    long r = syscall(SYS_mbind, first, sup - first, MPOL_PREFERRED, nodemask, MAX_NUMA_NODES + 1, MPOL_MF_MOVE_ALL);
+    if (r != 0) {
+        if (errno == EPERM) {
+            warn("Moving weave domains to NUMA node %d needs CAP_SYS_NICE; they will stay where the harness placed them", node);
+        } else {
+            warn("mbind to NUMA node %d failed (%d), weave domains will not be placed on their threads' nodes", node, errno);
+        }
+        unsupported = true;
+    }
+}
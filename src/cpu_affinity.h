@@ -0,0 +1,72 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPU_AFFINITY_H_
+#define CPU_AFFINITY_H_
+
+/* Host CPU placement of the weave threads (sim.contentionAffinity)
+ *
+ * Weave threads can be left to the OS scheduler (None), packed on as few
+ * sockets and cores as possible (Compact, e.g., to share the LLC), spread
+ * across sockets first, then cores, with SMT siblings used last (Scatter), or
+ * pinned to an explicit list of CPUs (List). CPUs always come from the
+ * process's affinity mask, so taskset/cgroup limits set up to co-locate
+ * several simulations on one host are respected. Optionally, the first CPUs
+ * of the pool (in Compact order) are left to app threads.
+ *
+ * Pinned threads also try to move the memory of the domains they simulate to
+ * their NUMA node (BindToLocalNode). That memory is in the shared global heap,
+ * so this needs CAP_SYS_NICE; without it, domains stay where they are.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+enum AffinityPolicy {AFF_NONE, AFF_COMPACT, AFF_SCATTER, AFF_LIST};
+
+// Parses "None", "Compact", "Scatter", or "List"; panics on anything else
+AffinityPolicy ParseAffinityPolicy(const std::string& str);
+
+// Parses a Linux-style CPU list, e.g., "0-3,8,10-11"
+std::vector<uint32_t> ParseCpuList(const std::string& str);
+
+/* Returns the host CPU each of numThreads threads should be pinned to, or an
+ * empty vector with AFF_NONE. cpuList restricts the pool (AFF_COMPACT/SCATTER)
+ * or gives the CPUs in order (AFF_LIST); if empty, the pool is the process's
+ * affinity mask. reservedCpus CPUs are left out of the pool for app threads.
+ * If there are fewer CPUs than threads, threads share them round-robin.
+ */
+std::vector<int32_t> AffinityPlaceThreads(AffinityPolicy policy, const std::string& cpuList, uint32_t numThreads, uint32_t reservedCpus);
+
+// Pins the calling thread to cpu; returns false (and warns) on failure
+bool PinCurrentThread(uint32_t cpu);
+
+// Moves the pages fully within [start, start+len) to the NUMA node of the calling thread's CPU, even if
+// other processes map them (MPOL_MF_MOVE_ALL, so this needs CAP_SYS_NICE). Best-effort: warns once and
+// gives up if the kernel does not support it or the process is not permitted to.
+void BindToLocalNode(void* start, size_t len);
+
+#endif  // CPU_AFFINITY_H_
@@ -40,13 +40,13 @@
 // Recorder-allocated event, represents one read or write request
 class DDRMemoryAccEvent : public TimingEvent {
     private:
+        bool write; //first, so it fits in TimingEvent's tail padding
         DDRMemory* mem;
         Address addr;
-        bool write;
 
     public:
         DDRMemoryAccEvent(DDRMemory* _mem, bool _isWrite, Address _addr, int32_t domain, uint32_t preDelay, uint32_t postDelay)
-            : TimingEvent(preDelay, postDelay, domain), mem(_mem), addr(_addr), write(_isWrite) {}
+            : TimingEvent(preDelay, postDelay, domain), write(_isWrite), mem(_mem), addr(_addr) {}
 
         Address getAddr() const {return addr;}
         bool isWrite() const {return write;}
@@ -92,9 +92,9 @@ class RefreshEvent : public TimingEvent, public GlobAlloc {
  */
 class SchedEvent : public TimingEvent, public GlobAlloc {
     private:
+        enum State : uint8_t { IDLE, QUEUED, RUNNING, ANNULLED };
+        State state; //first, so it fits in TimingEvent's tail padding
         DDRMemory* const mem;
-        enum State { IDLE, QUEUED, RUNNING, ANNULLED };
-        State state;
 
     public:
         SchedEvent* next;  // for event freelist
@@ -261,7 +261,7 @@ uint64_t DDRMemory::access(MemReq& req) {
     } else {
         bool isWrite = (req.type == PUTX);
         uint64_t respCycle = req.cycle + (isWrite? minWrLatency : minRdLatency);
-        if (zinfo->eventRecorders[req.srcId]) {
+        if (zinfo->eventRecorders[req.srcId] && !req.is(MemReq::WARMUP)) {
             DDRMemoryAccEvent* memEv = new (zinfo->eventRecorders[req.srcId]) DDRMemoryAccEvent(this,
                     isWrite, req.lineAddr, domain, preDelay, isWrite? postDelayWr : postDelayRd);
             memEv->setMinStartCycle(req.cycle);
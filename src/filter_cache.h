@@ -125,11 +125,38 @@ class FilterCache : public Cache {
             }
         }
 
-        uint64_t replace(Address vLineAddr, uint32_t idx, bool isLoad, uint64_t curCycle) {
+        //Functional warming (sampled simulation, see sampler.h): updates the hierarchy like a load or store, but the
+        //request is marked so that no timing events are recorded for it, and the core must not use its latency
+        inline void warm(Address vAddr, bool isLoad, uint64_t curCycle) {
+            Address vLineAddr = vAddr >> lineBits;
+            uint32_t idx = vLineAddr & setMask;
+            if (vLineAddr == (isLoad? filterArray[idx].rdAddr : filterArray[idx].wrAddr)) {
+                if (isLoad) fGETSHit++;
+                else fGETXHit++;
+            } else {
+                replace(vLineAddr, idx, isLoad, curCycle, MemReq::WARMUP);
+            }
+        }
+
+        //Fast-forward warming (sim.ffWarmRate): like warm(), but called by a thread that is not running on this
+        //cache's core, possibly from another process. The filter array must only hold lines of the core's current
+        //process, so this does not fill it, and drops the set's entry in case the access evicted its line.
+        void warmUnowned(Address pLineAddr, bool isLoad, uint64_t curCycle) {
+            uint32_t idx = pLineAddr & setMask;
+            MESIState dummyState = MESIState::I;
+            futex_lock(&filterLock);
+            MemReq req = {pLineAddr, isLoad? GETS : GETX, 0, &dummyState, curCycle, &filterLock, dummyState, srcId, reqFlags | MemReq::WARMUP};
+            access(req);
+            filterArray[idx].wrAddr = -1L;
+            filterArray[idx].rdAddr = -1L;
+            futex_unlock(&filterLock);
+        }
+
+        uint64_t replace(Address vLineAddr, uint32_t idx, bool isLoad, uint64_t curCycle, uint32_t extraFlags = 0) {
             Address pLineAddr = procMask | vLineAddr;
             MESIState dummyState = MESIState::I;
             futex_lock(&filterLock);
-            MemReq req = {pLineAddr, isLoad? GETS : GETX, 0, &dummyState, curCycle, &filterLock, dummyState, srcId, reqFlags};
+            MemReq req = {pLineAddr, isLoad? GETS : GETX, 0, &dummyState, curCycle, &filterLock, dummyState, srcId, reqFlags | extraFlags};
             uint64_t respCycle  = access(req);
 
             //Due to the way we do the locking, at this point the old address might be invalidated, but we have the new address guaranteed until we release the lock
@@ -149,7 +176,7 @@ class FilterCache : public Cache {
         }
 
         uint64_t invalidate(const InvReq& req) {
-            Cache::startInvalidate();  // grabs cache's downLock
+            Cache::startInvalidate(req);  // grabs cache's downLock
             futex_lock(&filterLock);
             uint32_t idx = req.lineAddr & setMask; //works because of how virtual<->physical is done...
             if ((filterArray[idx].rdAddr | procMask) == req.lineAddr) { //FIXME: If another process calls invalidate(), procMask will not match even though we may be doing a capacity-induced invalidation!
@@ -166,6 +193,11 @@ class FilterCache : public Cache {
             for (uint32_t i = 0; i < numSets; i++) filterArray[i].clear();
             futex_unlock(&filterLock);
         }
+
+        void restoreState(SnapshotReader& r) {
+            Cache::restoreState(r);
+            contextSwitch(); //the filter array may hold lines that are no longer cached
+        }
 };
 
 #endif  // FILTER_CACHE_H_
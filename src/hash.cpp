@@ -29,7 +29,7 @@
 #include "log.h"
 #include "mtrand.h"
 
-H3HashFamily::H3HashFamily(uint32_t numFunctions, uint32_t outputBits, uint64_t randSeed) : numFuncs(numFunctions) {
+H3HashFamily::H3HashFamily(uint32_t numFunctions, uint32_t outputBits, uint64_t randSeed, bool useTables) : numFuncs(numFunctions), tables(nullptr) {
     MTRand rnd(randSeed);
 
     if (outputBits <= 8) {
@@ -59,10 +59,50 @@ H3HashFamily::H3HashFamily(uint32_t numFunctions, uint32_t outputBits, uint64_t
             hMatrix[ii*words + jj] = val;
         }
     }
+
+    if (!useTables) return;
+    tables = gm_calloc<uint64_t>(numFuncs*8*256);
+    for (uint32_t id = 0; id < numFuncs; id++) {
+        for (uint32_t b = 0; b < 8; b++) {
+            for (uint32_t v = 0; v < 256; v++) {
+                tables[(id*8 + b)*256 + v] = matrixHash(id, ((uint64_t)v) << (8*b));
+            }
+        }
+    }
+
+    //Linearity guarantees this, but be paranoid: the simulated system must not change if tables are used
+    MTRand checkRnd(randSeed + 1);
+    for (uint32_t i = 0; i < 1024 && tables; i++) {
+        uint64_t val = (((uint64_t)checkRnd.randInt()) << 32) | checkRnd.randInt();
+        for (uint32_t id = 0; id < numFuncs; id++) {
+            if (tableHash(&tables[id*8*256], val) != matrixHash(id, val)) {
+                warn("H3: table hash does not match the matrix one on 0x%lx, using the matrix", val);
+                gm_free(tables);
+                tables = nullptr;
+                break;
+            }
+        }
+    }
 }
 
 H3HashFamily::~H3HashFamily() {
     gm_free(hMatrix);
+    if (tables) gm_free(tables);
+}
+
+uint64_t H3HashFamily::hash(uint32_t id, uint64_t val) {
+    assert(id >= 0 && id < numFuncs);
+    if (likely(tables != nullptr)) return tableHash(&tables[id*8*256], val);
+    return matrixHash(id, val);
+}
+
+void H3HashFamily::hashAll(uint64_t val, uint64_t* out, uint32_t n) {
+    assert(n <= numFuncs);
+    if (unlikely(!tables)) {
+        for (uint32_t id = 0; id < n; id++) out[id] = matrixHash(id, val);
+        return;
+    }
+    for (uint32_t id = 0; id < n; id++) out[id] = tableHash(&tables[id*8*256], val);
 }
 
 /* NOTE: This is fairly well hand-optimized. Go to the commit logs to see the speedup of this function. Main things:
@@ -77,7 +117,7 @@ H3HashFamily::~H3HashFamily() {
  *     res = (res << 1) | (res >> 63);
  * }
  */
-uint64_t H3HashFamily::hash(uint32_t id, uint64_t val) {
+uint64_t H3HashFamily::matrixHash(uint32_t id, uint64_t val) {
     uint64_t res = 0;
     assert(id >= 0 && id < numFuncs);
 
@@ -35,17 +35,39 @@ class HashFamily : public GlobAlloc {
         virtual ~HashFamily() {}
 
         virtual uint64_t hash(uint32_t id, uint64_t val) = 0;
+
+        //Computes the hashes of val with functions 0..n-1 (e.g., one per zcache way) in a single call
+        virtual void hashAll(uint64_t val, uint64_t* out, uint32_t n) {
+            for (uint32_t id = 0; id < n; id++) out[id] = hash(id, val);
+        }
 };
 
+/* H3 is linear over GF(2): the hash of val is the XOR of the hashes of its
+ * bytes, each in its position. So instead of running the bit-matrix loop,
+ * we use a table per byte position that holds the hashes of its 256 values
+ * (8 tables * 256 entries * 8 bytes = 16 KB per function), and XOR 8 table
+ * entries. Outputs are bit-identical to the matrix version, including the
+ * unmasked high bits; the constructor checks this before using the tables.
+ */
 class H3HashFamily : public HashFamily {
     private:
         const uint32_t numFuncs;
         uint32_t resShift;
         uint64_t* hMatrix;
+        uint64_t* tables; //[numFuncs][8 byte positions][256], nullptr if not used
+
+        uint64_t matrixHash(uint32_t id, uint64_t val);
+
+        inline uint64_t tableHash(const uint64_t* t, uint64_t val) {
+            return t[val & 0xff] ^ t[256 + ((val >> 8) & 0xff)] ^ t[2*256 + ((val >> 16) & 0xff)] ^ t[3*256 + ((val >> 24) & 0xff)] ^
+                t[4*256 + ((val >> 32) & 0xff)] ^ t[5*256 + ((val >> 40) & 0xff)] ^ t[6*256 + ((val >> 48) & 0xff)] ^ t[7*256 + (val >> 56)];
+        }
+
     public:
-        H3HashFamily(uint32_t numFunctions, uint32_t outputBits, uint64_t randSeed = 123132127);
+        H3HashFamily(uint32_t numFunctions, uint32_t outputBits, uint64_t randSeed = 123132127, bool useTables = true);
         virtual ~H3HashFamily();
         uint64_t hash(uint32_t id, uint64_t val);
+        void hashAll(uint64_t val, uint64_t* out, uint32_t n);
 };
 
 class SHA1HashFamily : public HashFamily {
@@ -210,6 +210,8 @@ class IdealLRUPartReplPolicy : public PartReplPolicy {
             array[id].used = false;
         }
 
+        uint64_t getStateBytes() const {return numLines*sizeof(Entry);}
+
         uint32_t rank(const MemReq* req) {
             //Choose part to evict from as a part with highest *proportional* diff between tgt and actual sizes (minimize/smooth transients); if all parts are within limits, evict from own
             uint32_t victimPart = mapper->getPartition(*req);
@@ -31,12 +31,14 @@
 #include <string>
 #include <sys/time.h>
 #include <vector>
+#include "bbl_cache.h"
 #include "cache.h"
 #include "cache_arrays.h"
 #include "config.h"
 #include "constants.h"
 #include "contention_sim.h"
 #include "core.h"
+#include "cpu_affinity.h"
 #include "detailed_mem.h"
 #include "detailed_mem_params.h"
 #include "ddr_mem.h"
@@ -54,6 +56,7 @@
 #include "null_core.h"
 #include "ooo_core.h"
 #include "part_repl_policies.h"
+#include "phase_ctrl.h"
 #include "pin_cmd.h"
 #include "prefetcher.h"
 #include "proc_stats.h"
@@ -61,8 +64,10 @@
 #include "process_tree.h"
 #include "profile_stats.h"
 #include "repl_policies.h"
+#include "sampler.h"
 #include "scheduler.h"
 #include "simple_core.h"
+#include "snapshot.h"
 #include "stats.h"
 #include "stats_filter.h"
 #include "str.h"
@@ -72,6 +77,7 @@
 #include "trace_driver.h"
 #include "tracing_cache.h"
 #include "virt/port_virtualizer.h"
+#include "weave_capture.h"
 #include "weave_md1_mem.h" //validation, could be taken out...
 #include "zsim.h"
 
@@ -152,6 +158,18 @@ BaseCache* BuildCacheBank(Config& config, const string& prefix, g_string& name,
         } else {
             rp = new LRUReplPolicy<false>(numLines);
         }
+    } else if (replType == "CompactLRU" || replType == "CompactLRUNoSh") {
+        //1 byte per line instead of LRU's 8: exact LRU ranks per set on SetAssoc arrays, approximate 8-bit timestamps on zcaches
+        bool sharersAware = (replType == "CompactLRU") && !isTerminal;
+        if (arrayType == "SetAssoc") {
+            if (sharersAware) rp = new SetLRUReplPolicy<true>(numLines, ways);
+            else rp = new SetLRUReplPolicy<false>(numLines, ways);
+        } else if (arrayType == "Z") {
+            if (sharersAware) rp = new CoarseLRUReplPolicy<true>(numLines);
+            else rp = new CoarseLRUReplPolicy<false>(numLines);
+        } else {
+            panic("%s: %s replacement needs a SetAssoc or Z array", name.c_str(), replType.c_str());
+        }
     } else if (replType == "LFU") {
         rp = new LFUReplPolicy(numLines);
     } else if (replType == "LRUProfViol") {
@@ -265,7 +283,20 @@ BaseCache* BuildCacheBank(Config& config, const string& prefix, g_string& name,
     if (isTerminal) {
         cc = new MESITerminalCC(numLines, name);
     } else {
-        cc = new MESICC(numLines, nonInclusiveHack, name);
+        MESICC* mcc = new MESICC(numLines, nonInclusiveHack, name);
+        // If > 1, accesses to different sets of this bank take different locks instead of serializing on the bank's;
+        // useful on shared caches with few banks. Needs all replacement state to be per-set.
+        uint32_t lockStripes = config.get<uint32_t>(prefix + "lockStripes", 1);
+        if (lockStripes > 1) {
+            if (!isPow2(lockStripes) || lockStripes > numSets) panic("%s: lockStripes must be a power of two <= sets (%d)", name.c_str(), numSets);
+            if (type != "Simple") panic("%s: lockStripes needs a Simple cache, %s caches keep bank-wide state", name.c_str(), type.c_str());
+            if (arrayType != "SetAssoc") panic("%s: lockStripes needs a SetAssoc array", name.c_str());
+            if (replType != "CompactLRU" && replType != "CompactLRUNoSh") {
+                panic("%s: lockStripes needs per-set replacement state; use repl.type = CompactLRU, which replaces as LRU does", name.c_str());
+            }
+            mcc->setLockStripes(lockStripes, hf);
+        }
+        cc = mcc;
     }
     rp->setCC(cc);
     if (!isTerminal) {
@@ -419,6 +450,35 @@ CacheGroup* BuildCacheGroup(Config& config, const string& name, bool isTerminal)
     return cgp;
 }
 
+/* OOO core presets (see ooo_core.h). Each is a separate instantiation of OOOCoreT with its own size, so groups
+ * are allocated and built through these instead of a typed array.
+ */
+struct OOOCoreType {
+    const char* name;
+    void* (*alloc)(uint32_t cores);
+    Core* (*build)(void* cores, uint32_t idx, FilterCache* ic, FilterCache* dc, g_string& name);
+};
+
+template <typename C> static void* AllocOOOCores(uint32_t cores) {
+    return gm_memalign<C>(CACHE_LINE_BYTES, cores);
+}
+
+template <typename C> static Core* BuildOOOCore(void* cores, uint32_t idx, FilterCache* ic, FilterCache* dc, g_string& name) {
+    return new (&static_cast<C*>(cores)[idx]) C(ic, dc, name);
+}
+
+static const OOOCoreType oooCoreTypes[] = {
+    {"OOO", AllocOOOCores<OOOCore>, BuildOOOCore<OOOCore>},  // Nehalem
+    {"OOO-Skylake", AllocOOOCores<OOOCoreSkylake>, BuildOOOCore<OOOCoreSkylake>},
+    {"OOO-Big", AllocOOOCores<OOOCoreBig>, BuildOOOCore<OOOCoreBig>},
+    {"OOO-Small", AllocOOOCores<OOOCoreSmall>, BuildOOOCore<OOOCoreSmall>},
+};
+
+static const OOOCoreType* FindOOOCoreType(const string& type) {
+    for (const OOOCoreType& t : oooCoreTypes) if (type == t.name) return &t;
+    return nullptr;
+}
+
 static void InitSystem(Config& config) {
     unordered_map<string, string> parentMap; //child -> parent
     unordered_map<string, vector<vector<string>>> childMap; //parent -> children (a parent may have multiple children)
@@ -606,6 +666,19 @@ static void InitSystem(Config& config) {
         }
     }
 
+    //All caches, for snapshots; other BaseCaches (e.g., trace driver proxies) hold no state
+    zinfo->caches = new g_vector<Cache*>();
+    for (const char* grp : cacheGroupNames) {
+        for (vector<BaseCache*>& bankVec : *cMap[grp]) {
+            for (BaseCache* bank : bankVec) {
+                Cache* c = dynamic_cast<Cache*>(bank);
+                if (c) zinfo->caches->push_back(c);
+            }
+        }
+    }
+
+    info("Set-associative arrays use %s tag matching", TagMatchImplName(BestTagMatchImpl()));
+
     //Tracks how many terminal caches have been allocated to cores
     unordered_map<string, uint32_t> assignedCaches;
     for (const char* grp : cacheGroupNames) if (isTerminal(grp)) assignedCaches[grp] = 0;
@@ -616,6 +689,8 @@ static void InitSystem(Config& config) {
         unordered_map <string, vector<Core*>> coreMap;
         config.subgroups("sys.cores", coreGroupNames);
 
+        if (zinfo->ffWarmRate) zinfo->ffWarmCaches = gm_calloc<FilterCache*>(zinfo->numCores);
+
         uint32_t coreIdx = 0;
         for (const char* group : coreGroupNames) {
             if (parentMap.count(group)) panic("Core group name %s is invalid, a cache group already has that name", group);
@@ -625,20 +700,21 @@ static void InitSystem(Config& config) {
             string prefix = string("sys.cores.") + group + ".";
             uint32_t cores = config.get<uint32_t>(prefix + "cores", 1);
             string type = config.get<const char*>(prefix + "type", "Simple");
+            const OOOCoreType* oooType = FindOOOCoreType(type); //null if not an OOO core
 
             //Build the core group
             union {
                 SimpleCore* simpleCores;
                 TimingCore* timingCores;
-                OOOCore* oooCores;
+                void* oooCores;
                 NullCore* nullCores;
             };
             if (type == "Simple") {
                 simpleCores = gm_memalign<SimpleCore>(CACHE_LINE_BYTES, cores);
             } else if (type == "Timing") {
                 timingCores = gm_memalign<TimingCore>(CACHE_LINE_BYTES, cores);
-            } else if (type == "OOO") {
-                oooCores = gm_memalign<OOOCore>(CACHE_LINE_BYTES, cores);
+            } else if (oooType) {
+                oooCores = oooType->alloc(cores);
                 zinfo->oooDecode = true; //enable uop decoding, this is false by default, must be true if even one OOO cpu is in the system
             } else if (type == "Null") {
                 nullCores = gm_memalign<NullCore>(CACHE_LINE_BYTES, cores);
@@ -679,6 +755,7 @@ static void InitSystem(Config& config) {
                     assert(dc);
                     dc->setSourceId(coreIdx);
                     assignedCaches[dcache]++;
+                    if (zinfo->ffWarmRate) zinfo->ffWarmCaches[coreIdx] = dc;
 
                     //Build the core
                     if (type == "Simple") {
@@ -690,11 +767,10 @@ static void InitSystem(Config& config) {
                         zinfo->eventRecorders[coreIdx]->setSourceId(coreIdx);
                         core = tcore;
                     } else {
-                        assert(type == "OOO");
-                        OOOCore* ocore = new (&oooCores[j]) OOOCore(ic, dc, name);
-                        zinfo->eventRecorders[coreIdx] = ocore->getEventRecorder();
+                        assert(oooType);
+                        core = oooType->build(oooCores, j, ic, dc, name);
+                        zinfo->eventRecorders[coreIdx] = core->getEventRecorder();
                         zinfo->eventRecorders[coreIdx]->setSourceId(coreIdx);
-                        core = ocore;
                     }
                     coreMap[group].push_back(core);
                     coreIdx++;
@@ -719,6 +795,8 @@ static void InitSystem(Config& config) {
             }
         }
 
+        if (zinfo->ffWarmRate && !assignedCaches.size()) panic("sim.ffWarmRate needs at least one core with caches");
+
         //Populate global core info
         assert(zinfo->numCores == coreIdx);
         zinfo->cores = gm_memalign<Core*>(CACHE_LINE_BYTES, zinfo->numCores);
@@ -803,16 +881,34 @@ static void PostInitStats(bool perProcessDir, Config& config) {
         zinfo->periodicStatsBackend = new HDF5Backend(pStatsFile, prStat, (1 << 20) /* 1MB chunks */, zinfo->skipStatsVectors, zinfo->compactPeriodicStats);
         zinfo->periodicStatsBackend->dump(true); //must have a first sample
 
+        //Dumps every statsPhaseInterval*phaseLength cycles. With adaptive phases, checks as often as needed to not
+        //overshoot with the longest phases; with fixed phases, this fires every statsPhaseInterval phases
         class PeriodicStatsDumpEvent : public Event {
+            private:
+                const uint64_t intervalCycles;
+                uint64_t nextCycle;
+
+                void setPeriod() {
+                    period = (nextCycle - zinfo->globPhaseCycles)/zinfo->maxPhaseLength;
+                    if (!period) period = 1;
+                }
+
             public:
-                explicit PeriodicStatsDumpEvent(uint32_t period) : Event(period) {}
+                explicit PeriodicStatsDumpEvent(uint64_t _intervalCycles) : Event(0), intervalCycles(_intervalCycles), nextCycle(_intervalCycles) {
+                    setPeriod();
+                }
+
                 void callback() {
-                    zinfo->trigger = 10000;
-                    zinfo->periodicStatsBackend->dump(true /*buffered*/);
+                    if (zinfo->globPhaseCycles >= nextCycle) {
+                        zinfo->trigger = 10000;
+                        zinfo->periodicStatsBackend->dump(true /*buffered*/);
+                        while (nextCycle <= zinfo->globPhaseCycles) nextCycle += intervalCycles;
+                    }
+                    setPeriod();
                 }
         };
 
-        zinfo->eventQueue->insert(new PeriodicStatsDumpEvent(zinfo->statsPhaseInterval));
+        zinfo->eventQueue->insert(new PeriodicStatsDumpEvent(((uint64_t)zinfo->statsPhaseInterval)*zinfo->phaseLength));
         zinfo->statsBackends->push_back(zinfo->periodicStatsBackend);
     } else {
         zinfo->periodicStatsBackend = nullptr;
@@ -831,7 +927,7 @@ static void PostInitStats(bool perProcessDir, Config& config) {
                 zinfo->trigger = i;
                 zinfo->eventualStatsBackend->dump(true /*buffered*/);
             };
-            zinfo->eventQueue->insert(makeAdaptiveEvent(getInstrs, dumpStats, 0, zinfo->maxMinInstrs, MAX_IPC*zinfo->phaseLength));
+            zinfo->eventQueue->insert(makeAdaptiveEvent(getInstrs, dumpStats, 0, zinfo->maxMinInstrs, MAX_IPC*zinfo->maxPhaseLength));
         }
     }
 
@@ -900,8 +996,28 @@ void SimInit(const char* configFile, const char* outputDir, uint32_t shmid) {
 
     zinfo->numDomains = config.get<uint32_t>("sim.domains", 1);
     uint32_t numSimThreads = config.get<uint32_t>("sim.contentionThreads", MAX((uint32_t)1, zinfo->numDomains/2)); //gives a bit of parallelism, TODO tune
-    zinfo->contentionSim = new ContentionSim(zinfo->numDomains, numSimThreads);
+    //If set, weave threads start each phase with a load-balanced set of domains and idle threads steal domains from busy ones
+    bool contentionStealing = config.get<bool>("sim.contentionStealing", false);
+    //If set, the weave phase runs concurrently with the next bound phase, and cores see contention delays one phase late
+    bool pipelinedWeave = config.get<bool>("sim.pipelinedWeave", false);
+    //If non-zero, profile one in every crossingProfileRate crossings (per source/destination domain pair counts, holds, and lag); 0 disables
+    uint32_t crossingProfileRate = config.get<uint32_t>("sim.crossingProfileRate", 0);
+    zinfo->contentionSim = new ContentionSim(zinfo->numDomains, numSimThreads, contentionStealing, pipelinedWeave, crossingProfileRate);
     zinfo->contentionSim->initStats(zinfo->rootStat);
+    //Pause iterations weave threads spin waiting for the next phase, and the phase driver spins waiting for the weave phase,
+    //before blocking on a futex. Spinning cuts handoff latency with short phases, but steals host CPU time from app and
+    //weave threads if there are fewer host CPUs than threads; see contention.wakeLat and doneLat to tune these
+    uint32_t weaveWakeSpins = config.get<uint32_t>("sim.weaveWakeSpins", 0);
+    uint32_t weaveWaitSpins = config.get<uint32_t>("sim.weaveWaitSpins", 0);
+    zinfo->contentionSim->setHandoffSpins(weaveWakeSpins, weaveWaitSpins);
+    //If set, the weave phase's event graphs are written to this file (in outputDir) for offline replay with weavebench; slow
+    string weaveCapture = config.get<const char*>("sim.weaveCapture", "");
+    if (!weaveCapture.empty()) {
+        //Number of weave phases to capture, 0 for all
+        uint32_t weaveCapturePhases = config.get<uint32_t>("sim.weaveCapturePhases", 0);
+        const char* captureFile = gm_strdup((string(zinfo->outputDir) + "/" + weaveCapture).c_str());
+        zinfo->contentionSim->setCapture(new WeaveCapture(captureFile, zinfo->numDomains, weaveCapturePhases));
+    }
     zinfo->eventRecorders = gm_calloc<EventRecorder*>(zinfo->numCores);
 
     zinfo->traceWriters = new g_vector<AccessTraceWriter*>();
@@ -910,6 +1026,22 @@ void SimInit(const char* configFile, const char* outputDir, uint32_t shmid) {
     zinfo->numPhases = 0;
 
     zinfo->phaseLength = config.get<uint32_t>("sim.phaseLength", 10000);
+    zinfo->nextPhaseLength = zinfo->pendingPhaseLength = zinfo->maxPhaseLength = zinfo->phaseLength;
+
+    //If set, phase lengths are tuned at runtime within [minPhaseLength, maxPhaseLength], starting at phaseLength
+    bool adaptivePhases = config.get<bool>("sim.adaptivePhases", false);
+    if (adaptivePhases) {
+        uint32_t minPhaseLength = config.get<uint32_t>("sim.minPhaseLength", (zinfo->phaseLength >= 4)? zinfo->phaseLength/4 : 1);
+        uint32_t maxPhaseLength = config.get<uint32_t>("sim.maxPhaseLength", 4*zinfo->phaseLength);
+        if (minPhaseLength == 0 || minPhaseLength > zinfo->phaseLength || maxPhaseLength < zinfo->phaseLength) {
+            panic("Invalid adaptive phase lengths: need 0 < minPhaseLength (%d) <= phaseLength (%d) <= maxPhaseLength (%d)",
+                    minPhaseLength, zinfo->phaseLength, maxPhaseLength);
+        }
+        zinfo->phaseCtrl = new PhaseLengthController(zinfo->phaseLength, minPhaseLength, maxPhaseLength);
+        zinfo->maxPhaseLength = maxPhaseLength;
+    } else {
+        zinfo->phaseCtrl = nullptr;
+    }
     zinfo->statsPhaseInterval = config.get<uint32_t>("sim.statsPhaseInterval", 100);
     zinfo->freqMHz = config.get<uint32_t>("sys.frequency", 2000);
 
@@ -932,14 +1064,27 @@ void SimInit(const char* configFile, const char* outputDir, uint32_t shmid) {
     zinfo->ffReinstrument = config.get<bool>("sim.ffReinstrument", false);
     if (zinfo->ffReinstrument) warn("sim.ffReinstrument = true, switching fast-forwarding on a multi-threaded process may be unstable");
 
+    //Fast-forward cache warming, 0 to disable; 1 warms with every access, N with one in every N (faster, but warms less)
+    zinfo->ffWarmRate = config.get<uint32_t>("sim.ffWarmRate", 0);
+    if (zinfo->ffWarmRate && zinfo->ffReinstrument) panic("sim.ffWarmRate and sim.ffReinstrument are incompatible, fast-forwarded code must be instrumented to warm caches");
+
+    //Cache hierarchy snapshots (see snapshot.h): if set, ZSIM_MAGIC_OP_SNAPSHOT saves the state of caches and cores to this file
+    string snapshotFile = config.get<const char*>("sim.snapshotFile", "");
+    //If non-zero, also take a snapshot once the cores have run this many instructions in total
+    uint64_t snapshotInstrs = config.get<uint64_t>("sim.snapshotInstrs", 0);
+    if (snapshotInstrs && snapshotFile.empty()) panic("sim.snapshotInstrs needs sim.snapshotFile");
+    //If set, caches and cores start with the state saved in this snapshot, from a simulation with the same system config
+    string restoreFile = config.get<const char*>("sim.restoreFile", "");
+
     zinfo->registerThreads = config.get<bool>("sim.registerThreads", false);
     zinfo->globalPauseFlag = config.get<bool>("sim.startInGlobalPause", false);
 
     zinfo->eventQueue = new EventQueue(); //must be instantiated before the memory hierarchy
 
+    uint32_t parallelism = 0; //concurrent app threads
     if (!zinfo->traceDriven) {
         //Build the scheduler
-        uint32_t parallelism = config.get<uint32_t>("sim.parallelism", 2*sysconf(_SC_NPROCESSORS_ONLN));
+        parallelism = config.get<uint32_t>("sim.parallelism", 2*sysconf(_SC_NPROCESSORS_ONLN));
         if (parallelism < zinfo->numCores) info("Limiting concurrent threads to %d", parallelism);
         assert(parallelism > 0); //jeez...
 
@@ -949,13 +1094,35 @@ void SimInit(const char* configFile, const char* outputDir, uint32_t shmid) {
         zinfo->sched = nullptr;
     }
 
+    //Host CPU placement of weave threads (see cpu_affinity.h): None (OS-scheduled), Compact, Scatter, or List
+    AffinityPolicy contentionAffinity = ParseAffinityPolicy(config.get<const char*>("sim.contentionAffinity", "None"));
+    //CPUs for weave threads, e.g., "0-3,8"; with Compact and Scatter this restricts the pool, with List threads use them in order
+    string contentionCpus = config.get<const char*>("sim.contentionCpus", "");
+    //If set, the first sim.parallelism CPUs of the pool (in Compact order) are left to app threads
+    bool contentionAvoidAppCpus = config.get<bool>("sim.contentionAvoidAppCpus", false);
+    zinfo->contentionSim->setThreadCpus(AffinityPlaceThreads(contentionAffinity, contentionCpus, numSimThreads,
+                contentionAvoidAppCpus? parallelism : 0));
+
     zinfo->blockingSyscalls = config.get<bool>("sim.blockingSyscalls", false);
+    //If set, the addresses of each basic block's memory operands are buffered inline and passed to the core in one call,
+    //instead of making an indirect analysis call per operand. Experimental: it should not change simulation results, but
+    //this has not been validated against per-operand runs yet (see misc/batchMemOpsCheck.py), so it stays off by default
+    zinfo->batchMemOps = config.get<bool>("sim.batchMemOps", false);
+    if (zinfo->batchMemOps) warn("sim.batchMemOps = true is experimental and not yet validated, check it with misc/batchMemOpsCheck.py");
+    //Global heap MB that decoded basic blocks shared across processes may take; once full, new bbls are decoded per process. 0 disables
+    uint32_t bblCacheMB = config.get<uint32_t>("sim.bblCacheMB", 64);
+    //If set, the decoded bbl cache is loaded from and saved to this file, so later simulations skip decoding the same code
+    string uopCacheFile = config.get<const char*>("sim.uopCacheFile", "");
+    if (!uopCacheFile.empty() && !bblCacheMB) warn("sim.uopCacheFile needs the decoded bbl cache, set sim.bblCacheMB > 0");
+    zinfo->bblCache = bblCacheMB? new BblCache(((uint64_t)bblCacheMB) << 20, uopCacheFile.empty()? nullptr : gm_strdup(uopCacheFile.c_str())) : nullptr;
 
     if (zinfo->blockingSyscalls) {
         warn("sim.blockingSyscalls = True, will likely deadlock with multi-threaded apps!");
     }
 
     InitGlobalStats();
+    if (zinfo->phaseCtrl) zinfo->phaseCtrl->initStats(zinfo->rootStat);
+    if (zinfo->bblCache) zinfo->bblCache->initStats(zinfo->rootStat);
 
     //Core stats (initialized here for cosmetic reasons, to be above cache stats)
     AggregateStat* allCoreStats = new AggregateStat(false);
@@ -991,6 +1158,18 @@ void SimInit(const char* configFile, const char* outputDir, uint32_t shmid) {
         zinfo->procStats = nullptr;
     }
 
+    //Sampled simulation, if any process sets samplingUnit (see sampler.h). MPKI counts the misses of the stats
+    //that match this regex, e.g., "l3\\..*\\.mGET.*" for the misses of all l3 banks
+    const char* samplingMissStats = config.get<const char*>("sim.samplingMissStats", "");
+    bool sampling = false;
+    for (uint32_t p = 0; p < zinfo->numProcs; p++) sampling |= zinfo->procArray[p]->getSampling().unit != 0;
+    if (sampling) {
+        zinfo->sampler = new Sampler(samplingMissStats, gm_strdup((string(zinfo->outputDir) + "/zsim-samples.out").c_str()));
+        zinfo->sampler->initStats(zinfo->rootStat);
+    } else {
+        zinfo->sampler = nullptr;
+    }
+
     //It's a global stat, but I want it to be last...
     zinfo->profHeartbeats = new VectorCounter();
     zinfo->profHeartbeats->init("heartbeats", "Per-process heartbeats", zinfo->lineSize);
@@ -1019,6 +1198,9 @@ void SimInit(const char* configFile, const char* outputDir, uint32_t shmid) {
 
     zinfo->contentionSim->postInit();
 
+    if (!snapshotFile.empty()) InitSnapshots(snapshotFile.c_str(), snapshotInstrs);
+    if (!restoreFile.empty()) RestoreSnapshot(restoreFile.c_str());
+
     info("Initialization complete");
 
     //Causes every other process to wake up
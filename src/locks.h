@@ -185,6 +185,20 @@ static inline void futex_lock_nospin(volatile uint32_t* lock) {
     } while (c != 0);
 }
 
+/* Spin-then-park: polls the lock for up to spins pause iterations before blocking as futex_lock_nospin does.
+ * For handoffs where the lock is usually released soon after we start waiting. Since a spinning waiter
+ * leaves the lock at 1, futex_unlock only makes the FUTEX_WAKE syscall if the waiter has parked.
+ */
+static inline void futex_lock_spin(volatile uint32_t* lock, uint32_t spins) {
+    for (uint32_t i = 0; i < spins; i++) {
+        if (*lock == 0 && __sync_bool_compare_and_swap(lock, 0, 1)) {
+            return;
+        }
+        _mm_pause();
+    }
+    futex_lock_nospin(lock);
+}
+
 #define BILLION (1000000000L)
 static inline bool futex_trylock_nospin_timeout(volatile uint32_t* lock, uint64_t timeoutNs) {
     if (*lock == 0 && __sync_bool_compare_and_swap(lock, 0, 1)) {
@@ -64,6 +64,7 @@ MD1Memory::MD1Memory(uint32_t requestSize, uint32_t megacyclesPerSecond, uint32_
     : zeroLoadLatency(_zeroLoadLatency), name(_name)
 {
     lastPhase = 0;
+    lastPhaseCycles = 0;
 
     double bytesPerCycle = ((double)megabytesPerSecond)/((double)megacyclesPerSecond);
     maxRequestsPerCycle = bytesPerCycle/requestSize;
@@ -79,7 +80,7 @@ MD1Memory::MD1Memory(uint32_t requestSize, uint32_t megacyclesPerSecond, uint32_
 }
 
 void MD1Memory::updateLatency() {
-    uint32_t phaseCycles = (zinfo->numPhases - lastPhase)*(zinfo->phaseLength);
+    uint32_t phaseCycles = zinfo->globPhaseCycles - lastPhaseCycles;
     if (phaseCycles < 10000) return; //Skip with short phases
 
     smoothedPhaseAccesses =  (curPhaseAccesses*0.5) + (smoothedPhaseAccesses*0.5);
@@ -104,9 +105,28 @@ void MD1Memory::updateLatency() {
     curPhaseAccesses = 0;
     __sync_synchronize();
     lastPhase = zinfo->numPhases;
+    lastPhaseCycles = zinfo->globPhaseCycles;
 }
 
 uint64_t MD1Memory::access(MemReq& req) {
+    //Functional warming requests model no timing, so they must not load the queue or show up in the stats
+    if (unlikely(req.is(MemReq::WARMUP))) {
+        switch (req.type) {
+            case PUTS:
+            case PUTX:
+                *req.state = I;
+                break;
+            case GETS:
+                *req.state = req.is(MemReq::NOEXCL)? S : E;
+                break;
+            case GETX:
+                *req.state = M;
+                break;
+            default: panic("!?");
+        }
+        return req.cycle;
+    }
+
     if (zinfo->numPhases > lastPhase) {
         futex_lock(&updateLock);
         //Recheck, someone may have updated already
@@ -97,6 +97,7 @@ struct MemReq {
         NONINCLWB     = (1<<3), //This is a non-inclusive writeback. Do not assume that the line was in the lower level. Used on NUCA (BankDir).
         PUTX_KEEPEXCL = (1<<4), //Non-relinquishing PUTX. On a PUTX, maintain the requestor's E state instead of removing the sharer (i.e., this is a pure writeback)
         PREFETCH      = (1<<5), //Prefetch GETS access. Only set at level where prefetch is issued; handled early in MESICC
+        WARMUP        = (1<<6), //Functional warming access (sampled simulation). Updates cache state like any other access, but timing caches and memory controllers record no events for it. Propagates to parent accesses and writebacks.
     };
     uint32_t flags;
 
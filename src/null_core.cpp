@@ -59,13 +59,14 @@ void NullCore::join() {
 //Static class functions: Function pointers and trampolines
 
 InstrFuncPtrs NullCore::GetFuncPtrs() {
-    return {LoadFunc, StoreFunc, BblFunc, BranchFunc, PredLoadFunc, PredStoreFunc, FPTR_ANALYSIS, {0}};
+    return {LoadFunc, StoreFunc, BblFunc, BranchFunc, PredLoadFunc, PredStoreFunc, MemBatchFunc, FPTR_ANALYSIS};
 }
 
 void NullCore::LoadFunc(THREADID tid, ADDRINT addr) {}
 void NullCore::StoreFunc(THREADID tid, ADDRINT addr) {}
 void NullCore::PredLoadFunc(THREADID tid, ADDRINT addr, BOOL pred) {}
 void NullCore::PredStoreFunc(THREADID tid, ADDRINT addr, BOOL pred) {}
+void NullCore::MemBatchFunc(THREADID tid, MemOpBatch* batch) {}
 
 void NullCore::BblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
     NullCore* core = static_cast<NullCore*>(cores[tid]);
@@ -73,7 +74,7 @@ void NullCore::BblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
 
     while (unlikely(core->curCycle > core->phaseEndCycle)) {
         assert(core->phaseEndCycle == zinfo->globPhaseCycles + zinfo->phaseLength);
-        core->phaseEndCycle += zinfo->phaseLength;
+        core->phaseEndCycle += zinfo->nextPhaseLength;
 
         uint32_t cid = getCid(tid);
         //NOTE: TakeBarrier may take ownership of the core, and so it will be used by some other thread. If TakeBarrier context-switches us,
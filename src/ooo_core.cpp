@@ -41,22 +41,9 @@
 #define DEBUG_MSG(args...)
 //#define DEBUG_MSG(args...) info(args)
 
-// Core parameters
-// TODO(dsm): Make OOOCore templated, subsuming these
-
-// Stages --- more or less matched to Westmere, but have not seen detailed pipe diagrams anywhare
-#define FETCH_STAGE 1
-#define DECODE_STAGE 4  // NOTE: Decoder adds predecode delays to decode
-#define ISSUE_STAGE 7
-#define DISPATCH_STAGE 13  // RAT + ROB + RS, each is easily 2 cycles
-
-#define L1D_LAT 4  // fixed, and FilterCache does not include L1 delay
-#define FETCH_BYTES_PER_CYCLE 16
-#define ISSUES_PER_CYCLE 4
-#define RF_READS_PER_CYCLE 3
-
-OOOCore::OOOCore(FilterCache* _l1i, FilterCache* _l1d, g_string& _name) : Core(_name), l1i(_l1i), l1d(_l1d), cRec(0, _name) {
-    decodeCycle = DECODE_STAGE;  // allow subtracting from it
+template <typename P>
+OOOCoreT<P>::OOOCoreT(FilterCache* _l1i, FilterCache* _l1d, g_string& _name) : Core(_name), l1i(_l1i), l1d(_l1d), cRec(0, _name) {
+    decodeCycle = P::DECODE_STAGE;  // allow subtracting from it
     curCycle = 0;
     phaseEndCycle = zinfo->phaseLength;
 
@@ -72,11 +59,13 @@ OOOCore::OOOCore(FilterCache* _l1i, FilterCache* _l1d, g_string& _name) : Core(_
     branchPc = 0;
 
     instrs = uops = bbls = approxInstrs = mispredBranches = 0;
+    warmInstrs = 0;
 
     for (uint32_t i = 0; i < FWD_ENTRIES; i++) fwdArray[i].set((Address)(-1L), 0);
 }
 
-void OOOCore::initStats(AggregateStat* parentStat) {
+template <typename P>
+void OOOCoreT<P>::initStats(AggregateStat* parentStat) {
     AggregateStat* coreStat = new AggregateStat();
     coreStat->init(name.c_str(), "Core stats");
 
@@ -98,6 +87,8 @@ void OOOCore::initStats(AggregateStat* parentStat) {
     approxInstrsStat->init("approxInstrs", "Instrs with approx uop decoding", &approxInstrs);
     ProxyStat* mispredBranchesStat = new ProxyStat();
     mispredBranchesStat->init("mispredBranches", "Mispredicted branches", &mispredBranches);
+    ProxyStat* warmInstrsStat = new ProxyStat();
+    warmInstrsStat->init("warmInstrs", "Instrs in functional warming (sampled simulation), included in instrs", &warmInstrs);
 
     coreStat->append(cyclesStat);
     coreStat->append(cCyclesStat);
@@ -106,6 +97,7 @@ void OOOCore::initStats(AggregateStat* parentStat) {
     coreStat->append(bblsStat);
     coreStat->append(approxInstrsStat);
     coreStat->append(mispredBranchesStat);
+    coreStat->append(warmInstrsStat);
 
 #ifdef OOO_STALL_STATS
     profFetchStalls.init("fetchStalls",  "Fetch stalls");  coreStat->append(&profFetchStalls);
@@ -116,10 +108,13 @@ void OOOCore::initStats(AggregateStat* parentStat) {
     parentStat->append(coreStat);
 }
 
-uint64_t OOOCore::getInstrs() const {return instrs;}
-uint64_t OOOCore::getPhaseCycles() const {return curCycle % zinfo->phaseLength;}
+template <typename P>
+uint64_t OOOCoreT<P>::getInstrs() const {return instrs;}
+template <typename P>
+uint64_t OOOCoreT<P>::getPhaseCycles() const {return (curCycle > zinfo->globPhaseCycles)? curCycle - zinfo->globPhaseCycles : 0;}
 
-void OOOCore::contextSwitch(int32_t gid) {
+template <typename P>
+void OOOCoreT<P>::contextSwitch(int32_t gid) {
     if (gid == -1) {
         // Do not execute previous BBL, as we were context-switched
         prevBbl = nullptr;
@@ -131,31 +126,40 @@ void OOOCore::contextSwitch(int32_t gid) {
 }
 
 
-InstrFuncPtrs OOOCore::GetFuncPtrs() {return {LoadFunc, StoreFunc, BblFunc, BranchFunc, PredLoadFunc, PredStoreFunc, FPTR_ANALYSIS, {0}};}
+template <typename P>
+InstrFuncPtrs OOOCoreT<P>::GetFuncPtrs() {return {LoadFunc, StoreFunc, BblFunc, BranchFunc, PredLoadFunc, PredStoreFunc, MemBatchFunc, FPTR_ANALYSIS};}
 
-inline void OOOCore::load(Address addr) {
+template <typename P>
+InstrFuncPtrs OOOCoreT<P>::GetWarmFuncPtrs() {return {WarmLoadFunc, WarmStoreFunc, WarmBblFunc, WarmBranchFunc, WarmPredLoadFunc, WarmPredStoreFunc, WarmMemBatchFunc, FPTR_ANALYSIS};}
+
+template <typename P>
+inline void OOOCoreT<P>::load(Address addr) {
     loadAddrs[loads++] = addr;
 }
 
-void OOOCore::store(Address addr) {
+template <typename P>
+void OOOCoreT<P>::store(Address addr) {
     storeAddrs[stores++] = addr;
 }
 
 // Predicated loads and stores call this function, gets recorded as a 0-cycle op.
 // Predication is rare enough that we don't need to model it perfectly to be accurate (i.e. the uops still execute, retire, etc), but this is needed for correctness.
-void OOOCore::predFalseMemOp() {
+template <typename P>
+void OOOCoreT<P>::predFalseMemOp() {
     // I'm going to go out on a limb and assume just loads are predicated (this will not fail silently if it's a store)
     loadAddrs[loads++] = -1L;
 }
 
-void OOOCore::branch(Address pc, bool taken, Address takenNpc, Address notTakenNpc) {
+template <typename P>
+void OOOCoreT<P>::branch(Address pc, bool taken, Address takenNpc, Address notTakenNpc) {
     branchPc = pc;
     branchTaken = taken;
     branchTakenNpc = takenNpc;
     branchNotTakenNpc = notTakenNpc;
 }
 
-inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
+template <typename P>
+inline void OOOCoreT<P>::bbl(Address bblAddr, BblInfo* bblInfo) {
     if (!prevBbl) {
         // This is the 1st BBL since scheduled, nothing to simulate
         prevBbl = bblInfo;
@@ -196,8 +200,8 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
         prevDecCycle = uop->decCycle;
         uopQueue.markLeave(curCycle);
 
-        // Implement issue width limit --- we can only issue 4 uops/cycle
-        if (curCycleIssuedUops >= ISSUES_PER_CYCLE) {
+        // Implement issue width limit --- we can only issue ISSUES_PER_CYCLE uops/cycle
+        if (curCycleIssuedUops >= P::ISSUES_PER_CYCLE) {
 #ifdef OOO_STALL_STATS
             profIssueStalls.inc();
 #endif
@@ -218,8 +222,8 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
         // RF read stalls
         // if srcs are not available at issue time, we have to go thru the RF
         curCycleRFReads += ((c0 < curCycle)? 1 : 0) + ((c1 < curCycle)? 1 : 0);
-        if (curCycleRFReads > RF_READS_PER_CYCLE) {
-            curCycleRFReads -= RF_READS_PER_CYCLE;
+        if (curCycleRFReads > P::RF_READS_PER_CYCLE) {
+            curCycleRFReads -= P::RF_READS_PER_CYCLE;
             curCycleIssuedUops = 0;  // or 1? that's probably a 2nd-order detail
             insWindow.advancePos(curCycle);
         }
@@ -230,7 +234,7 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
         uint64_t cOps = MAX(c0, c1);
 
         // Model RAT + ROB + RS delay between issue and dispatch
-        uint64_t dispatchCycle = MAX(cOps, MAX(c2, c3) + (DISPATCH_STAGE - ISSUE_STAGE));
+        uint64_t dispatchCycle = MAX(cOps, MAX(c2, c3) + (P::DISPATCH_STAGE - P::ISSUE_STAGE));
 
         // info("IW 0x%lx %d %ld %ld %x", bblAddr, i, c2, dispatchCycle, uop->portMask);
         // NOTE: Schedule can adjust both cur and dispatch cycles
@@ -268,7 +272,7 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
                     Address addr = loadAddrs[loadIdx++];
                     uint64_t reqSatisfiedCycle = dispatchCycle;
                     if (addr != ((Address)-1L)) {
-                        reqSatisfiedCycle = l1d->load(addr, dispatchCycle) + L1D_LAT;
+                        reqSatisfiedCycle = l1d->load(addr, dispatchCycle) + P::L1D_LAT;
                         cRec.record(curCycle, dispatchCycle, reqSatisfiedCycle);
                     }
 
@@ -305,7 +309,7 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
                     dispatchCycle = MAX(lastStoreAddrCommitCycle+1, dispatchCycle);
 
                     Address addr = storeAddrs[storeIdx++];
-                    uint64_t reqSatisfiedCycle = l1d->store(addr, dispatchCycle) + L1D_LAT;
+                    uint64_t reqSatisfiedCycle = l1d->store(addr, dispatchCycle) + P::L1D_LAT;
                     cRec.record(curCycle, dispatchCycle, reqSatisfiedCycle);
 
                     // Fill the forwarding table
@@ -370,7 +374,7 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
      */
 
     // Model fetch-decode delay (fixed, weak predec/IQ assumption)
-    uint64_t fetchCycle = decodeCycle - (DECODE_STAGE - FETCH_STAGE);
+    uint64_t fetchCycle = decodeCycle - (P::DECODE_STAGE - P::FETCH_STAGE);
     uint32_t lineSize = 1 << lineBits;
 
     // Simulate branch prediction
@@ -411,7 +415,7 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
                 break;
             }
             // Model fetch throughput limit
-            reqCycle = respCycle + lineSize/FETCH_BYTES_PER_CYCLE;
+            reqCycle = respCycle + lineSize/P::FETCH_BYTES_PER_CYCLE;
         }
 
         fetchCycle = lastCommitCycle;
@@ -433,7 +437,7 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
     // If fetch rules, take into account delay between fetch and decode;
     // If decode rules, different BBLs make the decoders skip a cycle
     decodeCycle++;
-    uint64_t minFetchDecCycle = fetchCycle + (DECODE_STAGE - FETCH_STAGE);
+    uint64_t minFetchDecCycle = fetchCycle + (P::DECODE_STAGE - P::FETCH_STAGE);
     if (minFetchDecCycle > decodeCycle) {
 #ifdef OOO_STALL_STATS
         profFetchStalls.inc(decodeCycle - minFetchDecCycle);
@@ -442,8 +446,30 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
     }
 }
 
+template <typename P>
+inline void OOOCoreT<P>::warmBbl(Address bblAddr, BblInfo* bblInfo) {
+    // Buffered ops and branches are from before warming; drop them, and restart detailed simulation on the next bbl
+    // as after a context switch
+    prevBbl = nullptr;
+    loads = stores = 0;
+    branchPc = 0;
+
+    instrs += bblInfo->instrs;
+    warmInstrs += bblInfo->instrs;
+
+    uint32_t lineSize = 1 << lineBits;
+    Address endAddr = bblAddr + bblInfo->bytes;
+    for (Address fetchAddr = bblAddr; fetchAddr < endAddr; fetchAddr += lineSize) {
+        l1i->warm(fetchAddr, true, curCycle);
+    }
+
+    // IPC=1; advance() drains the IW and moves the whole core in lockstep, so detailed simulation resumes cleanly
+    advance(curCycle + bblInfo->instrs);
+}
+
 // Timing simulation code
-void OOOCore::join() {
+template <typename P>
+void OOOCoreT<P>::join() {
     DEBUG_MSG("[%s] Joining, curCycle %ld phaseEnd %ld", name.c_str(), curCycle, phaseEndCycle);
     uint64_t targetCycle = cRec.notifyJoin(curCycle);
     if (targetCycle > curCycle) advance(targetCycle);
@@ -452,24 +478,30 @@ void OOOCore::join() {
     DEBUG_MSG("[%s] Joined, curCycle %ld phaseEnd %ld", name.c_str(), curCycle, phaseEndCycle);
 }
 
-void OOOCore::leave() {
+template <typename P>
+void OOOCoreT<P>::leave() {
     DEBUG_MSG("[%s] Leaving, curCycle %ld phaseEnd %ld", name.c_str(), curCycle, phaseEndCycle);
     cRec.notifyLeave(curCycle);
 }
 
-void OOOCore::cSimStart() {
+template <typename P>
+void OOOCoreT<P>::cSimStart() {
     uint64_t targetCycle = cRec.cSimStart(curCycle);
     assert(targetCycle >= curCycle);
     if (targetCycle > curCycle) advance(targetCycle);
 }
 
-void OOOCore::cSimEnd() {
+template <typename P>
+uint64_t OOOCoreT<P>::cSimEnd() {
     uint64_t targetCycle = cRec.cSimEnd(curCycle);
     assert(targetCycle >= curCycle);
+    uint64_t delay = targetCycle - curCycle;
     if (targetCycle > curCycle) advance(targetCycle);
+    return delay;
 }
 
-void OOOCore::advance(uint64_t targetCycle) {
+template <typename P>
+void OOOCoreT<P>::advance(uint64_t targetCycle) {
     assert(targetCycle > curCycle);
     decodeCycle += targetCycle - curCycle;
     insWindow.longAdvance(curCycle, targetCycle);
@@ -484,27 +516,43 @@ void OOOCore::advance(uint64_t targetCycle) {
 
 // Pin interface code
 
-void OOOCore::LoadFunc(THREADID tid, ADDRINT addr) {static_cast<OOOCore*>(cores[tid])->load(addr);}
-void OOOCore::StoreFunc(THREADID tid, ADDRINT addr) {static_cast<OOOCore*>(cores[tid])->store(addr);}
+template <typename P>
+void OOOCoreT<P>::LoadFunc(THREADID tid, ADDRINT addr) {static_cast<OOOCoreT<P>*>(cores[tid])->load(addr);}
+template <typename P>
+void OOOCoreT<P>::StoreFunc(THREADID tid, ADDRINT addr) {static_cast<OOOCoreT<P>*>(cores[tid])->store(addr);}
 
-void OOOCore::PredLoadFunc(THREADID tid, ADDRINT addr, BOOL pred) {
-    OOOCore* core = static_cast<OOOCore*>(cores[tid]);
+template <typename P>
+void OOOCoreT<P>::PredLoadFunc(THREADID tid, ADDRINT addr, BOOL pred) {
+    OOOCoreT<P>* core = static_cast<OOOCoreT<P>*>(cores[tid]);
     if (pred) core->load(addr);
     else core->predFalseMemOp();
 }
 
-void OOOCore::PredStoreFunc(THREADID tid, ADDRINT addr, BOOL pred) {
-    OOOCore* core = static_cast<OOOCore*>(cores[tid]);
+template <typename P>
+void OOOCoreT<P>::PredStoreFunc(THREADID tid, ADDRINT addr, BOOL pred) {
+    OOOCoreT<P>* core = static_cast<OOOCoreT<P>*>(cores[tid]);
     if (pred) core->store(addr);
     else core->predFalseMemOp();
 }
 
-void OOOCore::BblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
-    OOOCore* core = static_cast<OOOCore*>(cores[tid]);
+//Addresses are only buffered until the next bbl() simulates their instructions, so this is just a copy
+template <typename P>
+void OOOCoreT<P>::MemBatchFunc(THREADID tid, MemOpBatch* batch) {
+    OOOCoreT<P>* core = static_cast<OOOCoreT<P>*>(cores[tid]);
+    for (uint32_t i = 0; i < batch->numOps; i++) {
+        uint64_t op = batch->ops[i];
+        if (MemOpBatch::isStore(op)) core->store(MemOpBatch::addr(op));
+        else core->load(MemOpBatch::addr(op));
+    }
+}
+
+template <typename P>
+void OOOCoreT<P>::BblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
+    OOOCoreT<P>* core = static_cast<OOOCoreT<P>*>(cores[tid]);
     core->bbl(bblAddr, bblInfo);
 
     while (core->curCycle > core->phaseEndCycle) {
-        core->phaseEndCycle += zinfo->phaseLength;
+        core->phaseEndCycle += zinfo->nextPhaseLength;
 
         uint32_t cid = getCid(tid);
         // NOTE: TakeBarrier may take ownership of the core, and so it will be used by some other thread. If TakeBarrier context-switches us,
@@ -519,7 +567,74 @@ void OOOCore::BblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
     }
 }
 
-void OOOCore::BranchFunc(THREADID tid, ADDRINT pc, BOOL taken, ADDRINT takenNpc, ADDRINT notTakenNpc) {
-    static_cast<OOOCore*>(cores[tid])->branch(pc, taken, takenNpc, notTakenNpc);
+template <typename P>
+void OOOCoreT<P>::BranchFunc(THREADID tid, ADDRINT pc, BOOL taken, ADDRINT takenNpc, ADDRINT notTakenNpc) {
+    static_cast<OOOCoreT<P>*>(cores[tid])->branch(pc, taken, takenNpc, notTakenNpc);
+}
+
+// Functional warming interface code
+
+template <typename P>
+void OOOCoreT<P>::WarmLoadFunc(THREADID tid, ADDRINT addr) {
+    OOOCoreT<P>* core = static_cast<OOOCoreT<P>*>(cores[tid]);
+    core->l1d->warm(addr, true, core->curCycle);
+}
+
+template <typename P>
+void OOOCoreT<P>::WarmStoreFunc(THREADID tid, ADDRINT addr) {
+    OOOCoreT<P>* core = static_cast<OOOCoreT<P>*>(cores[tid]);
+    core->l1d->warm(addr, false, core->curCycle);
+}
+
+template <typename P>
+void OOOCoreT<P>::WarmPredLoadFunc(THREADID tid, ADDRINT addr, BOOL pred) {
+    if (pred) WarmLoadFunc(tid, addr);
+}
+
+template <typename P>
+void OOOCoreT<P>::WarmPredStoreFunc(THREADID tid, ADDRINT addr, BOOL pred) {
+    if (pred) WarmStoreFunc(tid, addr);
+}
+
+template <typename P>
+void OOOCoreT<P>::WarmMemBatchFunc(THREADID tid, MemOpBatch* batch) {
+    OOOCoreT<P>* core = static_cast<OOOCoreT<P>*>(cores[tid]);
+    for (uint32_t i = 0; i < batch->numOps; i++) {
+        uint64_t op = batch->ops[i];
+        core->l1d->warm(MemOpBatch::addr(op), !MemOpBatch::isStore(op), core->curCycle);
+    }
+}
+
+template <typename P>
+void OOOCoreT<P>::WarmBblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
+    OOOCoreT<P>* core = static_cast<OOOCoreT<P>*>(cores[tid]);
+    core->warmBbl(bblAddr, bblInfo);
+
+    while (core->curCycle > core->phaseEndCycle) {
+        core->phaseEndCycle += zinfo->nextPhaseLength;
+        uint32_t cid = getCid(tid);
+        uint32_t newCid = TakeBarrier(tid, cid);
+        if (newCid != cid) break;  /*context-switch*/
+    }
+}
+
+template <typename P>
+void OOOCoreT<P>::WarmBranchFunc(THREADID tid, ADDRINT pc, BOOL taken, ADDRINT takenNpc, ADDRINT notTakenNpc) {
+    static_cast<OOOCoreT<P>*>(cores[tid])->branchPred.predict(pc, taken);
+}
+
+template <typename P>
+void OOOCoreT<P>::saveState(SnapshotWriter& w) {
+    branchPred.saveState(w);
+}
+
+template <typename P>
+void OOOCoreT<P>::restoreState(SnapshotReader& r) {
+    if (!branchPred.restoreState(r)) warn("[%s] Snapshot has a branch predictor of a different size, starting it cold", name.c_str());
 }
 
+// Presets selectable from the config (see ooo_core.h)
+template class OOOCoreT<OOOParamsNehalem>;
+template class OOOCoreT<OOOParamsSkylake>;
+template class OOOCoreT<OOOParamsBig>;
+template class OOOCoreT<OOOParamsSmall>;
@@ -34,6 +34,7 @@
 #include "memory_hierarchy.h"
 #include "ooo_core_recorder.h"
 #include "pad.h"
+#include "snapshot.h"
 
 // Uncomment to enable stall stats
 // #define OOO_STALL_STATS
@@ -97,9 +98,35 @@ class BranchPredictorPAg {
             // info("BP Update: newPht=%d newBshr=%x", pht[phtIdx], bhsr[bhsrIdx]);
             return (taken == pred);
         }
+
+        void saveState(SnapshotWriter& w) {
+            w.putTag("PAg");
+            w.put(NB);
+            w.put(HB);
+            w.put(LB);
+            w.write(bhsr, sizeof(bhsr));
+            w.write(pht, sizeof(pht));
+        }
+
+        //Returns false, leaving the predictor untouched, if the saved one has a different geometry
+        bool restoreState(SnapshotReader& r) {
+            r.expectTag("PAg");
+            uint32_t nb = r.get<uint32_t>();
+            uint32_t hb = r.get<uint32_t>();
+            uint32_t lb = r.get<uint32_t>();
+            if (nb != NB || hb != HB || lb != LB) return false;
+            r.read(bhsr, sizeof(bhsr));
+            r.read(pht, sizeof(pht));
+            return true;
+        }
 };
 
 
+/* Instruction window, as a calendar of the port usage of each future cycle. Slots are kept in a ring that covers
+ * the next H cycles (H must be a power of 2), so scheduling and advancing are plain array accesses. Uops scheduled
+ * H or more cycles ahead (e.g., behind a long chain of misses) go to an overflow map, and move into the ring as
+ * their cycle comes within reach; size H so that this is rare.
+ */
 template<uint32_t H, uint32_t WSZ>
 class WindowStructure {
     private:
@@ -110,11 +137,12 @@ class WindowStructure {
             inline void set(uint8_t o, uint8_t c) {occUnits = o; count = c;}
         };
 
-        WinCycle* curWin;
-        WinCycle* nextWin;
+        static_assert((H & (H-1)) == 0, "WindowStructure horizon must be a power of 2");
+
+        WinCycle* win;  // ring, curPos holds curCycle
         typedef g_map<uint64_t, WinCycle> UBWin;
         typedef typename UBWin::iterator UBWinIterator;
-        UBWin ubWin;
+        UBWin ubWin;  // cycles >= curCycle + H at insertion time
         uint32_t occupancy;  // elements scheduled in the future
 
         uint32_t curPos;
@@ -123,13 +151,11 @@ class WindowStructure {
 
     public:
         WindowStructure() {
-            curWin = gm_calloc<WinCycle>(H);
-            nextWin = gm_calloc<WinCycle>(H);
+            win = gm_calloc<WinCycle>(H);
             curPos = 0;
             occupancy = 0;
         }
 
-
         void schedule(uint64_t& curCycle, uint64_t& schedCycle, uint8_t portMask, uint32_t extraSlots = 0) {
             if (!extraSlots) {
                 scheduleInternal<true, false>(curCycle, schedCycle, portMask);
@@ -149,28 +175,14 @@ class WindowStructure {
         }
 
         inline void advancePos(uint64_t& curCycle) {
-            occupancy -= curWin[curPos].count;
-            curWin[curPos].set(0, 0);
-            curPos++;
+            occupancy -= win[curPos].count;
+            win[curPos].set(0, 0);
+            curPos = (curPos + 1) & (H-1);
             curCycle++;
 
-            if (curPos == H) {  // rebase
-                // info("[%ld] Rebasing, curCycle=%ld", curCycle/H, curCycle);
-                std::swap(curWin, nextWin);
-                curPos = 0;
-                uint64_t nextWinHorizon = curCycle + 2*H;  // first cycle out of range
-
-                if (!ubWin.empty()) {
-                    UBWinIterator it = ubWin.begin();
-                    while (it != ubWin.end() && it->first < nextWinHorizon) {
-                        uint32_t nextWinPos = it->first - H - curCycle;
-                        assert_msg(nextWinPos < H, "WindowStructure: ubWin elem exceeds limit cycle=%ld curCycle=%ld nextWinPos=%d", it->first, curCycle, nextWinPos);
-                        nextWin[nextWinPos] = it->second;
-                        // info("Moved %d events from unbounded window, cycle %ld (%d cycles away)", it->second, it->first, it->first - curCycle);
-                        it++;
-                    }
-                    ubWin.erase(ubWin.begin(), it);
-                }
+            // The slot just cleared now stands for curCycle + H - 1
+            if (unlikely(!ubWin.empty()) && ubWin.begin()->first < curCycle + H) {
+                fillFromUBWin(curCycle);
             }
         }
 
@@ -189,6 +201,11 @@ class WindowStructure {
                 // info("advance: window drained at %ld, jumping to %ld", curCycle, targetCycle);
                 assert(curCycle <= targetCycle);
                 curCycle = targetCycle;  // with zero occupancy, we can just jump to it
+                // Only poisoned slots can be left; those behind the new curCycle are stale
+                if (unlikely(!ubWin.empty())) {
+                    ubWin.erase(ubWin.begin(), ubWin.lower_bound(curCycle));
+                    if (!ubWin.empty() && ubWin.begin()->first < curCycle + H) fillFromUBWin(curCycle);
+                }
             }
         }
 
@@ -204,6 +221,19 @@ class WindowStructure {
         }
 
     private:
+        // Moves overflow entries that are now within the ring's reach
+        void fillFromUBWin(uint64_t curCycle) {
+            UBWinIterator it = ubWin.begin();
+            while (it != ubWin.end() && it->first < curCycle + H) {
+                assert_msg(it->first >= curCycle, "WindowStructure: ubWin elem behind window cycle=%ld curCycle=%ld", it->first, curCycle);
+                // The slot was cleared when the ring last went past it (or is stale after a longAdvance jump)
+                win[(curPos + (it->first - curCycle)) & (H-1)] = it->second;
+                // info("Moved %d events from unbounded window, cycle %ld (%d cycles away)", it->second, it->first, it->first - curCycle);
+                it++;
+            }
+            ubWin.erase(ubWin.begin(), it);
+        }
+
         template <bool touchOccupancy, bool recordPort>
         void scheduleInternal(uint64_t& curCycle, uint64_t& schedCycle, uint8_t portMask) {
             // If the window is full, advance curPos until it's not
@@ -214,51 +244,39 @@ class WindowStructure {
             uint32_t delay = (schedCycle > curCycle)? (schedCycle - curCycle) : 0;
 
             // Schedule, progressively increasing delay if we cannot find a slot
-            uint32_t curWinPos = curPos + delay;
-            while (curWinPos < H) {
-                if (trySchedule<touchOccupancy, recordPort>(curWin[curWinPos], portMask)) {
-                    schedCycle = curCycle + (curWinPos - curPos);
+            while (delay < H) {
+                if (trySchedule<touchOccupancy, recordPort>(win[(curPos + delay) & (H-1)], portMask)) {
+                    schedCycle = curCycle + delay;
                     break;
                 } else {
-                    curWinPos++;
+                    delay++;
                 }
             }
-            if (curWinPos >= H) {
-                uint32_t nextWinPos = curWinPos - H;
-                while (nextWinPos < H) {
-                    if (trySchedule<touchOccupancy, recordPort>(nextWin[nextWinPos], portMask)) {
-                        schedCycle = curCycle + (nextWinPos + H - curPos);
-                        break;
+            if (delay >= H) {
+                schedCycle = curCycle + delay;
+                UBWinIterator it = ubWin.lower_bound(schedCycle);
+                while (true) {
+                    if (it == ubWin.end()) {
+                        WinCycle wc = {0, 0};
+                        bool success = trySchedule<touchOccupancy, recordPort>(wc, portMask);
+                        assert(success);
+                        ubWin.insert(std::pair<uint64_t, WinCycle>(schedCycle, wc));
+                    } else if (it->first != schedCycle) {
+                        WinCycle wc = {0, 0};
+                        bool success = trySchedule<touchOccupancy, recordPort>(wc, portMask);
+                        assert(success);
+                        ubWin.insert(it /*hint, makes insert faster*/, std::pair<uint64_t, WinCycle>(schedCycle, wc));
                     } else {
-                        nextWinPos++;
-                    }
-                }
-                if (nextWinPos >= H) {
-                    schedCycle = curCycle + (nextWinPos + H - curPos);
-                    UBWinIterator it = ubWin.lower_bound(schedCycle);
-                    while (true) {
-                        if (it == ubWin.end()) {
-                            WinCycle wc = {0, 0};
-                            bool success = trySchedule<touchOccupancy, recordPort>(wc, portMask);
-                            assert(success);
-                            ubWin.insert(std::pair<uint64_t, WinCycle>(schedCycle, wc));
-                        } else if (it->first != schedCycle) {
-                            WinCycle wc = {0, 0};
-                            bool success = trySchedule<touchOccupancy, recordPort>(wc, portMask);
-                            assert(success);
-                            ubWin.insert(it /*hint, makes insert faster*/, std::pair<uint64_t, WinCycle>(schedCycle, wc));
-                        } else {
-                            if (!trySchedule<touchOccupancy, recordPort>(it->second, portMask)) {
-                                // Try next cycle
-                                it++;
-                                schedCycle++;
-                                continue;
-                            }  // else scheduled correctly
-                        }
-                        break;
+                        if (!trySchedule<touchOccupancy, recordPort>(it->second, portMask)) {
+                            // Try next cycle
+                            it++;
+                            schedCycle++;
+                            continue;
+                        }  // else scheduled correctly
                     }
-                    // info("Scheduled event in unbounded window, cycle %ld", schedCycle);
+                    break;
                 }
+                // info("Scheduled event in unbounded window, cycle %ld", schedCycle);
             }
             if (touchOccupancy) occupancy++;
         }
@@ -358,7 +376,119 @@ class CycleQueue {
 
 struct BblInfo;
 
-class OOOCore : public Core {
+/* OOO core presets. OOOCoreT is specialized on one of these at compile time, so the model's sizes and widths are
+ * constants in its hot paths; init selects the preset from sys.cores.<group>.type.
+ *
+ * NOTE: The decoder always produces Nehalem uops and port masks (6 ports), so presets change structure sizes,
+ * widths, pipeline depths and predictor sizes, not the execution port layout. Branch predictor sizes must obey
+ * BranchPredictorPAg's NB <= LB <= HB.
+ */
+
+// Nehalem/Westmere, the default ("OOO")
+struct OOOParamsNehalem {
+    // Stages --- more or less matched to Westmere, but have not seen detailed pipe diagrams anywhare
+    static const uint32_t FETCH_STAGE = 1;
+    static const uint32_t DECODE_STAGE = 4;  // NOTE: Decoder adds predecode delays to decode
+    static const uint32_t ISSUE_STAGE = 7;
+    static const uint32_t DISPATCH_STAGE = 13;  // RAT + ROB + RS, each is easily 2 cycles
+
+    static const uint32_t L1D_LAT = 4;  // fixed, and FilterCache does not include L1 delay
+    static const uint32_t FETCH_BYTES_PER_CYCLE = 16;
+    static const uint32_t ISSUES_PER_CYCLE = 4;
+    static const uint32_t RF_READS_PER_CYCLE = 3;
+
+    static const uint32_t IW_SIZE = 36;  // NOTE: IW width is implicitly determined by the decoder, which sets the port masks according to uop type
+    static const uint32_t ROB_SIZE = 128;
+    static const uint32_t RETIRE_WIDTH = 4;
+    static const uint32_t LQ_SIZE = 32;
+    static const uint32_t SQ_SIZE = 32;
+    static const uint32_t UOP_QUEUE_SIZE = 28;
+
+    // Agner's guide says it's a 2-level pred and BHSR is 18 bits, so this is the config that makes sense;
+    // in practice, this is probably closer to the Pentium M's branch predictor, (see Uzelac and Milenkovic,
+    // ISPASS 2009), which get the 18 bits of history through a hybrid predictor (2-level + bimodal + loop)
+    // where a few of the 2-level history bits are in the tag.
+    // Since this is close enough, we'll leave it as is for now. Feel free to reverse-engineer the real thing...
+    // UPDATE: Now pht index is XOR-folded BSHR. This has 6656 bytes total -- not negligible, but not ridiculous.
+    static const uint32_t BP_NB = 11;
+    static const uint32_t BP_HB = 18;
+    static const uint32_t BP_LB = 14;
+};
+
+// Skylake-like ("OOO-Skylake"): larger RS/ROB/LSQ and IDQ, deeper pipe, bigger predictor
+struct OOOParamsSkylake {
+    static const uint32_t FETCH_STAGE = 1;
+    static const uint32_t DECODE_STAGE = 5;
+    static const uint32_t ISSUE_STAGE = 9;
+    static const uint32_t DISPATCH_STAGE = 15;
+
+    static const uint32_t L1D_LAT = 4;
+    static const uint32_t FETCH_BYTES_PER_CYCLE = 16;
+    static const uint32_t ISSUES_PER_CYCLE = 4;
+    static const uint32_t RF_READS_PER_CYCLE = 4;
+
+    static const uint32_t IW_SIZE = 97;
+    static const uint32_t ROB_SIZE = 224;
+    static const uint32_t RETIRE_WIDTH = 4;
+    static const uint32_t LQ_SIZE = 72;
+    static const uint32_t SQ_SIZE = 56;
+    static const uint32_t UOP_QUEUE_SIZE = 64;
+
+    static const uint32_t BP_NB = 12;
+    static const uint32_t BP_HB = 18;
+    static const uint32_t BP_LB = 16;
+};
+
+// Wide big core ("OOO-Big"), roughly a recent 6-wide design
+struct OOOParamsBig {
+    static const uint32_t FETCH_STAGE = 1;
+    static const uint32_t DECODE_STAGE = 5;
+    static const uint32_t ISSUE_STAGE = 9;
+    static const uint32_t DISPATCH_STAGE = 15;
+
+    static const uint32_t L1D_LAT = 5;
+    static const uint32_t FETCH_BYTES_PER_CYCLE = 32;
+    static const uint32_t ISSUES_PER_CYCLE = 6;
+    static const uint32_t RF_READS_PER_CYCLE = 8;
+
+    static const uint32_t IW_SIZE = 160;
+    static const uint32_t ROB_SIZE = 512;
+    static const uint32_t RETIRE_WIDTH = 8;
+    static const uint32_t LQ_SIZE = 192;
+    static const uint32_t SQ_SIZE = 114;
+    static const uint32_t UOP_QUEUE_SIZE = 144;
+
+    static const uint32_t BP_NB = 13;
+    static const uint32_t BP_HB = 20;
+    static const uint32_t BP_LB = 17;
+};
+
+// Small 2-wide core ("OOO-Small"), shallow pipe and small windows
+struct OOOParamsSmall {
+    static const uint32_t FETCH_STAGE = 1;
+    static const uint32_t DECODE_STAGE = 3;
+    static const uint32_t ISSUE_STAGE = 5;
+    static const uint32_t DISPATCH_STAGE = 8;
+
+    static const uint32_t L1D_LAT = 3;
+    static const uint32_t FETCH_BYTES_PER_CYCLE = 16;
+    static const uint32_t ISSUES_PER_CYCLE = 2;
+    static const uint32_t RF_READS_PER_CYCLE = 2;
+
+    static const uint32_t IW_SIZE = 16;
+    static const uint32_t ROB_SIZE = 32;
+    static const uint32_t RETIRE_WIDTH = 2;
+    static const uint32_t LQ_SIZE = 10;
+    static const uint32_t SQ_SIZE = 16;
+    static const uint32_t UOP_QUEUE_SIZE = 12;
+
+    static const uint32_t BP_NB = 9;
+    static const uint32_t BP_HB = 14;
+    static const uint32_t BP_LB = 12;
+};
+
+template <typename P>
+class OOOCoreT : public Core {
     private:
         FilterCache* l1i;
         FilterCache* l1d;
@@ -384,26 +514,16 @@ class OOOCore : public Core {
         //buffers, but we split the associative component from the limited-size modeling.
         //NOTE: We do not model the 10-entry fill buffer here; the weave model should take care
         //to not overlap more than 10 misses.
-        ReorderBuffer<32, 4> loadQueue;
-        ReorderBuffer<32, 4> storeQueue;
+        ReorderBuffer<P::LQ_SIZE, P::RETIRE_WIDTH> loadQueue;
+        ReorderBuffer<P::SQ_SIZE, P::RETIRE_WIDTH> storeQueue;
 
         uint32_t curCycleRFReads; //for RF read stalls
         uint32_t curCycleIssuedUops; //for uop issue limits
 
-        //This would be something like the Atom... (but careful, the iw probably does not allow 2-wide when configured with 1 slot)
-        //WindowStructure<1024, 1 /*size*/, 2 /*width*/> insWindow; //this would be something like an Atom, except all the instruction pairing business...
-
-        //Nehalem
-        WindowStructure<1024, 36 /*size*/> insWindow; //NOTE: IW width is implicitly determined by the decoder, which sets the port masks according to uop type
-        ReorderBuffer<128, 4> rob;
+        WindowStructure<4096, P::IW_SIZE> insWindow;
+        ReorderBuffer<P::ROB_SIZE, P::RETIRE_WIDTH> rob;
 
-        // Agner's guide says it's a 2-level pred and BHSR is 18 bits, so this is the config that makes sense;
-        // in practice, this is probably closer to the Pentium M's branch predictor, (see Uzelac and Milenkovic,
-        // ISPASS 2009), which get the 18 bits of history through a hybrid predictor (2-level + bimodal + loop)
-        // where a few of the 2-level history bits are in the tag.
-        // Since this is close enough, we'll leave it as is for now. Feel free to reverse-engineer the real thing...
-        // UPDATE: Now pht index is XOR-folded BSHR. This has 6656 bytes total -- not negligible, but not ridiculous.
-        BranchPredictorPAg<11, 18, 14> branchPred;
+        BranchPredictorPAg<P::BP_NB, P::BP_HB, P::BP_LB> branchPred;
 
         Address branchPc;  //0 if last bbl was not a conditional branch
         bool branchTaken;
@@ -411,9 +531,10 @@ class OOOCore : public Core {
         Address branchNotTakenNpc;
 
         uint64_t decodeCycle;
-        CycleQueue<28> uopQueue;  // models issue queue
+        CycleQueue<P::UOP_QUEUE_SIZE> uopQueue;  // models issue queue
 
         uint64_t instrs, uops, bbls, approxInstrs, mispredBranches;
+        uint64_t warmInstrs; //functional warming instrs, included in instrs
 
 #ifdef OOO_STALL_STATS
         Counter profFetchStalls, profDecodeStalls, profIssueStalls;
@@ -434,7 +555,7 @@ class OOOCore : public Core {
         OOOCoreRecorder cRec;
 
     public:
-        OOOCore(FilterCache* _l1i, FilterCache* _l1d, g_string& _name);
+        OOOCoreT(FilterCache* _l1i, FilterCache* _l1d, g_string& _name);
 
         void initStats(AggregateStat* parentStat);
 
@@ -448,11 +569,15 @@ class OOOCore : public Core {
         virtual void leave();
 
         InstrFuncPtrs GetFuncPtrs();
+        InstrFuncPtrs GetWarmFuncPtrs();
 
         // Contention simulation interface
-        inline EventRecorder* getEventRecorder() {return cRec.getEventRecorder();}
+        EventRecorder* getEventRecorder() {return cRec.getEventRecorder();}
+
+        void saveState(SnapshotWriter& w);
+        void restoreState(SnapshotReader& r);
         void cSimStart();
-        void cSimEnd();
+        uint64_t cSimEnd(); //returns the cycles this core was delayed by
 
     private:
         inline void load(Address addr);
@@ -476,12 +601,30 @@ class OOOCore : public Core {
 
         inline void bbl(Address bblAddr, BblInfo* bblInfo);
 
+        // Functional warming (see Core::GetWarmFuncPtrs)
+        inline void warmBbl(Address bblAddr, BblInfo* bblInfo);
+
         static void LoadFunc(THREADID tid, ADDRINT addr);
         static void StoreFunc(THREADID tid, ADDRINT addr);
         static void PredLoadFunc(THREADID tid, ADDRINT addr, BOOL pred);
         static void PredStoreFunc(THREADID tid, ADDRINT addr, BOOL pred);
+        static void MemBatchFunc(THREADID tid, MemOpBatch* batch);
         static void BblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo);
         static void BranchFunc(THREADID tid, ADDRINT pc, BOOL taken, ADDRINT takenNpc, ADDRINT notTakenNpc);
+
+        static void WarmLoadFunc(THREADID tid, ADDRINT addr);
+        static void WarmStoreFunc(THREADID tid, ADDRINT addr);
+        static void WarmPredLoadFunc(THREADID tid, ADDRINT addr, BOOL pred);
+        static void WarmPredStoreFunc(THREADID tid, ADDRINT addr, BOOL pred);
+        static void WarmMemBatchFunc(THREADID tid, MemOpBatch* batch);
+        static void WarmBblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo);
+        static void WarmBranchFunc(THREADID tid, ADDRINT pc, BOOL taken, ADDRINT takenNpc, ADDRINT notTakenNpc);
 } ATTR_LINE_ALIGNED;  // Take up an int number of cache lines
 
+// Instantiated in ooo_core.cpp
+typedef OOOCoreT<OOOParamsNehalem> OOOCore;
+typedef OOOCoreT<OOOParamsSkylake> OOOCoreSkylake;
+typedef OOOCoreT<OOOParamsBig> OOOCoreBig;
+typedef OOOCoreT<OOOParamsSmall> OOOCoreSmall;
+
 #endif  // OOO_CORE_H_
@@ -25,6 +25,7 @@
 
 #include "ooo_core_recorder.h"
 #include <string>
+#include "contention_sim.h"
 #include "timing_event.h"
 #include "zsim.h"
 
@@ -114,6 +115,7 @@ OOOCoreRecorder::OOOCoreRecorder(uint32_t _domain, g_string& _name)
     curId = 0;
 
     lastEvProduced = nullptr;
+    drainInFlight = false;
     lastEvSimulatedZllStartCycle = 0;
     lastEvSimulatedStartCycle = 0;
 }
@@ -139,8 +141,18 @@ uint64_t OOOCoreRecorder::notifyJoin(uint64_t curCycle) {
     } else if (state == DRAINING) {
         assert(curCycle >= zinfo->globPhaseCycles); //should not have gone out of sync...
         DEBUG_MSG("[%s] Joined, was DRAINING, curCycle %ld", name.c_str(), curCycle);
-        assert(lastEvProduced);
-        addIssueEvent(curCycle);
+        if (drainInFlight) {
+            // The weave phase in flight may be simulating the drain sequence, so start a new one.
+            // Both sequences are unordered, a small inaccuracy of the pipelined weave.
+            lastEvProduced = new (eventRecorder) OOOIssueEvent(0, curCycle - gapCycles, this, domain);
+            lastEvProduced->id = curId++;
+            lastEvProduced->setMinStartCycle(curCycle);
+            lastEvProduced->queue(curCycle);
+            drainInFlight = false;
+        } else {
+            assert(lastEvProduced);
+            addIssueEvent(curCycle);
+        }
     } else {
         panic("[%s] Invalid state %d on join()", name.c_str(), state);
     }
@@ -292,11 +304,20 @@ uint64_t OOOCoreRecorder::cSimStart(uint64_t curCycle) {
         if (lastEvProduced->zllStartCycle < zllNextPhaseCycle) {
             addIssueEvent(nextPhaseCycle);
         }
+
+        // With a pipelined weave, responses that may be simulated in this phase can't get more
+        // children, as we'll record the next phase concurrently. Treat them as already simulated.
+        if (zinfo->contentionSim->isPipelined()) {
+            for (FutureResponse& fr : GetPrioQueueContainer(futureResponses)) {
+                if (fr.zllStartCycle < zllNextPhaseCycle) fr.ev = nullptr;
+            }
+        }
     } else if (state == DRAINING) { // add no event --- that's how we detect we're done draining
         //Drain futureResponses... we could be a bit more exact by doing partial drains,
         //but if the thread has not joined back by the end of phase, chances are this is a long leave
         while (!futureResponses.empty()) futureResponses.pop();
         if (curCycle < nextPhaseCycle) curCycle = nextPhaseCycle; // bring cycle up
+        drainInFlight = zinfo->contentionSim->isPipelined();
     }
     return curCycle;
 }
@@ -348,6 +369,7 @@ uint64_t OOOCoreRecorder::cSimEnd(uint64_t curCycle) {
         assert_msg(state == DRAINING, "[%s] state %d lastEvSimulated startCycle %ld curCycle %ld", name.c_str(), state, lastEvSimulatedStartCycle, curCycle);
         lastUnhaltedCycle = lastEvSimulatedStartCycle; //the taper is a 0-delay event
         state = HALTED;
+        drainInFlight = false;
         DEBUG_MSG("[%s] lastEvSimulated reached (startCycle %ld), DRAINING -> HALTED", name.c_str(), lastEvSimulatedStartCycle);
         assert(futureResponses.empty());
         // This works (because we flush on leave()) but would be inaccurate if we called leave() very frequently; now leave() only happens on blocking syscalls though
@@ -358,7 +380,8 @@ uint64_t OOOCoreRecorder::cSimEnd(uint64_t curCycle) {
 void OOOCoreRecorder::reportIssueEventSimulated(OOOIssueEvent* ev, uint64_t startCycle) {
     lastEvSimulatedZllStartCycle = ev->zllStartCycle;
     lastEvSimulatedStartCycle = startCycle;
-    if (lastEvProduced == ev) lastEvProduced = nullptr;
+    // With a pipelined weave, notifyJoin() may replace lastEvProduced concurrently, so only clear it if it has not changed
+    if (lastEvProduced == ev) __sync_bool_compare_and_swap(&lastEvProduced, ev, nullptr);
     eventRecorder.setStartSlack(startCycle - ev->zllStartCycle);
 }
 
@@ -64,6 +64,7 @@ class OOOCoreRecorder {
 
         //Recording phase
         OOOIssueEvent* lastEvProduced;
+        bool drainInFlight; //pipelined weave only: our DRAINING sequence may be being simulated, so it can't be extended
 
         // Future response tracking
         struct FutureResponse {
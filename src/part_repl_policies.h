@@ -216,6 +216,8 @@ class WayPartReplPolicy : public PartReplPolicy, public LegacyReplPolicy {
             //info("0x%lx", incomingLineAddr);
         }
 
+        uint64_t getStateBytes() const {return totalSize*sizeof(WayPartInfo) + ways*sizeof(uint32_t);}
+
     private:
         void setPartitionSizes(const uint32_t* waysPart) {
             uint32_t curWay = 0;
@@ -587,6 +589,8 @@ class VantageReplPolicy : public PartReplPolicy, public LegacyReplPolicy {
             e->addr = incomingLineAddr;
         }
 
+        uint64_t getStateBytes() const {return totalSize*sizeof(LineInfo);}
+
     private:
         void setPartitionSizes(const uint32_t* sizes) {
             uint32_t s[partitions];
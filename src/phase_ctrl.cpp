@@ -0,0 +1,118 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "phase_ctrl.h"
+#include <math.h>
+#include "bithacks.h"
+#include "contention_sim.h"
+#include "log.h"
+#include "profile_stats.h"
+#include "zsim.h"
+
+#define STEPS_PER_OCTAVE 4
+#define EPOCH_PHASES 32
+#define COST_TOLERANCE 0.03 //relative cost changes below this are considered noise
+#define MAX_HOLDS_PER_CROSSING 4.0
+
+PhaseLengthController::PhaseLengthController(uint32_t _baseLength, uint32_t minLength, uint32_t maxLength) : baseLength(_baseLength) {
+    assert(minLength <= baseLength && baseLength <= maxLength);
+    minStep = (int32_t)ceil(STEPS_PER_OCTAVE*log2(((double)minLength)/baseLength));
+    maxStep = (int32_t)floor(STEPS_PER_OCTAVE*log2(((double)maxLength)/baseLength));
+    step = 0;
+    dir = 1; //start by trying longer phases, which are cheaper if they don't cause skew
+    lastCost = 0.0;
+    epochPhases = 0;
+    skipPhases = 1; //start the first epoch at the end of the first phase, when stats are up
+    info("Adaptive phase length: %d-%d cycles (%d steps), starting at %d", stepLength(minStep), stepLength(maxStep), maxStep - minStep + 1, baseLength);
+}
+
+void PhaseLengthController::initStats(AggregateStat* parentStat) {
+    AggregateStat* ctrlStat = new AggregateStat();
+    ctrlStat->init("phaseCtrl", "Adaptive phase length controller stats");
+    profAdjustments.init("adjs", "Phase length adjustments");
+    ctrlStat->append(&profAdjustments);
+    profPhasesPerStep.init("phasesPerStep", "Phases simulated at each length step (length = base * 2^(step/4), first is the shortest)", maxStep - minStep + 1);
+    ctrlStat->append(&profPhasesPerStep);
+    ProxyFuncStat* lengthStat = new ProxyFuncStat();
+    lengthStat->init("length", "Current phase length", []() -> uint64_t { return zinfo->phaseLength; });
+    ctrlStat->append(lengthStat);
+    parentStat->append(ctrlStat);
+}
+
+uint32_t PhaseLengthController::stepLength(int32_t s) const {
+    double len = round(baseLength*pow(2.0, ((double)s)/STEPS_PER_OCTAVE));
+    return (len < 1.0)? 1 : (uint32_t)len;
+}
+
+int32_t PhaseLengthController::lengthStep(uint32_t length) const {
+    int32_t s = (int32_t)lround(STEPS_PER_OCTAVE*log2(((double)length)/baseLength));
+    return MAX(minStep, MIN(maxStep, s));
+}
+
+static uint64_t getSimNs() {
+    return zinfo->profSimTime->count(PROF_BOUND) + zinfo->profSimTime->count(PROF_WEAVE);
+}
+
+void PhaseLengthController::startEpoch() {
+    epochPhases = EPOCH_PHASES;
+    epochStartNs = getSimNs();
+    epochStartCycles = zinfo->globPhaseCycles + zinfo->phaseLength;
+    epochStartCrossings = zinfo->contentionSim->getCrossings();
+    epochStartHolds = zinfo->contentionSim->getCrossingHolds();
+}
+
+void PhaseLengthController::endOfPhase() {
+    profPhasesPerStep.inc(lengthStep(zinfo->phaseLength) - minStep);
+
+    if (skipPhases) {
+        if (--skipPhases == 0) startEpoch();
+        return;
+    }
+    if (--epochPhases) return;
+
+    uint64_t cycles = zinfo->globPhaseCycles + zinfo->phaseLength - epochStartCycles;
+    double cost = ((double)(getSimNs() - epochStartNs))/cycles;
+    uint64_t crossings = zinfo->contentionSim->getCrossings() - epochStartCrossings;
+    uint64_t holds = zinfo->contentionSim->getCrossingHolds() - epochStartHolds;
+
+    if (lastCost > 0.0 && cost > lastCost*(1.0 + COST_TOLERANCE)) dir = -dir; //last move made things worse
+    if (crossings && holds > MAX_HOLDS_PER_CROSSING*crossings) dir = -1; //domains drift too far apart
+    lastCost = cost;
+
+    int32_t newStep = MAX(minStep, MIN(maxStep, step + dir));
+    if (newStep == step) {
+        dir = -dir; //at a bound, explore the other way next
+        startEpoch();
+        return;
+    }
+
+    step = newStep;
+    zinfo->pendingPhaseLength = stepLength(step);
+    profAdjustments.inc();
+    //info("Phase length -> %d (cost %.3f ns/cycle, %ld holds / %ld xings)", zinfo->pendingPhaseLength, cost, holds, crossings);
+
+    //The new length starts two phases from now (see nextPhaseLength); measure from there
+    skipPhases = 1;
+}
@@ -0,0 +1,79 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PHASE_CTRL_H_
+#define PHASE_CTRL_H_
+
+/* Adaptive phase length controller (sim.adaptivePhases)
+ *
+ * Short phases pay more barrier and weave wakeup overheads per simulated
+ * cycle, while long phases let domains drift further apart, so crossings get
+ * held for longer. The controller hill-climbs on the simulation time per
+ * simulated cycle: every epoch, it moves the phase length one step up or down
+ * (steps are a quarter octave apart), and reverses direction if the last move
+ * made things slower. If incoming crossings are held too often, it shrinks
+ * phases regardless.
+ *
+ * A new length takes effect two phases after it is chosen, because cores set
+ * the end of the next phase before they reach the end-of-phase barrier (see
+ * nextPhaseLength in zsim.h).
+ */
+
+#include <stdint.h>
+#include "galloc.h"
+#include "stats.h"
+
+class PhaseLengthController : public GlobAlloc {
+    private:
+        const uint32_t baseLength; //sim.phaseLength, at step 0
+        int32_t minStep, maxStep;
+        int32_t step; //of pendingPhaseLength
+        int32_t dir;
+
+        uint32_t skipPhases; //phases to wait before the next epoch starts, as new lengths take effect with a delay
+        uint32_t epochPhases; //phases left in this epoch
+        uint64_t epochStartNs;
+        uint64_t epochStartCycles;
+        uint64_t epochStartCrossings;
+        uint64_t epochStartHolds;
+        double lastCost; //ns per simulated cycle in the last epoch, 0 if none
+
+        Counter profAdjustments;
+        VectorCounter profPhasesPerStep;
+
+    public:
+        PhaseLengthController(uint32_t _baseLength, uint32_t minLength, uint32_t maxLength);
+        void initStats(AggregateStat* parentStat);
+
+        //Called at the end of every phase, after the weave phase
+        void endOfPhase();
+
+    private:
+        uint32_t stepLength(int32_t s) const;
+        int32_t lengthStep(uint32_t length) const;
+        void startEpoch();
+};
+
+#endif  // PHASE_CTRL_H_
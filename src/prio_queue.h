@@ -28,8 +28,25 @@
 
 #include "g_std/g_multimap.h"
 
+/* Calendar-style priority queue used by the weave phase.
+ *
+ * Near elements live in a ring of B blocks of 64 cycles each; elements
+ * beyond the ring go to an ordered far-element map, and are moved into the
+ * ring as soon as the window covers them. Block occupancy is summarized in a
+ * two-level bitmap (blockOcc has one bit per block, topOcc one bit per
+ * blockOcc word), so finding the next populated cycle takes a handful of
+ * ctz's regardless of how many empty blocks there are in between. This
+ * matters for sparse domains (e.g., memory controllers), where firstCycle()
+ * is called after every single event.
+ *
+ * Invariant: every element in feMap is beyond the ring window, i.e., its
+ * block is >= curBlock + B. Hence, if any block is populated, it holds the
+ * earliest element.
+ */
 template <typename T, uint32_t B>
 class PrioQueue {
+    static_assert(B % 64 == 0 && B <= 64*64, "PrioQueue needs B to be a multiple of 64 and at most 4096");
+
     struct PQBlock {
         T* array[64];
         uint64_t occ; // bit i is 1 if array[i] is populated
@@ -62,6 +79,10 @@ class PrioQueue {
 
     PQBlock blocks[B];
 
+    // Occupancy summaries: bit i of blockOcc[w] is set iff blocks[w*64 + i] is populated; bit w of topOcc is set iff blockOcc[w] != 0
+    uint64_t blockOcc[B/64];
+    uint64_t topOcc;
+
     typedef g_multimap<uint64_t, T*> FEMap; //far element map
     typedef typename FEMap::iterator FEMapIterator;
 
@@ -72,6 +93,8 @@ class PrioQueue {
 
     public:
         PrioQueue() {
+            for (uint32_t i = 0; i < B/64; i++) blockOcc[i] = 0;
+            topOcc = 0;
             curBlock = 0;
             elems = 0;
         }
@@ -81,9 +104,7 @@ class PrioQueue {
             assert(absBlock >= curBlock);
 
             if (absBlock < curBlock + B) {
-                uint32_t i = absBlock % B;
-                uint32_t offset = cycle % 64;
-                blocks[i].enqueue(obj, offset);
+                enqueueNear(obj, cycle);
             } else {
                 //info("XXX far enq() %ld", cycle);
                 feMap.insert(std::pair<uint64_t, T*>(cycle, obj));
@@ -93,31 +114,23 @@ class PrioQueue {
 
         T* dequeue(uint64_t& deqCycle) {
             assert(elems);
-            while (!blocks[curBlock % B].occ) {
-                curBlock++;
-                if ((curBlock % (B/2)) == 0 && !feMap.empty()) {
-                    uint64_t topCycle = (curBlock + B)*64;
-                    //Move every element with cycle < topCycle to blocks[]
-                    FEMapIterator it = feMap.begin();
-                    while (it != feMap.end() && it->first < topCycle) {
-                        uint64_t cycle = it->first;
-                        T* obj = it->second;
-
-                        uint64_t absBlock = cycle/64;
-                        assert(absBlock >= curBlock);
-                        assert(absBlock < curBlock + B);
-                        uint32_t i = absBlock % B;
-                        uint32_t offset = cycle % 64;
-                        blocks[i].enqueue(obj, offset);
-                        it++;
-                    }
-                    feMap.erase(feMap.begin(), it);
+            if (!blocks[curBlock % B].occ) {
+                int32_t idx = nextPopulatedBlock();
+                if (idx >= 0) {
+                    curBlock += (idx - curBlock % B + B) % B;
+                } else {
+                    // Ring is empty, skip straight to the earliest far element
+                    assert(!feMap.empty());
+                    curBlock = feMap.begin()->first/64;
                 }
+                if (!feMap.empty()) refill();
             }
 
             //We're now at the first populated block
+            uint32_t i = curBlock % B;
             uint32_t offset;
-            T* obj = blocks[curBlock % B].dequeue(offset);
+            T* obj = blocks[i].dequeue(offset);
+            if (!blocks[i].occ) clearOcc(i);
             elems--;
 
             deqCycle = curBlock*64 + offset;
@@ -130,25 +143,56 @@ class PrioQueue {
 
         inline uint64_t firstCycle() const {
             assert(elems);
-            for (uint32_t i = 0; i < B/2; i++) {
-                uint64_t occ = blocks[(curBlock + i) % B].occ;
-                if (occ) {
-                    uint64_t pos = __builtin_ctzl(occ);
-                    return (curBlock + i)*64 + pos;
-                }
-            }
-            for (uint32_t i = B/2; i < B; i++) { //beyond B/2 blocks, there may be a far element that comes earlier
-                uint64_t occ = blocks[(curBlock + i) % B].occ;
-                if (occ) {
-                    uint64_t pos = __builtin_ctzl(occ);
-                    uint64_t cycle = (curBlock + i)*64 + pos;
-                    return feMap.empty()? cycle : MIN(cycle, feMap.begin()->first);
-                }
-            }
+            uint64_t occ = blocks[curBlock % B].occ;
+            if (occ) return curBlock*64 + __builtin_ctzl(occ);
+            int32_t idx = nextPopulatedBlock();
+            if (idx < 0) return feMap.begin()->first;
+            uint64_t absBlock = curBlock + (idx - curBlock % B + B) % B;
+            return absBlock*64 + __builtin_ctzl(blocks[idx].occ);
+        }
 
-            return feMap.begin()->first;
+    private:
+        inline void enqueueNear(T* obj, uint64_t cycle) {
+            uint32_t i = (cycle/64) % B;
+            blocks[i].enqueue(obj, cycle % 64);
+            blockOcc[i/64] |= 1UL << (i % 64);
+            topOcc |= 1UL << (i/64);
+        }
+
+        inline void clearOcc(uint32_t i) {
+            blockOcc[i/64] &= ~(1UL << (i % 64));
+            if (!blockOcc[i/64]) topOcc &= ~(1UL << (i/64));
+        }
+
+        // Returns the first populated ring index at or after from, or -1 if there is none
+        inline int32_t findPopulatedBlock(uint32_t from) const {
+            uint32_t w = from/64;
+            uint64_t occ = blockOcc[w] & (~0UL << (from % 64));
+            if (occ) return w*64 + __builtin_ctzl(occ);
+            uint64_t top = (w + 1 < 64)? (topOcc & (~0UL << (w + 1))) : 0;
+            if (!top) return -1;
+            w = __builtin_ctzl(top);
+            return w*64 + __builtin_ctzl(blockOcc[w]);
+        }
+
+        // Returns the ring index of the earliest populated block, or -1 if the ring is empty
+        inline int32_t nextPopulatedBlock() const {
+            if (!topOcc) return -1;
+            int32_t idx = findPopulatedBlock(curBlock % B);
+            return (idx >= 0)? idx : findPopulatedBlock(0); //wrap around
+        }
+
+        // Move every far element that the current window covers into the ring
+        inline void refill() {
+            uint64_t topCycle = (curBlock + B)*64;
+            FEMapIterator it = feMap.begin();
+            while (it != feMap.end() && it->first < topCycle) {
+                assert(it->first/64 >= curBlock);
+                enqueueNear(it->second, it->first);
+                it++;
+            }
+            feMap.erase(feMap.begin(), it);
         }
 };
 
 #endif  // PRIO_QUEUE_H_
-
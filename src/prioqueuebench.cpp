@@ -0,0 +1,147 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Microbenchmark of the weave phase's PrioQueue (see prio_queue.h), without
+ * Pin or the rest of the simulator.
+ *
+ * Runs the hold model: the queue starts with a fixed number of events, and
+ * every event dequeued is enqueued again a random number of cycles later, so
+ * the queue size stays constant. Each dequeue is preceded by a firstCycle()
+ * call, as ContentionSim does. Dense configs look like core and cache
+ * domains (many events, a few cycles apart); sparse ones look like memory
+ * controller domains, with a handful of events spread beyond the ring. All
+ * configs are checked against a std::multimap first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "galloc.h"
+#include "log.h"
+#include "prio_queue.h"
+#include "profile_stats.h"
+
+#define PQ_BLOCKS 1024 //as in contention_sim.h
+
+using std::vector;
+
+struct BenchEvent {
+    BenchEvent* next;
+    uint64_t cycle;
+};
+
+struct QueueConfig {
+    const char* name;
+    uint32_t events;
+    uint64_t maxGap; //events are re-enqueued [0, maxGap) cycles after they are dequeued
+};
+
+static uint64_t rngState;
+static volatile uint64_t sink;
+
+static uint64_t rnd() {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+//Returns the sum of dequeued cycles, so that the timed loop is not optimized away
+static uint64_t run(const QueueConfig& cfg, uint64_t numDequeues, bool check) {
+    PrioQueue<BenchEvent, PQ_BLOCKS>* pq = new PrioQueue<BenchEvent, PQ_BLOCKS>();
+    vector<BenchEvent> events(cfg.events);
+    std::multimap<uint64_t, BenchEvent*> ref;
+
+    rngState = 0x2545F4914F6CDD1DL;
+    for (BenchEvent& ev : events) {
+        ev.next = nullptr;
+        ev.cycle = rnd() % cfg.maxGap;
+        pq->enqueue(&ev, ev.cycle);
+        if (check) ref.insert(std::make_pair(ev.cycle, &ev));
+    }
+
+    uint64_t sum = 0;
+    uint64_t curCycle = 0;
+    for (uint64_t i = 0; i < numDequeues; i++) {
+        uint64_t first = pq->firstCycle();
+        uint64_t cycle;
+        BenchEvent* ev = pq->dequeue(cycle);
+        if (check) {
+            //Same-cycle events may come out in any order, so only cycles are compared
+            auto it = ref.begin();
+            if (first != cycle || cycle != it->first || ev->cycle != cycle || cycle < curCycle) {
+                panic("%s: dequeued event at cycle %ld (firstCycle %ld), expected %ld", cfg.name, cycle, first, it->first);
+            }
+            ref.erase(it);
+        }
+        curCycle = cycle;
+        sum += cycle;
+
+        ev->cycle = curCycle + rnd() % cfg.maxGap;
+        pq->enqueue(ev, ev->cycle);
+        if (check) ref.insert(std::make_pair(ev->cycle, ev));
+    }
+
+    delete pq;
+    return sum;
+}
+
+int main(int argc, const char* argv[]) {
+    InitLog(""); //no log header
+    if (argc > 2) {
+        info("Benchmarks the weave phase's PrioQueue on dense and sparse queues");
+        info("Usage: %s [dequeues]", argv[0]);
+        exit(1);
+    }
+    uint64_t numDequeues = (argc > 1)? atol(argv[1]) : 4*1024*1024;
+
+    gm_init(1ul << 28);
+
+    const QueueConfig configs[] = {
+        {"dense", 1024, 16},
+        {"dense", 64, 1000},
+        {"sparse", 16, 50000},
+        {"sparse", 16, 1000000},
+        {"far", 16, 20000000}, //mostly beyond the ring, in the far-element map
+    };
+
+    info("%8s %7s %10s %10s %10s", "Queue", "Events", "MaxGap", "ns/event", "Mevents/s");
+    for (const QueueConfig& cfg : configs) {
+        run(cfg, std::min(numDequeues, 100000ul), true);
+
+        //Best of a few runs, to filter out noise from other host processes
+        double ns = 0.0;
+        for (uint32_t r = 0; r < 3; r++) {
+            uint64_t startNs = getNs();
+            sink += run(cfg, numDequeues, false);
+            double runNs = ((double)(getNs() - startNs))/numDequeues;
+            ns = r? std::min(ns, runNs) : runNs;
+        }
+        info("%8s %7d %10ld %10.2f %10.2f", cfg.name, cfg.events, cfg.maxGap, ns, 1e3/ns);
+    }
+    return 0;
+}
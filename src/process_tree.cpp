@@ -187,11 +187,19 @@ static void PopulateLevel(Config& config, const std::string& prefix, std::vector
         }  //  else leave mask empty, no cores
         g_vector<uint64_t> ffiPoints(ParseList<uint64_t>(config.get<const char*>(p_ss.str() +  ".ffiPoints", "")));
 
+        //Sampled simulation: alternate detailed units of samplingUnit instrs with samplingInterval instrs of functional
+        //warming; each unit is preceded by samplingWarmup detailed instrs that are not measured (see sampler.h)
+        SamplingParams sampling;
+        sampling.unit = config.get<uint64_t>(p_ss.str() +  ".samplingUnit", 0);
+        sampling.interval = config.get<uint64_t>(p_ss.str() +  ".samplingInterval", 0);
+        sampling.detailedWarmup = config.get<uint64_t>(p_ss.str() +  ".samplingWarmup", 0);
+        if (sampling.unit && zinfo->traceDriven) panic("process%d: sampled simulation needs execution-driven cores", procIdx);
+
         if (dumpInstrs) {
             if (dumpHeartbeats) warn("Dumping eventual stats on both heartbeats AND instructions; you won't be able to distinguish both!");
             auto getInstrs = [procIdx]() { return zinfo->processStats->getProcessInstrs(procIdx); };
             auto dumpStats = [procIdx]() { DumpEventualStats(procIdx, "instructions"); };
-            zinfo->eventQueue->insert(makeAdaptiveEvent(getInstrs, dumpStats, 0, dumpInstrs, MAX_IPC*zinfo->phaseLength*zinfo->numCores /*all cores can be on*/));
+            zinfo->eventQueue->insert(makeAdaptiveEvent(getInstrs, dumpStats, 0, dumpInstrs, MAX_IPC*zinfo->maxPhaseLength*zinfo->numCores /*all cores can be on*/));
         } //NOTE: trivial to do the same with cycles
 
         if (clockDomain >= MAX_CLOCK_DOMAINS) panic("Invalid clock domain %d", clockDomain);
@@ -207,7 +215,7 @@ static void PopulateLevel(Config& config, const std::string& prefix, std::vector
         else
             panic("Invalid synced fast forward mode %s", syncedFastForwardStr.c_str());
 
-        ProcessTreeNode* ptn = new ProcessTreeNode(procIdx, groupIdx, startFastForwarded, startPaused, syncedFastForward, clockDomain, portDomain, dumpHeartbeats, dumpsResetHeartbeats, restarts, mask, ffiPoints, syscallBlacklistRegex, gpr);
+        ProcessTreeNode* ptn = new ProcessTreeNode(procIdx, groupIdx, startFastForwarded, startPaused, syncedFastForward, clockDomain, portDomain, dumpHeartbeats, dumpsResetHeartbeats, restarts, mask, ffiPoints, sampling, syscallBlacklistRegex, gpr);
         //info("Created ProcessTreeNode, procIdx %d", procIdx);
         parent->addChild(ptn);
         children.push_back(ptn);
@@ -229,7 +237,7 @@ static void PopulateLevel(Config& config, const std::string& prefix, std::vector
 }
 
 void CreateProcessTree(Config& config) {
-    ProcessTreeNode* rootNode = new ProcessTreeNode(-1, -1, false, false, SFF_NEVER, 0, 0, 0, false, 0, g_vector<bool> {},  g_vector<uint64_t> {}, g_string {}, nullptr);
+    ProcessTreeNode* rootNode = new ProcessTreeNode(-1, -1, false, false, SFF_NEVER, 0, 0, 0, false, 0, g_vector<bool> {},  g_vector<uint64_t> {}, SamplingParams {0, 0, 0}, g_string {}, nullptr);
     uint32_t procIdx = 0;
     uint32_t groupIdx = 0;
     std::vector<ProcessTreeNode*> globProcVector;
@@ -40,6 +40,13 @@ enum SyncedFastForwardMode {
     SFF_NEVER
 };
 
+//Sampled simulation (see sampler.h), in instructions; unit == 0 disables sampling
+struct SamplingParams {
+    uint64_t unit; //detailed instrs measured per sample
+    uint64_t interval; //functional warming instrs between samples
+    uint64_t detailedWarmup; //detailed but unmeasured instrs before each sample
+};
+
 class ProcessTreeNode : public GlobAlloc {
     private:
         g_vector<ProcessTreeNode*> children;
@@ -51,6 +58,7 @@ class ProcessTreeNode : public GlobAlloc {
         bool started;
         volatile bool inFastForward;
         volatile bool inPause;
+        volatile bool inWarming; //between sampled units, threads run the cores' functional warming pointers
         uint32_t restartsLeft;
         const SyncedFastForwardMode syncedFastForward;
         const uint32_t clockDomain;
@@ -59,14 +67,15 @@ class ProcessTreeNode : public GlobAlloc {
         const bool dumpsResetHeartbeats;
         const g_vector<bool> mask;
         const g_vector<uint64_t> ffiPoints;
+        const SamplingParams sampling;
         const g_string syscallBlacklistRegex;
 
     public:
         ProcessTreeNode(uint32_t _procIdx, uint32_t _groupIdx, bool _inFastForward, bool _inPause, const SyncedFastForwardMode& _syncedFastForward,
                         uint32_t _clockDomain, uint32_t _portDomain, uint64_t _dumpHeartbeats, bool _dumpsResetHeartbeats, uint32_t _restarts,
-                        const g_vector<bool>& _mask, const g_vector<uint64_t>& _ffiPoints, const g_string& _syscallBlacklistRegex, const char*_patchRoot)
+                        const g_vector<bool>& _mask, const g_vector<uint64_t>& _ffiPoints, const SamplingParams& _sampling, const g_string& _syscallBlacklistRegex, const char*_patchRoot)
             : patchRoot(_patchRoot), procIdx(_procIdx), groupIdx(_groupIdx), curChildren(0), heartbeats(0), started(false), inFastForward(_inFastForward),
-              inPause(_inPause), restartsLeft(_restarts), syncedFastForward(_syncedFastForward), clockDomain(_clockDomain), portDomain(_portDomain), dumpHeartbeats(_dumpHeartbeats), dumpsResetHeartbeats(_dumpsResetHeartbeats), mask(_mask), ffiPoints(_ffiPoints), syscallBlacklistRegex(_syscallBlacklistRegex) {}
+              inPause(_inPause), inWarming(false), restartsLeft(_restarts), syncedFastForward(_syncedFastForward), clockDomain(_clockDomain), portDomain(_portDomain), dumpHeartbeats(_dumpHeartbeats), dumpsResetHeartbeats(_dumpsResetHeartbeats), mask(_mask), ffiPoints(_ffiPoints), sampling(_sampling), syscallBlacklistRegex(_syscallBlacklistRegex) {}
 
         void addChild(ProcessTreeNode* child) {
             children.push_back(child);
@@ -110,6 +119,7 @@ class ProcessTreeNode : public GlobAlloc {
 
         inline bool isInFastForward() const { return inFastForward; }
         inline bool isInPause() const { return inPause; }
+        inline bool isWarming() const { return inWarming; }
         inline bool getSyncedFastForward() const {
             return syncedFastForward == SFF_ALWAYS || (syncedFastForward == SFF_MULTIPROCESS && zinfo->numProcs > 1);
         }
@@ -140,6 +150,16 @@ class ProcessTreeNode : public GlobAlloc {
             return ffiPoints;
         }
 
+        const SamplingParams& getSampling() const {
+            return sampling;
+        }
+
+        //Called by the sampler at the end of a phase; threads switch pointers at their next barrier or join
+        void setWarming(bool warming) {
+            inWarming = warming;
+            __sync_synchronize();
+        }
+
         const g_string& getSyscallBlacklistRegex() const {
             return syscallBlacklistRegex;
         }
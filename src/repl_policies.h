@@ -32,6 +32,7 @@
 #include "coherence_ctrls.h"
 #include "memory_hierarchy.h"
 #include "mtrand.h"
+#include "snapshot.h"
 
 /* Generic replacement policy interface. A replacement policy is initialized by the cache (by calling setTop/BottomCC) and used by the cache array. Usage follows two models:
  * - On lookups, update() is called if the replacement policy is to be updated on a hit
@@ -54,6 +55,13 @@ class ReplPolicy : public GlobAlloc {
         virtual uint32_t rankCands(const MemReq* req, ZCands cands) = 0;
 
         virtual void initStats(AggregateStat* parent) {}
+
+        //Host bytes of per-line replacement state, for footprint stats; 0 if the array keeps it (e.g., ideal arrays)
+        virtual uint64_t getStateBytes() const {return 0;}
+
+        //Saves and restores per-line state (see snapshot.h)
+        virtual void saveState(SnapshotWriter& w) {panic("%s: replacement policy does not support snapshots", w.getSection());}
+        virtual void restoreState(SnapshotReader& r) {panic("%s: replacement policy does not support snapshots", r.getSection());}
 };
 
 /* Add DECL_RANK_BINDINGS to each class that implements the new interface,
@@ -118,6 +126,20 @@ class LRUReplPolicy : public ReplPolicy {
             array[id] = 0;
         }
 
+        uint64_t getStateBytes() const {return numLines*sizeof(uint64_t);}
+
+        void saveState(SnapshotWriter& w) {
+            w.putTag("LRU");
+            w.put(timestamp);
+            w.putArray(array, numLines);
+        }
+
+        void restoreState(SnapshotReader& r) {
+            r.expectTag("LRU");
+            timestamp = r.get<uint64_t>();
+            r.getArray(array, numLines, "lines");
+        }
+
         template <typename C> inline uint32_t rank(const MemReq* req, C cands) {
             uint32_t bestCand = -1;
             uint64_t bestScore = (uint64_t)-1L;
@@ -186,6 +208,8 @@ class TreeLRUReplPolicy : public LRUReplPolicy<true> {
             candIdx = 0;
             array[id] = 0;
         }
+
+        uint64_t getStateBytes() const {return LRUReplPolicy<true>::getStateBytes() + numCands*sizeof(uint32_t);}
 };
 
 //2-bit NRU, see A new Case for Skew-Associativity, A. Seznec, 1997
@@ -249,6 +273,20 @@ class NRUReplPolicy : public LegacyReplPolicy {
             candIdx = 0;
             array[id] = 0;
         }
+
+        uint64_t getStateBytes() const {return (numLines + numCands)*sizeof(uint32_t);}
+
+        void saveState(SnapshotWriter& w) {
+            w.putTag("NRU");
+            w.put(youngLines);
+            w.putArray(array, numLines);
+        }
+
+        void restoreState(SnapshotReader& r) {
+            r.expectTag("NRU");
+            youngLines = r.get<uint32_t>();
+            r.getArray(array, numLines, "lines");
+        }
 };
 
 class RandReplPolicy : public LegacyReplPolicy {
@@ -286,6 +324,10 @@ class RandReplPolicy : public LegacyReplPolicy {
         void replaced(uint32_t id) {
             candIdx = 0;
         }
+
+        //No per-line state
+        void saveState(SnapshotWriter& w) {w.putTag("Rand");}
+        void restoreState(SnapshotReader& r) {r.expectTag("Rand");}
 };
 
 class LFUReplPolicy : public LegacyReplPolicy {
@@ -370,6 +412,196 @@ class LFUReplPolicy : public LegacyReplPolicy {
             bestRank.reset();
             array[id].acc = 0;
         }
+
+        uint64_t getStateBytes() const {return numLines*sizeof(LFUInfo);}
+
+        void saveState(SnapshotWriter& w) {
+            w.putTag("LFU");
+            w.put(timestamp);
+            w.putArray(array, numLines);
+        }
+
+        void restoreState(SnapshotReader& r) {
+            r.expectTag("LFU");
+            timestamp = r.get<uint64_t>();
+            r.getArray(array, numLines, "lines");
+        }
+};
+
+/* Compact LRU for set-associative arrays: instead of a 64-bit timestamp, each
+ * line keeps its recency rank within its set in a byte (0 is the MRU line,
+ * ways-1 the LRU one). Evicts exactly the same lines as LRUReplPolicy,
+ * including its preference for lines without sharers, with 1/8th of the
+ * state. Updates touch the whole set, which is a few bytes. Needs each set's
+ * lines to have consecutive ids, as in SetAssocArray.
+ */
+template <bool sharersAware>
+class SetLRUReplPolicy : public ReplPolicy {
+    private:
+        uint8_t* array; //rank within the set; each set holds a permutation of [0, ways)
+        uint32_t numLines;
+        uint32_t ways;
+
+    public:
+        SetLRUReplPolicy(uint32_t _numLines, uint32_t _ways) : numLines(_numLines), ways(_ways) {
+            if (ways > 256) panic("SetLRU replacement supports up to 256 ways, %d given", ways);
+            array = gm_calloc<uint8_t>(numLines);
+            for (uint32_t id = 0; id < numLines; id++) array[id] = id % ways;
+        }
+
+        ~SetLRUReplPolicy() {
+            gm_free(array);
+        }
+
+        //Makes id the MRU line, aging the lines that were more recent than it
+        void update(uint32_t id, const MemReq* req) {
+            uint8_t* set = &array[id - id % ways];
+            uint8_t rank = array[id];
+            for (uint32_t w = 0; w < ways; w++) set[w] += (set[w] < rank);
+            array[id] = 0;
+        }
+
+        //Makes id the LRU line (LRUReplPolicy zeroes its timestamp)
+        void replaced(uint32_t id) {
+            uint8_t* set = &array[id - id % ways];
+            uint8_t rank = array[id];
+            for (uint32_t w = 0; w < ways; w++) set[w] -= (set[w] > rank);
+            array[id] = ways - 1;
+        }
+
+        template <typename C> inline uint32_t rank(const MemReq* req, C cands) {
+            uint32_t bestCand = -1;
+            uint64_t bestScore = (uint64_t)-1L;
+            for (auto ci = cands.begin(); ci != cands.end(); ci.inc()) {
+                uint64_t s = score(*ci);
+                bestCand = (s < bestScore)? *ci : bestCand;
+                bestScore = MIN(s, bestScore);
+            }
+            return bestCand;
+        }
+
+        DECL_RANK_BINDINGS;
+
+        uint64_t getStateBytes() const {return numLines*sizeof(uint8_t);}
+
+        void saveState(SnapshotWriter& w) {
+            w.putTag("SetLRU");
+            w.put(ways);
+            w.putArray(array, numLines);
+        }
+
+        void restoreState(SnapshotReader& r) {
+            r.expectTag("SetLRU");
+            r.expect(ways, "ways");
+            r.getArray(array, numLines, "lines");
+        }
+
+    private:
+        //Same order as LRUReplPolicy::score(): invalid lines first, then by sharers, then least recently used
+        inline uint64_t score(uint32_t id) {
+            return ((sharersAware? cc->numSharers(id) : 0)*ways + ways - array[id])*cc->isValid(id);
+        }
+};
+
+/* Compact, approximate LRU for zcaches (or any array): each line keeps an
+ * 8-bit coarse-grained timestamp of its last access, and the current
+ * timestamp advances every numLines/32 accesses. Replacements evict the
+ * candidate with the oldest timestamp (preferring invalid lines and lines
+ * without sharers, as LRUReplPolicy does). Lines accessed within the same
+ * 1/32nd of a cache's worth of accesses are not ordered, so ties go to the
+ * first candidate.
+ *
+ * Ages saturate instead of wrapping around: every timestamp advance sweeps
+ * 1/64th of the lines and clamps ages above MAX_AGE to it, so every line is
+ * visited before its age can exceed 255. Lines unused for more than MAX_AGE
+ * timestamps (6 cache's worth of accesses) are thus roughly equally old.
+ */
+template <bool sharersAware>
+class CoarseLRUReplPolicy : public ReplPolicy {
+    private:
+        static const uint32_t TICKS_PER_CACHE = 32; //timestamp advances per numLines accesses
+        static const uint32_t SWEEP_TICKS = 64; //timestamp advances to sweep all lines
+        static const uint8_t MAX_AGE = 255 - SWEEP_TICKS;
+
+        uint8_t* array;
+        uint32_t numLines;
+        uint32_t tickAccesses; //accesses per timestamp advance
+        uint32_t sweepLines; //lines swept per timestamp advance
+
+        uint8_t curTs;
+        uint32_t accessesLeft; //until the next advance
+        uint32_t sweepPos;
+
+        inline uint8_t age(uint32_t id) const {return curTs - array[id];}
+
+        void tick() {
+            curTs++;
+            accessesLeft = tickAccesses;
+            for (uint32_t i = 0; i < sweepLines; i++) {
+                if (age(sweepPos) > MAX_AGE) array[sweepPos] = curTs - MAX_AGE;
+                if (++sweepPos == numLines) sweepPos = 0;
+            }
+        }
+
+    public:
+        explicit CoarseLRUReplPolicy(uint32_t _numLines) : numLines(_numLines), curTs(0), sweepPos(0) {
+            array = gm_calloc<uint8_t>(numLines);
+            tickAccesses = MAX(1u, numLines/TICKS_PER_CACHE);
+            sweepLines = (numLines + SWEEP_TICKS - 1)/SWEEP_TICKS;
+            accessesLeft = tickAccesses;
+        }
+
+        ~CoarseLRUReplPolicy() {
+            gm_free(array);
+        }
+
+        void update(uint32_t id, const MemReq* req) {
+            array[id] = curTs;
+            if (--accessesLeft == 0) tick();
+        }
+
+        void replaced(uint32_t id) {
+            array[id] = curTs - MAX_AGE;
+        }
+
+        template <typename C> inline uint32_t rank(const MemReq* req, C cands) {
+            uint32_t bestCand = -1;
+            uint64_t bestScore = (uint64_t)-1L;
+            for (auto ci = cands.begin(); ci != cands.end(); ci.inc()) {
+                uint64_t s = score(*ci);
+                bestCand = (s < bestScore)? *ci : bestCand;
+                bestScore = MIN(s, bestScore);
+            }
+            return bestCand;
+        }
+
+        DECL_RANK_BINDINGS;
+
+        uint64_t getStateBytes() const {return numLines*sizeof(uint8_t);}
+
+        void saveState(SnapshotWriter& w) {
+            w.putTag("CoarseLRU");
+            w.put(curTs);
+            w.put(accessesLeft);
+            w.put(sweepPos);
+            w.putArray(array, numLines);
+        }
+
+        void restoreState(SnapshotReader& r) {
+            r.expectTag("CoarseLRU");
+            curTs = r.get<uint8_t>();
+            accessesLeft = r.get<uint32_t>();
+            sweepPos = r.get<uint32_t>();
+            if (accessesLeft == 0 || accessesLeft > tickAccesses || sweepPos >= numLines) {
+                panic("Snapshot section %s: incompatible CoarseLRU state", r.getSection());
+            }
+            r.getArray(array, numLines, "lines");
+        }
+
+    private:
+        inline uint64_t score(uint32_t id) {
+            return ((sharersAware? cc->numSharers(id) : 0)*256 + 256 - age(id))*cc->isValid(id);
+        }
 };
 
 //Extends a given replacement policy to profile access ordering violations
@@ -0,0 +1,217 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sampler.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "bithacks.h"
+#include "log.h"
+#include "process_stats.h"
+#include "process_tree.h"
+#include "stats_filter.h"
+#include "zsim.h"
+
+#define CI95_Z 1.96 //normal approximation; fine with the tens of samples sampling needs to be useful anyway
+
+Sampler::Sampler(const char* missStatsRegex, const char* _samplesFile) : samplesFile(_samplesFile) {
+    maxProcs = zinfo->lineSize; //see ProcessTreeNode::getNextChild
+    procs = gm_calloc<ProcState>(maxProcs);
+    for (uint32_t p = 0; p < maxProcs; p++) procs[p].mode = SMP_IDLE;
+
+    missStats = strlen(missStatsRegex)? FilterStats(zinfo->rootStat, missStatsRegex) : nullptr;
+    if (!missStats) warn("Sampling: no stats match sim.samplingMissStats \"%s\", MPKI will be 0", missStatsRegex);
+
+    FILE* f = fopen(samplesFile, "w");
+    if (!f) panic("Sampling: could not open %s", samplesFile);
+    fprintf(f, "# proc sample startInstrs instrs cycles misses cpi mpki\n");
+    fclose(f);
+
+    for (uint32_t p = 0; p < zinfo->numProcs; p++) {
+        const SamplingParams& sp = zinfo->procArray[p]->getSampling();
+        if (sp.unit) info("Sampling process %d: %ld-instr units, %ld warming instrs between units, %ld detailed warmup instrs", p, sp.unit, sp.interval, sp.detailedWarmup);
+    }
+}
+
+void Sampler::initStats(AggregateStat* parentStat) {
+    AggregateStat* smpStat = new AggregateStat();
+    smpStat->init("sampling", "Sampled simulation stats, per process");
+    profSamples.init("samples", "Measured units", maxProcs);
+    smpStat->append(&profSamples);
+    profInstrs.init("instrs", "Instrs in measured units", maxProcs);
+    smpStat->append(&profInstrs);
+    profCycles.init("cycles", "Cycles in measured units", maxProcs);
+    smpStat->append(&profCycles);
+    profMisses.init("misses", "Misses (sim.samplingMissStats) in measured units", maxProcs);
+    smpStat->append(&profMisses);
+    profWarmPhases.init("warmPhases", "Phases in functional warming", maxProcs);
+    smpStat->append(&profWarmPhases);
+
+    auto cpiFn = [this](uint32_t p) { return (uint64_t)round(1000*mean(p, procs[p].sumCpi)); };
+    auto cpiStat = makeLambdaVectorStat(cpiFn, maxProcs);
+    cpiStat->init("cpi", "Mean CPI over units (x1000)");
+    smpStat->append(cpiStat);
+    auto cpiCIFn = [this](uint32_t p) { return (uint64_t)round(1000*ci95(p, procs[p].sumCpi, procs[p].sumSqCpi)); };
+    auto cpiCIStat = makeLambdaVectorStat(cpiCIFn, maxProcs);
+    cpiCIStat->init("cpiCI", "95% confidence interval half-width of mean CPI (x1000)");
+    smpStat->append(cpiCIStat);
+    auto mpkiFn = [this](uint32_t p) { return (uint64_t)round(1000*mean(p, procs[p].sumMpki)); };
+    auto mpkiStat = makeLambdaVectorStat(mpkiFn, maxProcs);
+    mpkiStat->init("mpki", "Mean MPKI over units (x1000)");
+    smpStat->append(mpkiStat);
+    auto mpkiCIFn = [this](uint32_t p) { return (uint64_t)round(1000*ci95(p, procs[p].sumMpki, procs[p].sumSqMpki)); };
+    auto mpkiCIStat = makeLambdaVectorStat(mpkiCIFn, maxProcs);
+    mpkiCIStat->init("mpkiCI", "95% confidence interval half-width of mean MPKI (x1000)");
+    smpStat->append(mpkiCIStat);
+
+    parentStat->append(smpStat);
+}
+
+static uint64_t SumStats(const Stat* s) {
+    if (const AggregateStat* as = dynamic_cast<const AggregateStat*>(s)) {
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < as->curSize(); i++) sum += SumStats(as->get(i));
+        return sum;
+    } else if (const ScalarStat* ss = dynamic_cast<const ScalarStat*>(s)) {
+        return ss->get();
+    } else if (const VectorStat* vs = dynamic_cast<const VectorStat*>(s)) {
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < vs->size(); i++) sum += vs->count(i);
+        return sum;
+    } else {
+        panic("Sampling: unrecognized stat type for %s", s->name());
+    }
+}
+
+uint64_t Sampler::getMisses() const {
+    return missStats? SumStats(missStats) : 0;
+}
+
+double Sampler::mean(uint32_t p, double sum) const {
+    uint64_t n = profSamples.count(p);
+    return n? sum/n : 0.0;
+}
+
+double Sampler::ci95(uint32_t p, double sum, double sumSq) const {
+    uint64_t n = profSamples.count(p);
+    if (n < 2) return 0.0;
+    double m = sum/n;
+    double var = (sumSq - n*m*m)/(n - 1);
+    return (var > 0.0)? CI95_Z*sqrt(var/n) : 0.0;
+}
+
+void Sampler::setMode(uint32_t p, Mode mode, uint64_t instrs) {
+    ProcessTreeNode* ptn = zinfo->procArray[p];
+    const SamplingParams& sp = ptn->getSampling();
+    ProcState& ps = procs[p];
+
+    if (mode == SMP_DETAILED_WARMUP && !sp.detailedWarmup) mode = SMP_MEASURE;
+    ps.mode = mode;
+    switch (mode) {
+        case SMP_IDLE:
+            break;
+        case SMP_WARMING:
+            ps.modeEnd = instrs + sp.interval;
+            break;
+        case SMP_DETAILED_WARMUP:
+            ps.modeEnd = instrs + sp.detailedWarmup;
+            break;
+        case SMP_MEASURE:
+            ps.modeEnd = instrs + sp.unit;
+            ps.startInstrs = instrs;
+            ps.startCycles = zinfo->processStats->getProcessCycles(p);
+            ps.startMisses = getMisses();
+            break;
+    }
+
+    bool warming = (mode == SMP_WARMING);
+    if (ptn->isWarming() != warming) ptn->setWarming(warming);
+}
+
+void Sampler::recordSample(uint32_t p, uint64_t instrs, uint64_t cycles) {
+    ProcState& ps = procs[p];
+    uint64_t unitInstrs = instrs - ps.startInstrs;
+    uint64_t unitCycles = cycles - ps.startCycles;
+    uint64_t unitMisses = getMisses() - ps.startMisses;
+    if (!unitInstrs) return;
+
+    double cpi = ((double)unitCycles)/unitInstrs;
+    double mpki = 1000.0*unitMisses/unitInstrs;
+    ps.sumCpi += cpi;
+    ps.sumSqCpi += cpi*cpi;
+    ps.sumMpki += mpki;
+    ps.sumSqMpki += mpki*mpki;
+    profSamples.inc(p);
+    profInstrs.inc(p, unitInstrs);
+    profCycles.inc(p, unitCycles);
+    profMisses.inc(p, unitMisses);
+
+    //Any process may run the end of a phase, so open the file every time; samples are at least a phase apart
+    FILE* f = fopen(samplesFile, "a");
+    if (f) {
+        fprintf(f, "%d %ld %ld %ld %ld %ld %.4f %.4f\n", p, profSamples.count(p) - 1, ps.startInstrs, unitInstrs, unitCycles, unitMisses, cpi, mpki);
+        fclose(f);
+    } else {
+        warn("Sampling: could not append to %s", samplesFile);
+    }
+}
+
+void Sampler::endOfPhase() {
+    for (uint32_t p = 0; p < MIN(zinfo->numProcs, maxProcs); p++) {
+        ProcessTreeNode* ptn = zinfo->procArray[p];
+        if (!ptn || !ptn->getSampling().unit) continue;
+        ProcState& ps = procs[p];
+
+        //Pause while fast-forwarded; restart with a detailed warmup afterwards
+        if (ptn->isInFastForward()) {
+            if (ps.mode != SMP_IDLE) setMode(p, SMP_IDLE, 0);
+            continue;
+        }
+
+        uint64_t instrs = zinfo->processStats->getProcessInstrs(p);
+        if (ps.mode == SMP_IDLE) {
+            setMode(p, SMP_DETAILED_WARMUP, instrs);
+            continue;
+        }
+
+        if (ps.mode == SMP_WARMING) profWarmPhases.inc(p);
+        if (instrs < ps.modeEnd) continue;
+
+        switch (ps.mode) {
+            case SMP_WARMING:
+                setMode(p, SMP_DETAILED_WARMUP, instrs);
+                break;
+            case SMP_DETAILED_WARMUP:
+                setMode(p, SMP_MEASURE, instrs);
+                break;
+            case SMP_MEASURE:
+                recordSample(p, instrs, zinfo->processStats->getProcessCycles(p));
+                setMode(p, ptn->getSampling().interval? SMP_WARMING : SMP_DETAILED_WARMUP, instrs);
+                break;
+            default:
+                panic("Sampling: invalid mode %d", ps.mode);
+        }
+    }
+}
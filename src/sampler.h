@@ -0,0 +1,104 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+/* Sampled simulation (SMARTS-style systematic sampling), configured per
+ * process with processN.samplingUnit, samplingInterval and samplingWarmup.
+ *
+ * A sampled process alternates between detailed simulation and functional
+ * warming. While warming, its threads run the cores' warming pointers (see
+ * Core::GetWarmFuncPtrs), which keep caches and branch predictors up to date
+ * and advance the core's clock at IPC=1, but model no timing and record no
+ * weave events (see MemReq::WARMUP). Each detailed stretch starts with
+ * samplingWarmup unmeasured instrs to refill the pipeline's structures,
+ * followed by a measured unit of samplingUnit instrs.
+ *
+ * Modes change at the end of a phase, when process instruction counts are up
+ * to date, so units and intervals are rounded up to whole phases; each sample
+ * is measured exactly over the instrs it covers. Per-sample records go to
+ * zsim-samples.out, and stats report per-process means and 95% confidence
+ * intervals of CPI and MPKI. Misses are the sum of the stats that match
+ * sim.samplingMissStats (e.g., the LLC's miss counters). Cache stats are not
+ * per-process, so MPKI is only meaningful when a single process runs.
+ *
+ * Sampling pauses while the process is fast-forwarded, so it composes with
+ * ffiPoints and magic-op fast-forwarding: a unit cut short by fast-forward is
+ * dropped, and sampling restarts with a detailed warmup when the process
+ * leaves fast-forward. ffiPoints count warming instrs too.
+ */
+
+#include <stdint.h>
+#include "galloc.h"
+#include "stats.h"
+
+class Sampler : public GlobAlloc {
+    private:
+        enum Mode {
+            SMP_IDLE,  // in fast-forward or not started yet
+            SMP_WARMING,
+            SMP_DETAILED_WARMUP,
+            SMP_MEASURE
+        };
+
+        struct ProcState {
+            Mode mode;
+            uint64_t modeEnd; //process instrs at which the current mode ends
+            uint64_t startInstrs, startCycles, startMisses; //at the start of the unit being measured
+
+            //Running sums over samples, for the means and confidence intervals
+            double sumCpi, sumSqCpi;
+            double sumMpki, sumSqMpki;
+        };
+
+        ProcState* procs; //indexed by process, sized to the max number of processes (sys.lineSize)
+        uint32_t maxProcs;
+        const AggregateStat* missStats; //nullptr if none matched
+        const char* samplesFile;
+
+        VectorCounter profSamples;
+        VectorCounter profInstrs; //measured
+        VectorCounter profCycles;
+        VectorCounter profMisses;
+        VectorCounter profWarmPhases;
+
+    public:
+        //Call after the memory hierarchy's stats are registered, as it looks up the miss stats
+        Sampler(const char* missStatsRegex, const char* _samplesFile);
+        void initStats(AggregateStat* parentStat);
+
+        //Called at the end of every phase, after the weave phase
+        void endOfPhase();
+
+    private:
+        uint64_t getMisses() const;
+        void setMode(uint32_t p, Mode mode, uint64_t instrs);
+        void recordSample(uint32_t p, uint64_t instrs, uint64_t cycles);
+        double mean(uint32_t p, double sum) const;
+        double ci95(uint32_t p, double sum, double sumSq) const;
+};
+
+#endif  // SAMPLER_H_
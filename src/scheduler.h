@@ -436,6 +436,8 @@ class Scheduler : public GlobAlloc, public Callee {
             /* End of phase accounting */
             zinfo->numPhases++;
             zinfo->globPhaseCycles += zinfo->phaseLength;
+            zinfo->phaseLength = zinfo->nextPhaseLength;
+            zinfo->nextPhaseLength = zinfo->pendingPhaseLength;
             curPhase++;
 
             assert(curPhase == zinfo->numPhases); //check they don't skew
@@ -44,7 +44,7 @@ void SimpleCore::initStats(AggregateStat* parentStat) {
 }
 
 uint64_t SimpleCore::getPhaseCycles() const {
-    return curCycle % zinfo->phaseLength;
+    return (curCycle > zinfo->globPhaseCycles)? curCycle - zinfo->globPhaseCycles : 0;
 }
 
 void SimpleCore::load(Address addr) {
@@ -89,7 +89,7 @@ void SimpleCore::join() {
 //Static class functions: Function pointers and trampolines
 
 InstrFuncPtrs SimpleCore::GetFuncPtrs() {
-    return {LoadFunc, StoreFunc, BblFunc, BranchFunc, PredLoadFunc, PredStoreFunc, FPTR_ANALYSIS, {0}};
+    return {LoadFunc, StoreFunc, BblFunc, BranchFunc, PredLoadFunc, PredStoreFunc, MemBatchFunc, FPTR_ANALYSIS};
 }
 
 void SimpleCore::LoadFunc(THREADID tid, ADDRINT addr) {
@@ -108,13 +108,22 @@ void SimpleCore::PredStoreFunc(THREADID tid, ADDRINT addr, BOOL pred) {
     if (pred) static_cast<SimpleCore*>(cores[tid])->store(addr);
 }
 
+void SimpleCore::MemBatchFunc(THREADID tid, MemOpBatch* batch) {
+    SimpleCore* core = static_cast<SimpleCore*>(cores[tid]);
+    for (uint32_t i = 0; i < batch->numOps; i++) {
+        uint64_t op = batch->ops[i];
+        if (MemOpBatch::isStore(op)) core->store(MemOpBatch::addr(op));
+        else core->load(MemOpBatch::addr(op));
+    }
+}
+
 void SimpleCore::BblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
     SimpleCore* core = static_cast<SimpleCore*>(cores[tid]);
     core->bbl(bblAddr, bblInfo);
 
     while (core->curCycle > core->phaseEndCycle) {
         assert(core->phaseEndCycle == zinfo->globPhaseCycles + zinfo->phaseLength);
-        core->phaseEndCycle += zinfo->phaseLength;
+        core->phaseEndCycle += zinfo->nextPhaseLength;
 
         uint32_t cid = getCid(tid);
         //NOTE: TakeBarrier may take ownership of the core, and so it will be used by some other thread. If TakeBarrier context-switches us,
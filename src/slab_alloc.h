@@ -33,6 +33,13 @@
  * are garbage-collected once all their events are done. To do this without space
  * overheads, slabs are carefully aligned, so that objects inside the slab can
  * derive the pointer of their slab.
+ *
+ * Allocations are unsynced, but may happen while other threads free elements
+ * of the same slab (e.g., with a pipelined weave phase). To avoid atomic ops
+ * on allocation, the current slab keeps liveElems biased by SLAB_LIVE_BIAS and
+ * counts allocations privately; when the allocator moves to a new slab, it
+ * removes the bias and the allocations still live, and whoever brings
+ * liveElems to 0 frees the slab.
  */
 
 #include <deque>
@@ -44,6 +51,7 @@
 
 #define SLAB_SIZE (1<<16)  // 64KB; must be a power of two
 #define SLAB_MASK (~(SLAB_SIZE - 1))
+#define SLAB_LIVE_BIAS (1u << 31)
 
 // Uncomment to immediately scrub slabs (to 0) and freed elems (to -1).
 // This makes use-after-free errors obvious.
@@ -55,9 +63,10 @@ class SlabAlloc;
 
 struct Slab {  // POD type (no constructor)
     SlabAlloc* allocator;
-    volatile uint32_t liveElems;
+    volatile uint32_t liveElems;  // biased by SLAB_LIVE_BIAS while this is the allocator's current slab
     uint32_t usedBytes;
-    char buf[SLAB_SIZE - sizeof(SlabAlloc*) - sizeof(volatile uint32_t) - sizeof(uint32_t)];
+    uint32_t allocElems;  // only touched by the allocating thread
+    char buf[SLAB_SIZE - sizeof(SlabAlloc*) - sizeof(volatile uint32_t) - 2*sizeof(uint32_t)];
 
     void init(SlabAlloc* _allocator) {
         allocator = _allocator;
@@ -65,8 +74,9 @@ struct Slab {  // POD type (no constructor)
     }
 
     void clear() {
-        liveElems = 0;
+        liveElems = SLAB_LIVE_BIAS;
         usedBytes = 0;
+        allocElems = 0;
     }
 
     void* alloc(uint32_t bytes) {
@@ -81,7 +91,7 @@ struct Slab {  // POD type (no constructor)
 #endif
         //info("Allocation starting at %p, %d bytes", ptr, bytes);
         if (usedBytes < sizeof(buf)) {
-            liveElems++;  // allocation is unsynced, no need for atomic op
+            allocElems++;  // allocation is unsynced, no need for atomic op
             return ptr;
         } else {
             return nullptr;
@@ -89,6 +99,7 @@ struct Slab {  // POD type (no constructor)
     }
 
     inline void freeElem();
+    inline void seal();
 };
 
 class SlabAlloc {
@@ -119,7 +130,15 @@ class SlabAlloc {
 
     private:
         void allocSlab() {
-            scoped_mutex sm(freeLock);
+            Slab* prevSlab = curSlab;
+            {
+                scoped_mutex sm(freeLock);
+                allocSlabLocked();
+            }
+            if (prevSlab) prevSlab->seal();  // may free it, so do it outside freeLock
+        }
+
+        void allocSlabLocked() {
             if (!freeList.empty()) {
                 curSlab = freeList.back();
                 freeList.pop_back();
@@ -137,14 +156,13 @@ class SlabAlloc {
         void freeSlab(Slab* s) {
             scoped_mutex sm(freeLock);
             //info("freeing slab %p, %d live, %ld in freeList", s, liveSlabs, freeList.size());
+            assert(s != curSlab);  // curSlab is biased, so it is never freed
             s->clear();
 #ifdef DEBUG_SLAB_ALLOC
             memset(s->buf, -1, sizeof(s->buf));
 #endif
-            if (s != curSlab) {
-                freeList.push_back(s);
-                liveSlabs--;
-            }
+            freeList.push_back(s);
+            liveSlabs--;
             assert(liveSlabs);  // at least curSlab
         }
 
@@ -153,13 +171,24 @@ class SlabAlloc {
 
 inline void Slab::freeElem() {
     uint32_t prevLiveElems = __sync_fetch_and_sub(&liveElems, 1);
-    assert(prevLiveElems && prevLiveElems < usedBytes /* >= 1 bytes/obj*/);
+    assert(prevLiveElems);
     //info("[%p] Slab::freeElem %d prevLiveElems", this, prevLiveElems);
     if (prevLiveElems == 1) {
         allocator->freeSlab(this);
     }
 }
 
+// Called by the allocator when this stops being its current slab
+inline void Slab::seal() {
+    assert(allocElems < SLAB_LIVE_BIAS);
+    uint32_t unbias = SLAB_LIVE_BIAS - allocElems;
+    uint32_t prevLiveElems = __sync_fetch_and_sub(&liveElems, unbias);
+    assert(prevLiveElems >= unbias);
+    if (prevLiveElems == unbias) {  // all elems already freed
+        allocator->freeSlab(this);
+    }
+}
+
 inline void freeElem(void* elem, size_t minSz) {
 #ifdef DEBUG_SLAB_ALLOC
     memset(elem, 0, minSz);
@@ -0,0 +1,183 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "snapshot.h"
+#include <functional>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "cache.h"
+#include "constants.h"
+#include "core.h"
+#include "event_queue.h"
+#include "zsim.h"
+
+/* File format: the magic, the version, the line size, and the number of
+ * sections; then each section's name (u32 length and chars), payload bytes
+ * (u64), and payload. Each payload is whatever the component's saveState()
+ * wrote, which is sized beforehand with a dry run.
+ */
+
+#define SNAPSHOT_MAGIC "ZSNAP"
+#define SNAPSHOT_VERSION 1
+
+typedef std::function<void (SnapshotWriter&)> SaveFunc;
+
+//Calls f(name, saveFunc) on every component, in the same order every time
+template <typename F>
+static void ForEachComponent(F f) {
+    for (Cache* c : *zinfo->caches) f(c->getName(), [c](SnapshotWriter& w) { c->saveState(w); });
+    for (uint32_t i = 0; i < zinfo->numCores; i++) {
+        Core* core = zinfo->cores[i];
+        f(core->getName(), [core](SnapshotWriter& w) { core->saveState(w); });
+    }
+}
+
+void InitSnapshots(const char* snapshotFile, uint64_t snapshotInstrs) {
+    //Dry run: components without snapshot support panic now, not after hours of simulation
+    uint64_t bytes = 0;
+    ForEachComponent([&](const char* name, SaveFunc save) {
+        SnapshotWriter w(name, nullptr);
+        save(w);
+        bytes += w.getBytes();
+    });
+    info("Snapshots enabled, will save %ld caches and %d cores to %s (%ld KB)",
+            zinfo->caches->size(), zinfo->numCores, snapshotFile, bytes/1024);
+    if (zinfo->ffWarmRate) warn("sim.ffWarmRate is set, fast-forwarded threads may warm caches while a snapshot is taken");
+
+    zinfo->snapshotFile = gm_strdup(snapshotFile);
+    if (snapshotInstrs) {
+        auto getInstrs = []() {
+            uint64_t instrs = 0;
+            for (uint32_t i = 0; i < zinfo->numCores; i++) instrs += zinfo->cores[i]->getInstrs();
+            return instrs;
+        };
+        auto fire = []() { zinfo->snapshotPending = true; };
+        zinfo->eventQueue->insert(makeAdaptiveEvent(getInstrs, fire, 0, snapshotInstrs, MAX_IPC*zinfo->maxPhaseLength*zinfo->numCores /*all cores can be on*/));
+    }
+}
+
+void TakeSnapshot() {
+    zinfo->snapshotPending = false;
+    const char* file = zinfo->snapshotFile;
+    assert(file);
+
+    //Readers never see partial files, as we write a temporary one and rename it
+    std::string tmpFile = std::string(file) + ".tmp." + std::to_string(getpid());
+    FILE* f = fopen(tmpFile.c_str(), "w");
+    if (!f) {
+        warn("Could not write %s, not saving the snapshot", tmpFile.c_str());
+        return;
+    }
+
+    uint32_t numSections = zinfo->caches->size() + zinfo->numCores;
+    SnapshotWriter hdr("header", f);
+    hdr.write(SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC));
+    hdr.put((uint32_t)SNAPSHOT_VERSION);
+    hdr.put(zinfo->lineSize);
+    hdr.put(numSections);
+    bool ok = hdr.isOk();
+    uint64_t bytes = hdr.getBytes();
+
+    ForEachComponent([&](const char* name, SaveFunc save) {
+        if (!ok) return;
+        SnapshotWriter dry(name, nullptr);
+        save(dry);
+
+        SnapshotWriter w(name, f);
+        w.putTag(name);
+        w.put(dry.getBytes());
+        save(w);
+        ok = w.isOk();
+        bytes += w.getBytes();
+    });
+
+    ok = (fclose(f) == 0) && ok;
+    if (ok && rename(tmpFile.c_str(), file) == 0) {
+        info("Saved snapshot of %d sections (%ld KB) to %s at phase %ld", numSections, bytes/1024, file, zinfo->numPhases);
+    } else {
+        warn("Could not write %s, not saving the snapshot", tmpFile.c_str());
+        unlink(tmpFile.c_str());
+    }
+}
+
+void RestoreSnapshot(const char* file) {
+    FILE* f = fopen(file, "r");
+    if (!f) panic("Could not open snapshot %s", file);
+    std::vector<uint8_t> buf;
+    uint8_t chunk[1 << 16];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) buf.insert(buf.end(), chunk, chunk + n);
+    fclose(f);
+
+    SnapshotReader hdr(file, buf.data(), buf.size());
+    char magic[sizeof(SNAPSHOT_MAGIC)] = {0};
+    hdr.read(magic, strlen(SNAPSHOT_MAGIC));
+    if (strcmp(magic, SNAPSHOT_MAGIC) != 0) panic("%s is not a zsim snapshot", file);
+    hdr.expect((uint32_t)SNAPSHOT_VERSION, "version");
+    hdr.expect(zinfo->lineSize, "line size");
+    uint32_t numSections = hdr.get<uint32_t>();
+
+    //Index sections by name
+    std::unordered_map<std::string, std::pair<const uint8_t*, uint64_t>> sections;
+    uint64_t pos = strlen(SNAPSHOT_MAGIC) + 3*sizeof(uint32_t);
+    for (uint32_t i = 0; i < numSections; i++) {
+        SnapshotReader r(file, buf.data() + pos, buf.size() - pos);
+        uint32_t nameLen = r.get<uint32_t>();
+        std::string name(nameLen, '\0');
+        r.read(&name[0], nameLen);
+        uint64_t len = r.get<uint64_t>();
+        uint64_t start = pos + sizeof(uint32_t) + nameLen + sizeof(uint64_t);
+        if (start + len > buf.size()) panic("Snapshot %s is truncated", file);
+        sections[name] = std::make_pair(buf.data() + start, len);
+        pos = start + len;
+    }
+
+    uint32_t restored = 0;
+    for (Cache* c : *zinfo->caches) {
+        auto it = sections.find(c->getName());
+        if (it == sections.end()) {
+            warn("Snapshot %s has no state for cache %s, it starts cold", file, c->getName());
+            continue;
+        }
+        SnapshotReader r(c->getName(), it->second.first, it->second.second);
+        c->restoreState(r);
+        if (!r.done()) panic("Snapshot section %s has trailing data (different configuration?)", c->getName());
+        restored++;
+    }
+
+    //Cores of a different type save nothing or state we can't use; they just start cold
+    for (uint32_t i = 0; i < zinfo->numCores; i++) {
+        Core* core = zinfo->cores[i];
+        auto it = sections.find(core->getName());
+        if (it == sections.end() || !it->second.second) continue;
+        SnapshotReader r(core->getName(), it->second.first, it->second.second);
+        core->restoreState(r);
+        restored++;
+    }
+
+    info("Restored %d of %d sections from snapshot %s", restored, numSections, file);
+}
@@ -0,0 +1,147 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+/* Snapshots of the memory hierarchy's warmed-up state (sim.snapshotFile,
+ * sim.restoreFile)
+ *
+ * A snapshot holds, for every cache, its array's tags (and, in zcaches, the
+ * lookup array), replacement policy state, and coherence state (MESI states
+ * and directory sharers), plus every core's branch predictor. Simulations of
+ * the same region with different core or memory parameters can restore it at
+ * startup instead of paying warmup each time.
+ *
+ * Snapshots are taken at the end of a phase, either when the simulated
+ * program issues the SNAPSHOT magic op, or when the cores have executed
+ * sim.snapshotInstrs instrs in total. Each component is stored in its own
+ * section, named after the cache or core. Restoring a section checks that the
+ * component's type and geometry (e.g., lines, ways, sets, and hash functions)
+ * match, and panics otherwise; components without a section, and cores whose
+ * branch predictor has a different size, start cold.
+ * Ephemeral state (filter arrays, MSHRs, prefetcher streams, memory
+ * controller queues) is not saved.
+ *
+ * Line addresses include the process index (see procMask), so the restoring
+ * simulation must run the same programs as the same processes. Address space
+ * randomization is disabled by the harness, so their addresses match.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "log.h"
+
+class SnapshotWriter {
+    private:
+        const char* section; //for error messages
+        FILE* f; //nullptr on a dry run, which only counts bytes
+        uint64_t bytes;
+        bool ok;
+
+    public:
+        SnapshotWriter(const char* _section, FILE* _f) : section(_section), f(_f), bytes(0), ok(true) {}
+
+        void write(const void* buf, uint64_t len) {
+            if (f && ok) ok = fwrite(buf, 1, len, f) == len;
+            bytes += len;
+        }
+
+        template <typename T> void put(const T& v) {write(&v, sizeof(T));}
+
+        //Element counts are stored so that the reader can check geometries
+        template <typename T> void putArray(const T* a, uint64_t n) {
+            put(n);
+            write(a, n*sizeof(T));
+        }
+
+        //Type tags guard against restoring a component into a different kind of component
+        void putTag(const char* tag) {
+            uint32_t len = strlen(tag);
+            put(len);
+            write(tag, len);
+        }
+
+        const char* getSection() const {return section;}
+        uint64_t getBytes() const {return bytes;}
+        bool isOk() const {return ok;}
+};
+
+class SnapshotReader {
+    private:
+        const char* section; //for error messages
+        const uint8_t* buf;
+        uint64_t len;
+        uint64_t pos;
+
+    public:
+        SnapshotReader(const char* _section, const uint8_t* _buf, uint64_t _len) : section(_section), buf(_buf), len(_len), pos(0) {}
+
+        void read(void* dst, uint64_t n) {
+            if (pos + n > len) panic("Snapshot section %s is truncated", section);
+            memcpy(dst, buf + pos, n);
+            pos += n;
+        }
+
+        template <typename T> T get() {
+            T v;
+            read(&v, sizeof(T));
+            return v;
+        }
+
+        //Panics unless the saved value matches ours; use for sizes and other geometry
+        template <typename T> void expect(const T& v, const char* what) {
+            T saved = get<T>();
+            if (saved != v) panic("Snapshot section %s: incompatible %s (saved %ld, expected %ld)", section, what, (int64_t)saved, (int64_t)v);
+        }
+
+        template <typename T> void getArray(T* a, uint64_t n, const char* what) {
+            expect(n, what);
+            read(a, n*sizeof(T));
+        }
+
+        void expectTag(const char* tag) {
+            uint32_t tagLen = get<uint32_t>();
+            if (tagLen != strlen(tag) || pos + tagLen > len || memcmp(buf + pos, tag, tagLen) != 0) {
+                panic("Snapshot section %s: saved component is not a %s (different configuration?)", section, tag);
+            }
+            pos += tagLen;
+        }
+
+        const char* getSection() const {return section;}
+        bool done() const {return pos == len;}
+};
+
+//Registers the snapshot triggers and checks that every component supports snapshots (by doing a dry run), call after the system is built
+void InitSnapshots(const char* snapshotFile, uint64_t snapshotInstrs);
+
+//Restores the state saved in file, call after the system is built
+void RestoreSnapshot(const char* file);
+
+//Saves a snapshot to sim.snapshotFile; called at the end of a phase, after the weave phase, when zinfo->snapshotPending is set
+void TakeSnapshot();
+
+#endif  // SNAPSHOT_H_
@@ -0,0 +1,108 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tag_match.h"
+#include <immintrin.h>
+#include "log.h"
+
+static int32_t ScalarTagMatch(const Address* tags, uint32_t numTags, Address lineAddr) {
+    for (uint32_t i = 0; i < numTags; i++) {
+        if (tags[i] == lineAddr) return i;
+    }
+    return -1;
+}
+
+__attribute__((target("sse4.1")))
+static int32_t SSE41TagMatch(const Address* tags, uint32_t numTags, Address lineAddr) {
+    __m128i key = _mm_set1_epi64x(lineAddr);
+    uint32_t i = 0;
+    for (; i + 8 <= numTags; i += 8) {
+        uint32_t m0 = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)&tags[i]), key)));
+        uint32_t m1 = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)&tags[i+2]), key)));
+        uint32_t m2 = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)&tags[i+4]), key)));
+        uint32_t m3 = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)&tags[i+6]), key)));
+        uint32_t mask = m0 | (m1 << 2) | (m2 << 4) | (m3 << 6);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    for (; i + 2 <= numTags; i += 2) {
+        uint32_t mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)&tags[i]), key)));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    if (i < numTags && tags[i] == lineAddr) return i;
+    return -1;
+}
+
+__attribute__((target("avx2")))
+static int32_t AVX2TagMatch(const Address* tags, uint32_t numTags, Address lineAddr) {
+    __m256i key = _mm256_set1_epi64x(lineAddr);
+    uint32_t i = 0;
+    for (; i + 8 <= numTags; i += 8) {
+        uint32_t m0 = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)&tags[i]), key)));
+        uint32_t m1 = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)&tags[i+4]), key)));
+        uint32_t mask = m0 | (m1 << 4);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    if (i + 4 <= numTags) {
+        uint32_t mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)&tags[i]), key)));
+        if (mask) return i + __builtin_ctz(mask);
+        i += 4;
+    }
+    for (; i < numTags; i++) {
+        if (tags[i] == lineAddr) return i;
+    }
+    return -1;
+}
+
+bool TagMatchSupported(TagMatchImpl impl) {
+    switch (impl) {
+        case TM_SCALAR: return true;
+        case TM_SSE41: return __builtin_cpu_supports("sse4.1");
+        case TM_AVX2: return __builtin_cpu_supports("avx2");
+        default: panic("Invalid tag match implementation %d", impl);
+    }
+}
+
+TagMatchImpl BestTagMatchImpl() {
+    static TagMatchImpl best = TagMatchSupported(TM_AVX2)? TM_AVX2 : TagMatchSupported(TM_SSE41)? TM_SSE41 : TM_SCALAR;
+    return best;
+}
+
+TagMatchFunc GetTagMatchFunc(TagMatchImpl impl) {
+    if (!TagMatchSupported(impl)) panic("Tag match implementation %s is not supported by this host", TagMatchImplName(impl));
+    switch (impl) {
+        case TM_SCALAR: return ScalarTagMatch;
+        case TM_SSE41: return SSE41TagMatch;
+        default: return AVX2TagMatch;
+    }
+}
+
+const char* TagMatchImplName(TagMatchImpl impl) {
+    switch (impl) {
+        case TM_SCALAR: return "scalar";
+        case TM_SSE41: return "SSE4.1";
+        case TM_AVX2: return "AVX2";
+        default: panic("Invalid tag match implementation %d", impl);
+    }
+}
@@ -0,0 +1,60 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TAG_MATCH_H_
+#define TAG_MATCH_H_
+
+/* Tag matching for set-associative array lookups: finds a line address among
+ * a set's tags.
+ *
+ * The vector implementations compare 2 (SSE4.1) or 4 (AVX2) tags per
+ * instruction, and test a whole 8-tag block with a single branch. They are
+ * built with per-function target attributes, so the simulator still runs on
+ * hosts without them (see -march in SConstruct), and the best one the host
+ * supports is picked at startup. All implementations return the same result.
+ *
+ * zcaches do not use this: their lookups are dominated by the per-way hashes,
+ * and probing way by way skips the remaining hashes on a hit.
+ */
+
+#include <stdint.h>
+#include "memory_hierarchy.h"
+
+enum TagMatchImpl {
+    TM_SCALAR,
+    TM_SSE41,
+    TM_AVX2,
+    TM_NUM_IMPLS
+};
+
+//Returns the index of the first tag equal to lineAddr, or -1 if there is none
+typedef int32_t (*TagMatchFunc)(const Address* tags, uint32_t numTags, Address lineAddr);
+
+TagMatchImpl BestTagMatchImpl(); //best implementation the host supports
+bool TagMatchSupported(TagMatchImpl impl);
+TagMatchFunc GetTagMatchFunc(TagMatchImpl impl);
+const char* TagMatchImplName(TagMatchImpl impl);
+
+#endif  // TAG_MATCH_H_
@@ -31,10 +31,10 @@
 //#define DEBUG_MSG(args...) info(args)
 
 TimingCore::TimingCore(FilterCache* _l1i, FilterCache* _l1d, uint32_t _domain, g_string& _name)
-    : Core(_name), l1i(_l1i), l1d(_l1d), instrs(0), curCycle(0), cRec(_domain, _name) {}
+    : Core(_name), l1i(_l1i), l1d(_l1d), instrs(0), warmInstrs(0), curCycle(0), cRec(_domain, _name) {}
 
 uint64_t TimingCore::getPhaseCycles() const {
-    return curCycle % zinfo->phaseLength;
+    return (curCycle > zinfo->globPhaseCycles)? curCycle - zinfo->globPhaseCycles : 0;
 }
 
 void TimingCore::initStats(AggregateStat* parentStat) {
@@ -55,6 +55,10 @@ void TimingCore::initStats(AggregateStat* parentStat) {
     instrsStat->init("instrs", "Simulated instructions", &instrs);
     coreStat->append(instrsStat);
 
+    ProxyStat* warmInstrsStat = new ProxyStat();
+    warmInstrsStat->init("warmInstrs", "Instrs in functional warming (sampled simulation), included in instrs", &warmInstrs);
+    coreStat->append(warmInstrsStat);
+
     parentStat->append(coreStat);
 }
 
@@ -101,9 +105,19 @@ void TimingCore::bblAndRecord(Address bblAddr, BblInfo* bblInfo) {
     }
 }
 
+void TimingCore::warmBbl(Address bblAddr, BblInfo* bblInfo) {
+    instrs += bblInfo->instrs;
+    warmInstrs += bblInfo->instrs;
+    curCycle += bblInfo->instrs;
+
+    Address endBblAddr = bblAddr + bblInfo->bytes;
+    for (Address fetchAddr = bblAddr; fetchAddr < endBblAddr; fetchAddr+=(1 << lineBits)) {
+        l1i->warm(fetchAddr, true, curCycle);
+    }
+}
 
 InstrFuncPtrs TimingCore::GetFuncPtrs() {
-    return {LoadAndRecordFunc, StoreAndRecordFunc, BblAndRecordFunc, BranchFunc, PredLoadAndRecordFunc, PredStoreAndRecordFunc, FPTR_ANALYSIS, {0}};
+    return {LoadAndRecordFunc, StoreAndRecordFunc, BblAndRecordFunc, BranchFunc, PredLoadAndRecordFunc, PredStoreAndRecordFunc, MemBatchAndRecordFunc, FPTR_ANALYSIS};
 }
 
 void TimingCore::LoadAndRecordFunc(THREADID tid, ADDRINT addr) {
@@ -114,12 +128,21 @@ void TimingCore::StoreAndRecordFunc(THREADID tid, ADDRINT addr) {
     static_cast<TimingCore*>(cores[tid])->storeAndRecord(addr);
 }
 
+void TimingCore::MemBatchAndRecordFunc(THREADID tid, MemOpBatch* batch) {
+    TimingCore* core = static_cast<TimingCore*>(cores[tid]);
+    for (uint32_t i = 0; i < batch->numOps; i++) {
+        uint64_t op = batch->ops[i];
+        if (MemOpBatch::isStore(op)) core->storeAndRecord(MemOpBatch::addr(op));
+        else core->loadAndRecord(MemOpBatch::addr(op));
+    }
+}
+
 void TimingCore::BblAndRecordFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
     TimingCore* core = static_cast<TimingCore*>(cores[tid]);
     core->bblAndRecord(bblAddr, bblInfo);
 
     while (core->curCycle > core->phaseEndCycle) {
-        core->phaseEndCycle += zinfo->phaseLength;
+        core->phaseEndCycle += zinfo->nextPhaseLength;
         uint32_t cid = getCid(tid);
         uint32_t newCid = TakeBarrier(tid, cid);
         if (newCid != cid) break; /*context-switch*/
@@ -134,3 +157,44 @@ void TimingCore::PredStoreAndRecordFunc(THREADID tid, ADDRINT addr, BOOL pred) {
     if (pred) static_cast<TimingCore*>(cores[tid])->storeAndRecord(addr);
 }
 
+InstrFuncPtrs TimingCore::GetWarmFuncPtrs() {
+    return {WarmLoadFunc, WarmStoreFunc, WarmBblFunc, BranchFunc, WarmPredLoadFunc, WarmPredStoreFunc, WarmMemBatchFunc, FPTR_ANALYSIS};
+}
+
+void TimingCore::WarmLoadFunc(THREADID tid, ADDRINT addr) {
+    TimingCore* core = static_cast<TimingCore*>(cores[tid]);
+    core->l1d->warm(addr, true, core->curCycle);
+}
+
+void TimingCore::WarmStoreFunc(THREADID tid, ADDRINT addr) {
+    TimingCore* core = static_cast<TimingCore*>(cores[tid]);
+    core->l1d->warm(addr, false, core->curCycle);
+}
+
+void TimingCore::WarmMemBatchFunc(THREADID tid, MemOpBatch* batch) {
+    TimingCore* core = static_cast<TimingCore*>(cores[tid]);
+    for (uint32_t i = 0; i < batch->numOps; i++) {
+        uint64_t op = batch->ops[i];
+        core->l1d->warm(MemOpBatch::addr(op), !MemOpBatch::isStore(op), core->curCycle);
+    }
+}
+
+void TimingCore::WarmBblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
+    TimingCore* core = static_cast<TimingCore*>(cores[tid]);
+    core->warmBbl(bblAddr, bblInfo);
+
+    while (core->curCycle > core->phaseEndCycle) {
+        core->phaseEndCycle += zinfo->nextPhaseLength;
+        uint32_t cid = getCid(tid);
+        uint32_t newCid = TakeBarrier(tid, cid);
+        if (newCid != cid) break; /*context-switch*/
+    }
+}
+
+void TimingCore::WarmPredLoadFunc(THREADID tid, ADDRINT addr, BOOL pred) {
+    if (pred) WarmLoadFunc(tid, addr);
+}
+
+void TimingCore::WarmPredStoreFunc(THREADID tid, ADDRINT addr, BOOL pred) {
+    if (pred) WarmStoreFunc(tid, addr);
+}
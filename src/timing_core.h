@@ -40,6 +40,7 @@ class TimingCore : public Core {
         FilterCache* l1d;
 
         uint64_t instrs;
+        uint64_t warmInstrs; //functional warming instrs, included in instrs
 
         uint64_t curCycle; //phase 1 clock
         uint64_t phaseEndCycle; //phase 1 end clock
@@ -59,25 +60,39 @@ class TimingCore : public Core {
         virtual void leave();
 
         InstrFuncPtrs GetFuncPtrs();
+        InstrFuncPtrs GetWarmFuncPtrs();
 
         //Contention simulation interface
-        inline EventRecorder* getEventRecorder() {return cRec.getEventRecorder();}
+        EventRecorder* getEventRecorder() {return cRec.getEventRecorder();}
         void cSimStart() {curCycle = cRec.cSimStart(curCycle);}
-        void cSimEnd() {curCycle = cRec.cSimEnd(curCycle);}
+        uint64_t cSimEnd() { //returns the cycles this core was delayed by
+            uint64_t prevCycle = curCycle;
+            curCycle = cRec.cSimEnd(curCycle);
+            return curCycle - prevCycle;
+        }
 
     private:
         inline void loadAndRecord(Address addr);
         inline void storeAndRecord(Address addr);
         inline void bblAndRecord(Address bblAddr, BblInfo* bblInstrs);
         inline void record(uint64_t startCycle);
+        inline void warmBbl(Address bblAddr, BblInfo* bblInfo);
 
         static void LoadAndRecordFunc(THREADID tid, ADDRINT addr);
         static void StoreAndRecordFunc(THREADID tid, ADDRINT addr);
         static void BblAndRecordFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo);
         static void PredLoadAndRecordFunc(THREADID tid, ADDRINT addr, BOOL pred);
         static void PredStoreAndRecordFunc(THREADID tid, ADDRINT addr, BOOL pred);
+        static void MemBatchAndRecordFunc(THREADID tid, MemOpBatch* batch);
 
         static void BranchFunc(THREADID, ADDRINT, BOOL, ADDRINT, ADDRINT) {}
+
+        static void WarmLoadFunc(THREADID tid, ADDRINT addr);
+        static void WarmStoreFunc(THREADID tid, ADDRINT addr);
+        static void WarmBblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo);
+        static void WarmPredLoadFunc(THREADID tid, ADDRINT addr, BOOL pred);
+        static void WarmPredStoreFunc(THREADID tid, ADDRINT addr, BOOL pred);
+        static void WarmMemBatchFunc(THREADID tid, MemOpBatch* batch);
 } ATTR_LINE_ALIGNED;
 
 #endif  // TIMING_CORE_H_
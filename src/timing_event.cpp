@@ -27,6 +27,7 @@
 #include <sstream>
 #include <typeinfo>
 #include "contention_sim.h"
+#include "weave_capture.h"
 #include "zsim.h"
 
 /* TimingEvent */
@@ -77,6 +78,13 @@ TimingEvent* TimingEvent::handleCrossing(TimingEvent* childEv, EventRecorder* ev
     return xe->getSrcDomainEvent();
 }
 
+void TimingEvent::notifyDone(uint64_t doneCycle) {
+    assert(domain != -1);
+    ContentionSim* cs = zinfo->contentionSim;
+    cs->countChildren(domain, numChildren);
+    if (unlikely(cs->getCapture() != nullptr)) cs->getCapture()->recordDone(this, doneCycle);
+}
+
 void TimingEvent::checkDomain(TimingEvent* ch) {
     //dynamic_cast takes a while, so let's just punt on this now that it's correct
     //assert(domain == ch->domain || dynamic_cast<CrossingEvent*>(ch));
@@ -119,8 +127,7 @@ CrossingEvent::CrossingEvent(TimingEvent* parent, TimingEvent* child, uint64_t _
 void CrossingEvent::markSrcEventDone(uint64_t cycle) {
     assert(!called);
     //Sanity check
-    srcDomainCycleAtDone = zinfo->contentionSim->getCurCycle(srcDomain);
-    assert(cycle >= srcDomainCycleAtDone);
+    assert(cycle >= zinfo->contentionSim->getCurCycle(srcDomain));
     //NOTE: No fencing needed; TSO ensures writes to doneCycle and callled happen in order.
     doneCycle = cycle;
     called = true;
@@ -150,10 +157,9 @@ void CrossingEvent::simulate(uint64_t simCycle) {
         __sync_synchronize(); //not needed --- these are all volatile, and by TSO, if we see a cycle > doneCycle, by force we must see doneCycle set
         if (!called) { //have to check again, AFTER reading the cycles! Otherwise, we have a race
             zinfo->contentionSim->setPrio(domain, (nextCycle == simCycle)? 1 : 2);
+            zinfo->contentionSim->countCrossingHold(domain);
 
-#if PROFILE_CROSSINGS
             simCount++;
-#endif
             numParents = 0; //HACK
             requeue(nextCycle);
             return;
@@ -163,10 +169,7 @@ void CrossingEvent::simulate(uint64_t simCycle) {
     //Runs if called
     //assert_msg(simCycle <= doneCycle+preSlack+postSlack+1, "simCycle %ld doneCycle %ld, preSlack %d postSlack %d simCount %ld child %s", simCycle, doneCycle, preSlack, postSlack, simCount, typeid(*child).name());
     zinfo->contentionSim->setPrio(domain, 0);
-
-#if PROFILE_CROSSINGS
-    zinfo->contentionSim->profileCrossing(srcDomain, domain, simCount);
-#endif
+    zinfo->contentionSim->countCrossing(srcDomain, domain, simCount, (simCycle > doneCycle)? simCycle - doneCycle : 0);
 
     uint64_t dCycle = MAX(simCycle, doneCycle);
     //info("Crossing %d->%d done %ld", srcDomain, domain, dCycle);
@@ -33,7 +33,12 @@
 #include "event_recorder.h"
 #include "galloc.h"
 
-#define TIMING_BLOCK_EVENTS 3
+/* Events keep up to TIMING_INLINE_CHILDREN children inline, which covers the common case (a core event with the next
+ * core event and a memory access, a miss with its response and writeback; see the childHist stats). Events with more
+ * children move all of them to a chain of TimingEventBlocks, each a single 64-byte line.
+ */
+#define TIMING_INLINE_CHILDREN 2
+#define TIMING_BLOCK_EVENTS 7
 struct TimingEventBlock {
     TimingEvent* events[TIMING_BLOCK_EVENTS];
     TimingEventBlock* next;
@@ -60,37 +65,51 @@ struct TimingEventBlock {
         void* operator new (size_t);
 };
 
-enum EventState {EV_INVALID, EV_NONE, EV_QUEUED, EV_RUNNING, EV_HELD, EV_DONE};
+enum EventState : uint8_t {EV_INVALID, EV_NONE, EV_QUEUED, EV_RUNNING, EV_HELD, EV_DONE};
 
 class CrossingEvent;
 
+/* Events are allocated by the thousands every phase, and the weave phase is bound by touching them, so their
+ * layout is packed: with the vtable pointer and both inline children, the base class is exactly one 64-byte line.
+ * Domains, child and parent counts are 16 bits (bounds checked on assignment), and the state is one byte at the very
+ * end, so subclasses can place a small field (e.g., a bool) in the base class's tail padding. Keep subclasses lean
+ * too: fields that are only needed for debugging or profiling should be conditionally compiled.
+ */
 class TimingEvent {
     private:
-        uint64_t privCycle; //only touched by ContentionSim
+        //cycle accumulates the latest done cycle of the event's parents until it is enqueued; from then on, the
+        //same word holds privCycle, the cycle it was enqueued for (only touched by ContentionSim). Once enqueued,
+        //an event has no parents left and is only requeued, so it never needs both.
+        union {
+            uint64_t cycle;
+            uint64_t privCycle;
+        };
 
     public:
         TimingEvent* next; //used by PrioQueue --- PRIVATE
 
     private:
-        EventState state;
-        uint64_t cycle;
-
         uint64_t minStartCycle;
         union {
-            TimingEvent* child;
-            TimingEventBlock* children;
+            TimingEvent* inlineChildren[TIMING_INLINE_CHILDREN]; //if numChildren <= TIMING_INLINE_CHILDREN
+            TimingEventBlock* children; //otherwise; most recent block first
         };
-        int32_t domain; //-1 if none; if none, it acquires it from the parent. Cannot be a starting event (no parents at enqueue time) and get -1 as domain
-        uint32_t numChildren;
-        uint32_t numParents;
         uint32_t preDelay;
         uint32_t postDelay; //we could get by with one delay, but pre/post makes it easier to code
+        int16_t domain; //-1 if none; if none, it acquires it from the parent. Cannot be a starting event (no parents at enqueue time) and get -1 as domain
+        uint16_t numChildren;
+        uint16_t numParents;
+        EventState state;
 
     public:
-        TimingEvent(uint32_t _preDelay, uint32_t _postDelay, int32_t _domain = -1) : next(nullptr), state(EV_NONE), cycle(0), minStartCycle(-1L), child(nullptr),
-                    domain(_domain), numChildren(0), numParents(0), preDelay(_preDelay), postDelay(_postDelay) {}
-        explicit TimingEvent(int32_t _domain = -1) : next(nullptr), state(EV_NONE), minStartCycle(-1L), child(nullptr),
-                    domain(_domain), numChildren(0), numParents(0), preDelay(0), postDelay(0) {} //no delegating constructors until gcc 4.7...
+        TimingEvent(uint32_t _preDelay, uint32_t _postDelay, int32_t _domain = -1) : cycle(0), next(nullptr), minStartCycle(-1L), inlineChildren(),
+                    preDelay(_preDelay), postDelay(_postDelay), domain(_domain), numChildren(0), numParents(0), state(EV_NONE) {
+            assert(_domain == (int16_t)_domain);
+        }
+        explicit TimingEvent(int32_t _domain = -1) : cycle(0), next(nullptr), minStartCycle(-1L), inlineChildren(),
+                    preDelay(0), postDelay(0), domain(_domain), numChildren(0), numParents(0), state(EV_NONE) {  //no delegating constructors until gcc 4.7...
+            assert(_domain == (int16_t)_domain);
+        }
 
         inline uint32_t getDomain() const {return domain;}
         inline uint32_t getNumChildren() const {return numChildren;}
@@ -106,18 +125,18 @@ class TimingEvent {
         TimingEvent* addChild(TimingEvent* childEv, EventRecorder* evRec) {
             assert_msg(state == EV_NONE || state == EV_QUEUED, "adding child in invalid state %d %s -> %s", state, typeid(*this).name(), typeid(*childEv).name()); //either not scheduled or not executed yet
             assert(childEv->state == EV_NONE);
+            assert((uint16_t)(numChildren + 1) && (uint16_t)(childEv->numParents + 1)); //no overflows
 
             TimingEvent* res = childEv;
 
-            if (numChildren == 0) {
-                numChildren = 1;
-                child = childEv;
-            } else if (numChildren == 1) {
-                TimingEvent* firstChild = child;
-                children = new (evRec) TimingEventBlock();
-                children->events[0] = firstChild;
-                children->events[1] = childEv;
-                numChildren = 2;
+            if (numChildren < TIMING_INLINE_CHILDREN) {
+                inlineChildren[numChildren++] = childEv;
+            } else if (numChildren == TIMING_INLINE_CHILDREN) {
+                TimingEventBlock* blk = new (evRec) TimingEventBlock();
+                for (uint32_t i = 0; i < TIMING_INLINE_CHILDREN; i++) blk->events[i] = inlineChildren[i];
+                blk->events[TIMING_INLINE_CHILDREN] = childEv;
+                children = blk;
+                numChildren++;
             } else {
                 uint32_t idx = numChildren % TIMING_BLOCK_EVENTS;
                 if (idx == 0) {
@@ -179,6 +198,7 @@ class TimingEvent {
         void done(uint64_t doneCycle) {
             assert(state == EV_RUNNING); //ContentionSim sets it when calling simulate()
             state = EV_DONE;
+            notifyDone(doneCycle);
             auto vLambda = [this, doneCycle](TimingEvent** childPtr) {
                 checkDomain(*childPtr);
                 (*childPtr)->parentDone(doneCycle+postDelay);
@@ -215,7 +235,7 @@ class TimingEvent {
     private:
         void* operator new (size_t);
 
-        void propagateDomain(int32_t dom) {
+        void propagateDomain(int16_t dom) {
             assert(domain == -1);
             domain = dom;
             auto vLambda = [this](TimingEvent** childPtr) {
@@ -227,10 +247,21 @@ class TimingEvent {
 
         template <typename F> //F has to be decltype(f)
         inline void visitChildren(F f) {
-            if (numChildren == 0) return;
             //info("visit %p nc %d", this, numChildren);
-            if (numChildren == 1) {
-                f(&child);
+            if (numChildren <= TIMING_INLINE_CHILDREN) {
+                //f may add children to us (produceCrossings chains response crossings to the request's parent).
+                //Only the children we had when the visit started are visited, never the ones added by f.
+                uint32_t n = numChildren;
+                for (uint32_t i = 0; i < n; i++) {
+                    f(&inlineChildren[i]);
+                    if (unlikely(numChildren > TIMING_INLINE_CHILDREN)) {
+                        //The inline children moved to the first block, which is now the last one
+                        TimingEventBlock* curBlock = children;
+                        while (curBlock->next) curBlock = curBlock->next;
+                        for (uint32_t j = i + 1; j < n; j++) f(&curBlock->events[j]);
+                        return;
+                    }
+                }
             } else {
                 TimingEventBlock* curBlock = children;
                 uint32_t visitedChildren = 0;
@@ -253,9 +284,11 @@ class TimingEvent {
 
         void checkDomain(TimingEvent* ch);
 
+        void notifyDone(uint64_t doneCycle); //see cpp
+
         void freeEvent() {
             // Free timing event blocks and ourselves
-            if (numChildren > 1) {
+            if (numChildren > TIMING_INLINE_CHILDREN) {
                 TimingEventBlock* teb = children;
                 while (teb) {
                     TimingEventBlock* next = teb->next;
@@ -280,10 +313,14 @@ class TimingEvent {
 
 
     friend class ContentionSim;
+    friend class WeaveCapture;
     friend class DelayEvent; //DelayEvent is, for now, the only child of TimingEvent that should do anything other than implement simulate
     friend class CrossingEvent;
 };
 
+static_assert(TIMING_INLINE_CHILDREN < TIMING_BLOCK_EVENTS, "Overflowing inline children must fit in one block");
+static_assert(sizeof(TimingEvent) == 64, "TimingEvent must fit in a single cache line");
+
 class DelayEvent : public TimingEvent {
     public:
         explicit DelayEvent(uint32_t delay) : TimingEvent(delay, 0) {}
@@ -305,20 +342,19 @@ class DelayEvent : public TimingEvent {
 
 class CrossingEvent : public TimingEvent {
     private:
+        volatile bool called; //first, so it fits in TimingEvent's tail padding
         uint32_t srcDomain;
-        volatile bool called;
+        uint32_t preSlack, postSlack;
+        uint32_t simCount; //times simulated before being called
         volatile uint64_t doneCycle;
-        volatile uint64_t srcDomainCycleAtDone;
         EventRecorder* evRec;
         uint64_t origStartCycle;
-        uint64_t simCount;
         TimingEvent* parentEv; //stored exclusively for resp-req xing chaining
 
-        uint32_t preSlack, postSlack;
-
         class CrossingSrcEvent : public TimingEvent {
             private:
                 CrossingEvent* ce;
+                friend class WeaveCapture;
             public:
                 CrossingSrcEvent(CrossingEvent* _ce, uint32_t dom) : TimingEvent(0, 0, dom), ce(_ce) {
                     //These are never connected to anything, but substitute an existing event; so, this never gets
@@ -331,10 +367,12 @@ class CrossingEvent : public TimingEvent {
                     assert_msg(numParents == 1, "CSE: numParents %d", numParents);
                     numParents = 0;
                     assert(numChildren == 0);
-                    ce->markSrcEventDone(startCycle);
                     assert(state == EV_NONE);
-                    state = EV_RUNNING;
-                    done(startCycle);  // does RUNNING -> DONE and frees event
+                    //Not done(), which would free us: we live inside ce, and freeing both released ce's slab while
+                    //other events in it were still live. Once ce sees markSrcEventDone, it may be freed at any time.
+                    state = EV_DONE;
+                    notifyDone(startCycle);
+                    ce->markSrcEventDone(startCycle);
                 }
 
                 virtual void simulate(uint64_t simCycle) {
@@ -357,6 +395,7 @@ class CrossingEvent : public TimingEvent {
         void markSrcEventDone(uint64_t cycle);
 
         friend class ContentionSim;
+        friend class WeaveCapture;
 };
 
 
@@ -0,0 +1,160 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "weave_capture.h"
+#include <string.h>
+#include <typeinfo>
+#include "log.h"
+#include "timing_event.h"
+
+WeaveCapture::WeaveCapture(const char* _filename, uint32_t numDomains, uint32_t maxPhases)
+    : nextId(0), curLimit(0), phasesLeft(maxPhases), active(true), filename(_filename)
+{
+    futex_init(&lock);
+    file = fopen(filename, "w");
+    if (!file) panic("Could not open weave capture file %s", filename);
+    fwrite(WEAVE_CAPTURE_MAGIC, 1, strlen(WEAVE_CAPTURE_MAGIC), file);
+    put(numDomains);
+    info("Capturing %s weave phases to %s", maxPhases? "the first" : "all", filename);
+}
+
+void WeaveCapture::beginPhase(uint64_t limit) {
+    if (!active) return;
+    futex_lock(&lock);
+    if (limit != curLimit) {
+        curLimit = limit;
+        buf.push_back(WC_PHASE);
+        put(limit);
+    }
+    futex_unlock(&lock);
+}
+
+void WeaveCapture::endPhase() {
+    if (!active) return;
+    futex_lock(&lock);
+    if (active) {
+        if (fwrite(&buf[0], 1, buf.size(), file) != buf.size()) panic("Could not write to weave capture file %s", filename);
+        fflush(file);
+        buf.clear();
+        if (phasesLeft && --phasesLeft == 0) {
+            active = false;
+            fclose(file);
+            file = nullptr;
+            liveEvents.clear();
+            info("Finished weave capture to %s", filename);
+        }
+    }
+    futex_unlock(&lock);
+}
+
+WeaveCapture::EventInfo& WeaveCapture::getInfo(TimingEvent* ev) {
+    auto it = liveEvents.find(ev);
+    if (it == liveEvents.end()) {
+        EventInfo& info = liveEvents[ev];
+        info.id = nextId++;
+        info.firstRunCycle = -1L;
+        return info;
+    }
+    return it->second;
+}
+
+uint32_t WeaveCapture::getType(TimingEvent* ev) {
+    const char* name = typeid(*ev).name();
+    auto it = types.find(name);
+    if (it != types.end()) return it->second;
+
+    uint32_t type = types.size();
+    types[name] = type;
+    uint32_t len = strlen(name);
+    buf.push_back(WC_TYPE);
+    put(type);
+    put(len);
+    buf.insert(buf.end(), name, name + len);
+    return type;
+}
+
+void WeaveCapture::recordRoot(TimingEvent* ev, uint64_t cycle) {
+    if (!active) return;
+    futex_lock(&lock);
+    buf.push_back(WC_ROOT);
+    put(getInfo(ev).id);
+    put(cycle);
+    futex_unlock(&lock);
+}
+
+void WeaveCapture::recordRun(TimingEvent* ev, uint64_t cycle) {
+    if (!active) return;
+    futex_lock(&lock);
+    EventInfo& info = getInfo(ev);
+    if (info.firstRunCycle == (uint64_t)-1L) info.firstRunCycle = cycle;
+    futex_unlock(&lock);
+}
+
+void WeaveCapture::recordDone(TimingEvent* ev, uint64_t doneCycle) {
+    if (!active) return;
+
+    //Crossings are replayed with their own synchronization, delays are run inline; everything else is generic
+    WeaveEventKind kind = WC_GENERIC;
+    uint32_t srcDomain = 0;
+    uint32_t slack = 0;
+    TimingEvent* crossing = nullptr;
+    if (CrossingEvent* ce = dynamic_cast<CrossingEvent*>(ev)) {
+        kind = WC_XING;
+        srcDomain = ce->srcDomain;
+        slack = ce->preSlack + ce->postSlack;
+    } else if (CrossingEvent::CrossingSrcEvent* cse = dynamic_cast<CrossingEvent::CrossingSrcEvent*>(ev)) {
+        kind = WC_XSRC;
+        crossing = cse->ce;
+    } else if (dynamic_cast<DelayEvent*>(ev)) {
+        kind = WC_DELAY;
+    }
+
+    futex_lock(&lock);
+    EventInfo info = getInfo(ev);
+    liveEvents.erase(ev);
+    uint32_t type = getType(ev);
+
+    buf.push_back(WC_EVENT);
+    put(info.id);
+    put(kind);
+    put(type);
+    putSigned(ev->domain);
+    put(ev->preDelay);
+    put(ev->postDelay);
+    put(ev->minStartCycle + 1); //unset (-1) becomes 0
+    //Events that never run through the queues (e.g., DelayEvents) have no latency
+    putSigned((info.firstRunCycle == (uint64_t)-1L)? 0 : (int64_t)(doneCycle - info.firstRunCycle));
+    if (kind == WC_XING) {
+        put(srcDomain);
+        put(slack);
+    } else if (kind == WC_XSRC) put(getInfo(crossing).id);
+
+    put(ev->numChildren);
+    auto vLambda = [this](TimingEvent** childPtr) {
+        put(getInfo(*childPtr).id);
+    };
+    ev->visitChildren< decltype(vLambda) >(vLambda);
+    futex_unlock(&lock);
+}
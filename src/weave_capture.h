@@ -0,0 +1,105 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WEAVE_CAPTURE_H_
+#define WEAVE_CAPTURE_H_
+
+/* Weave phase capture (sim.weaveCapture)
+ *
+ * Records the event graphs that the weave phase simulates into a compact
+ * binary file, so that weavebench can replay them through ContentionSim
+ * without Pin or the rest of the simulator. The file is a header (magic and
+ * number of domains) followed by tagged records, with all integers encoded
+ * as LEB128 varints:
+ *  - PHASE: the limit of a weave phase; following records belong to it
+ *  - TYPE: the class name of a new event type index
+ *  - ROOT: an event that entered the weave through a synced enqueue, and its cycle
+ *  - EVENT: an event that finished (at done()): its kind, type, domain,
+ *    delays, minStartCycle, the cycles from its first run to done(), and its
+ *    children. Crossings also record their source domain and slack, and
+ *    their source events the crossing they belong to.
+ *
+ * Events are identified by sequence numbers, assigned when first seen.
+ * Capture serializes all weave threads on a lock, so it is slow; it is meant
+ * to produce workloads for weave optimizations, not to be left on.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "g_std/g_unordered_map.h"
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "locks.h"
+
+class TimingEvent;
+
+#define WEAVE_CAPTURE_MAGIC "ZWEAVE01"
+
+enum WeaveCaptureTag {WC_PHASE = 1, WC_TYPE, WC_ROOT, WC_EVENT};
+enum WeaveEventKind {WC_GENERIC, WC_DELAY, WC_XING, WC_XSRC};
+
+class WeaveCapture : public GlobAlloc {
+    private:
+        struct EventInfo {
+            uint64_t id;
+            uint64_t firstRunCycle; //-1 until the event runs
+        };
+
+        g_unordered_map<TimingEvent*, EventInfo> liveEvents;
+        g_unordered_map<const char*, uint32_t> types; //keyed by typeid name, which is unique per type
+        g_vector<uint8_t> buf;
+        uint64_t nextId;
+        uint64_t curLimit;
+        uint32_t phasesLeft; //0 if unlimited
+        volatile bool active;
+        FILE* file; //only valid in the process that runs the weave threads
+        const char* filename;
+        lock_t lock;
+
+    public:
+        WeaveCapture(const char* _filename, uint32_t numDomains, uint32_t maxPhases);
+
+        //All of these are called by weave threads
+        void beginPhase(uint64_t limit);
+        void endPhase(); //flushes the phase's records to the file
+        void recordRoot(TimingEvent* ev, uint64_t cycle);
+        void recordRun(TimingEvent* ev, uint64_t cycle);
+        void recordDone(TimingEvent* ev, uint64_t doneCycle);
+
+    private:
+        EventInfo& getInfo(TimingEvent* ev);
+        uint32_t getType(TimingEvent* ev);
+
+        void put(uint64_t v) {
+            while (v >= 0x80) {
+                buf.push_back((uint8_t)(v | 0x80));
+                v >>= 7;
+            }
+            buf.push_back((uint8_t)v);
+        }
+        void putSigned(int64_t v) {put((((uint64_t)v) << 1) ^ (uint64_t)(v >> 63));} //zigzag
+};
+
+#endif  // WEAVE_CAPTURE_H_
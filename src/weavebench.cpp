@@ -0,0 +1,532 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Replays a weave phase capture (see weave_capture.h) through ContentionSim,
+ * without Pin or the rest of the simulator, to benchmark the weave phase.
+ *
+ * Event graphs are rebuilt lazily: an event is materialized when one of its
+ * parents becomes ready, and its children when it becomes ready, so memory
+ * use is similar to a live simulation. Generic events take the latency they
+ * had from their first run to done(), delays and crossings keep their
+ * semantics. Roots are enqueued at the start of the phase that drained them.
+ * Events that never finished during the capture are replayed as
+ * zero-latency leaves.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "contention_sim.h"
+#include "core.h"
+#include "event_recorder.h"
+#include "galloc.h"
+#include "log.h"
+#include "pad.h"
+#include "timing_event.h"
+#include "weave_capture.h"
+#include "zsim.h"
+
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+GlobSimInfo* zinfo;
+
+/* Weave threads are Pin internal threads in the simulator, plain pthreads here */
+
+namespace LEVEL_PINCLIENT {
+THREADID PIN_SpawnInternalThread(ROOT_THREAD_FUNC* func, VOID* arg, size_t stackSize, PIN_THREAD_UID* uid) {
+    struct Args {
+        ROOT_THREAD_FUNC* func;
+        VOID* arg;
+    };
+    Args* args = new Args {func, arg};
+    auto trampoline = [](void* p) -> void* {
+        Args* a = (Args*)p;
+        a->func(a->arg);
+        delete a;
+        return nullptr;
+    };
+    pthread_t thread;
+    if (pthread_create(&thread, nullptr, trampoline, args) != 0) panic("Could not spawn weave thread");
+    return 0;
+}
+}  // namespace LEVEL_PINCLIENT
+
+/* Capture contents */
+
+struct EventRec {
+    bool valid; //false if the event never finished during the capture
+    WeaveEventKind kind;
+    int32_t domain;
+    uint32_t preDelay, postDelay;
+    uint32_t numChildren;
+    int64_t lat;
+    uint32_t srcDomain, slack; //crossings only
+    uint64_t link; //crossings and their source events: index into links
+    uint64_t firstChild; //index into childIds
+};
+
+struct Phase {
+    uint64_t limit;
+    vector< std::pair<uint64_t, uint64_t> > roots; //(id, cycle)
+};
+
+//Set by the crossing's source event, polled by the crossing, like CrossingEvent::markSrcEventDone()
+struct XingLink {
+    volatile bool called;
+    volatile uint64_t doneCycle;
+};
+
+static uint32_t numDomains;
+static vector<EventRec> recs; //indexed by event id
+static vector<uint32_t> refs; //times each event appears as a child
+static vector<uint64_t> childIds;
+static vector<Phase> phases;
+static vector<string> typeNames;
+static XingLink* links;
+
+class CaptureReader {
+    private:
+        const uint8_t* cur;
+        const uint8_t* end;
+
+    public:
+        CaptureReader(const uint8_t* buf, size_t size) : cur(buf), end(buf + size) {}
+
+        bool empty() const {return cur == end;}
+
+        uint64_t get() {
+            uint64_t v = 0;
+            for (uint32_t shift = 0; ; shift += 7) {
+                if (cur == end || shift > 63) panic("Truncated or corrupt capture");
+                uint8_t b = *cur++;
+                v |= ((uint64_t)(b & 0x7f)) << shift;
+                if (!(b & 0x80)) return v;
+            }
+        }
+
+        int64_t getSigned() {
+            uint64_t v = get();
+            return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+        }
+
+        const char* getBytes(size_t len) {
+            if ((size_t)(end - cur) < len) panic("Truncated or corrupt capture");
+            const char* res = (const char*)cur;
+            cur += len;
+            return res;
+        }
+};
+
+static EventRec& getRec(uint64_t id) {
+    if (id >= recs.size()) {
+        recs.resize(id + 1);
+        refs.resize(id + 1);
+    }
+    return recs[id];
+}
+
+static void loadCapture(const char* filename) {
+    FILE* f = fopen(filename, "r");
+    if (!f) panic("Could not open capture %s", filename);
+    vector<uint8_t> buf;
+    uint8_t chunk[1 << 16];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f))) buf.insert(buf.end(), chunk, chunk + n);
+    fclose(f);
+
+    size_t magicLen = strlen(WEAVE_CAPTURE_MAGIC);
+    if (buf.size() < magicLen || memcmp(&buf[0], WEAVE_CAPTURE_MAGIC, magicLen) != 0) panic("%s is not a weave capture", filename);
+    CaptureReader r(&buf[magicLen], buf.size() - magicLen);
+    numDomains = r.get();
+
+    vector<uint64_t> xingLinks; //event id -> link, for crossings
+    unordered_map<uint64_t, uint64_t> xingIds; //crossing id -> link, also for crossings that finished after their source event
+    auto getLink = [&](uint64_t xingId) -> uint64_t {
+        auto it = xingIds.find(xingId);
+        if (it != xingIds.end()) return it->second;
+        uint64_t link = xingIds.size();
+        xingIds[xingId] = link;
+        return link;
+    };
+
+    while (!r.empty()) {
+        uint64_t tag = r.get();
+        if (tag == WC_PHASE) {
+            phases.push_back(Phase());
+            phases.back().limit = r.get();
+        } else if (tag == WC_TYPE) {
+            uint64_t type = r.get();
+            uint64_t len = r.get();
+            const char* name = r.getBytes(len);
+            if (type >= typeNames.size()) typeNames.resize(type + 1);
+            typeNames[type] = string(name, len);
+        } else if (tag == WC_ROOT) {
+            if (phases.empty()) panic("Root before first phase");
+            uint64_t id = r.get();
+            uint64_t cycle = r.get();
+            getRec(id);
+            phases.back().roots.push_back(std::make_pair(id, cycle));
+        } else if (tag == WC_EVENT) {
+            uint64_t id = r.get();
+            EventRec& rec = getRec(id);
+            rec.valid = true;
+            rec.kind = (WeaveEventKind)r.get();
+            r.get(); //type, only informative
+            rec.domain = r.getSigned();
+            rec.preDelay = r.get();
+            rec.postDelay = r.get();
+            r.get(); //minStartCycle, replay events do not enforce it
+            rec.lat = r.getSigned();
+            if (rec.kind == WC_XING) {
+                rec.srcDomain = r.get();
+                rec.slack = r.get();
+                rec.link = getLink(id);
+            } else if (rec.kind == WC_XSRC) {
+                rec.link = getLink(r.get());
+            }
+            if (rec.domain < 0 || (uint32_t)rec.domain >= numDomains) panic("Event %ld has invalid domain %d", id, rec.domain);
+            uint32_t numChildren = r.get();
+            rec.numChildren = numChildren;
+            rec.firstChild = childIds.size();
+            //NOTE: getRec() may grow recs, so rec is not valid past here
+            for (uint32_t i = 0; i < numChildren; i++) {
+                uint64_t child = r.get();
+                childIds.push_back(child);
+                getRec(child);
+                refs[child]++;
+            }
+        } else {
+            panic("Unknown record tag %ld in capture", tag);
+        }
+    }
+
+    links = gm_calloc<XingLink>(xingIds.size() + 1);
+    info("Loaded %s: %d domains, %ld phases, %ld events, %ld crossings, %ld event types",
+            filename, numDomains, phases.size(), recs.size(), xingIds.size(), typeNames.size());
+}
+
+/* Replay events */
+
+struct DomainReplay {
+    EventRecorder* evRec; //only used by the thread simulating the domain
+    unordered_map<uint64_t, TimingEvent*>* waiting; //materialized events with parents left
+    uint64_t events;
+    PAD();
+};
+
+static DomainReplay* domReplay;
+static EventRecorder* rootEvRec;
+
+static TimingEvent* materialize(uint64_t id, uint32_t parentDomain, EventRecorder* evRec);
+
+//Arrivals are tracked separately from numParents, so that parents materialized after the event can still wake it
+struct Arrivals {
+    uint64_t id;
+    uint32_t left;
+    uint64_t maxCycle;
+
+    //Returns true on the last arrival, when the event becomes ready and its children must be materialized
+    bool arrive(uint64_t& startCycle, uint32_t domain) {
+        maxCycle = MAX(maxCycle, startCycle);
+        if (--left) return false;
+        startCycle = maxCycle;
+        if (refs[id] > 1) domReplay[domain].waiting->erase(id);
+        return true;
+    }
+};
+
+static void expandChildren(TimingEvent* ev, uint64_t id, EventRecorder* evRec) {
+    const EventRec& rec = recs[id];
+    for (uint32_t i = 0; i < rec.numChildren; i++) {
+        ev->addChild(materialize(childIds[rec.firstChild + i], ev->getDomain(), evRec), evRec);
+    }
+}
+
+class ReplayEvent : public TimingEvent {
+    private:
+        Arrivals arr;
+
+    public:
+        ReplayEvent(uint64_t id, uint32_t parents, uint32_t domain) : TimingEvent(recs[id].preDelay, recs[id].postDelay, domain), arr({id, parents, 0}) {}
+
+        void parentDone(uint64_t startCycle) {
+            if (!arr.arrive(startCycle, getDomain())) return;
+            expandChildren(this, arr.id, domReplay[getDomain()].evRec);
+            TimingEvent::parentDone(startCycle);
+        }
+
+        void start(uint64_t cycle) {
+            expandChildren(this, arr.id, rootEvRec);
+            queue(cycle);
+        }
+
+        void simulate(uint64_t startCycle) {
+            int64_t lat = recs[arr.id].lat;
+            done(startCycle + ((lat > 0)? lat : 0));
+        }
+};
+
+class ReplayDelayEvent : public DelayEvent {
+    private:
+        Arrivals arr;
+
+    public:
+        ReplayDelayEvent(uint64_t id, uint32_t parents) : DelayEvent(recs[id].preDelay), arr({id, parents, 0}) {
+            setPostDelay(recs[id].postDelay);
+        }
+
+        void parentDone(uint64_t startCycle) {
+            if (!arr.arrive(startCycle, getDomain())) return;
+            expandChildren(this, arr.id, domReplay[getDomain()].evRec);
+            DelayEvent::parentDone(startCycle);
+        }
+};
+
+class ReplayCrossingEvent : public TimingEvent {
+    private:
+        Arrivals arr;
+        uint32_t holds;
+
+    public:
+        ReplayCrossingEvent(uint64_t id, uint32_t parents, uint32_t domain) : TimingEvent(0, 0, domain), arr({id, parents, 0}), holds(0) {}
+
+        void parentDone(uint64_t startCycle) {
+            if (!arr.arrive(startCycle, getDomain())) return;
+            expandChildren(this, arr.id, domReplay[getDomain()].evRec);
+            TimingEvent::parentDone(startCycle);
+        }
+
+        void start(uint64_t cycle) {
+            expandChildren(this, arr.id, rootEvRec);
+            queue(cycle);
+        }
+
+        //Same hold/release protocol as CrossingEvent::simulate(), minus the core-relative slack
+        void simulate(uint64_t simCycle) {
+            const EventRec& rec = recs[arr.id];
+            XingLink& link = links[rec.link];
+            ContentionSim* cs = zinfo->contentionSim;
+            if (!link.called) {
+                uint64_t nextCycle = MAX(cs->getCurCycle(rec.srcDomain) + rec.slack, simCycle);
+                __sync_synchronize();
+                if (!link.called) {
+                    cs->setPrio(getDomain(), (nextCycle == simCycle)? 1 : 2);
+                    cs->countCrossingHold(getDomain());
+                    holds++;
+                    requeue(nextCycle);
+                    return;
+                }
+            }
+            cs->setPrio(getDomain(), 0);
+            cs->countCrossing(rec.srcDomain, getDomain(), holds, (simCycle > link.doneCycle)? simCycle - link.doneCycle : 0);
+            done(MAX(simCycle, link.doneCycle));
+        }
+};
+
+class ReplayCrossingSrcEvent : public TimingEvent {
+    private:
+        Arrivals arr;
+
+    public:
+        ReplayCrossingSrcEvent(uint64_t id, uint32_t parents, uint32_t domain) : TimingEvent(0, 0, domain), arr({id, parents, 0}) {}
+
+        void parentDone(uint64_t startCycle) {
+            if (!arr.arrive(startCycle, getDomain())) return;
+            XingLink& link = links[recs[arr.id].link];
+            link.doneCycle = startCycle;
+            link.called = true; //TSO orders the writes, as in CrossingEvent::markSrcEventDone()
+            setRunning();
+            done(startCycle);
+        }
+
+        void simulate(uint64_t simCycle) {
+            panic("ReplayCrossingSrcEvent::simulate() called");
+        }
+};
+
+//Wakes an event that was materialized by an earlier parent; addChild() on it would add a parent it never loses
+class ReplayEdgeEvent : public TimingEvent, public GlobAlloc {
+    private:
+        TimingEvent* target;
+
+    public:
+        using GlobAlloc::operator new;
+        using GlobAlloc::operator delete;
+
+        ReplayEdgeEvent(TimingEvent* _target) : TimingEvent(0, 0, _target->getDomain()), target(_target) {}
+
+        void parentDone(uint64_t startCycle) {
+            target->parentDone(startCycle);
+            delete this;
+        }
+
+        void simulate(uint64_t simCycle) {
+            panic("ReplayEdgeEvent::simulate() called");
+        }
+};
+
+static TimingEvent* materialize(uint64_t id, uint32_t parentDomain, EventRecorder* evRec) {
+    const EventRec& rec = recs[id];
+    uint32_t domain = rec.valid? rec.domain : parentDomain;
+    DomainReplay& dr = domReplay[domain];
+    uint32_t parents = refs[id];
+
+    if (parents > 1) {
+        auto it = dr.waiting->find(id);
+        if (it != dr.waiting->end()) {
+            return new ReplayEdgeEvent(it->second);
+        }
+    }
+
+    TimingEvent* ev;
+    if (!rec.valid || rec.kind == WC_GENERIC) {
+        ev = new (evRec) ReplayEvent(id, parents, domain);
+    } else if (rec.kind == WC_DELAY) {
+        ev = new (evRec) ReplayDelayEvent(id, parents);
+    } else if (rec.kind == WC_XING) {
+        ev = new (evRec) ReplayCrossingEvent(id, parents, domain);
+    } else {
+        ev = new (evRec) ReplayCrossingSrcEvent(id, parents, domain);
+    }
+    ev->setMinStartCycle(0);
+    dr.events++;
+    if (parents > 1) (*dr.waiting)[id] = ev;
+    return ev;
+}
+
+/* Makes ContentionSim simulate the weave; ContentionSim skips it if no core records events */
+
+class ReplayCore : public Core {
+    private:
+        EventRecorder evRec;
+
+    public:
+        explicit ReplayCore(g_string& _name) : Core(_name) {}
+        uint64_t getInstrs() const {return 0;}
+        uint64_t getPhaseCycles() const {return 0;}
+        uint64_t getCycles() const {return 0;}
+        void initStats(AggregateStat* parentStat) {}
+        void contextSwitch(int32_t gid) {}
+        InstrFuncPtrs GetFuncPtrs() {panic("ReplayCore does not run instructions");}
+        EventRecorder* getEventRecorder() {return &evRec;}
+};
+
+static ScalarStat* findStat(AggregateStat* parent, const char* name) {
+    for (uint32_t i = 0; i < parent->curSize(); i++) {
+        Stat* s = parent->get(i);
+        if (strcmp(s->name(), name) == 0) return dynamic_cast<ScalarStat*>(s);
+    }
+    return nullptr;
+}
+
+int main(int argc, const char* argv[]) {
+    InitLog(""); //no log header
+    if (argc < 2 || argc > 4) {
+        info("Replays a weave phase capture (sim.weaveCapture) and reports weave throughput");
+        info("Usage: %s <capture> [weaveThreads] [stealing (0/1)]", argv[0]);
+        exit(1);
+    }
+
+    gm_init(1ul << 30 /*1 GB, events are freed as they finish*/);
+    loadCapture(argv[1]);
+    if (phases.empty()) panic("Capture has no phases");
+    uint32_t numSimThreads = (argc > 2)? atoi(argv[2]) : MAX((uint32_t)1, numDomains/2);
+    bool stealing = (argc > 3)? atoi(argv[3]) : false;
+    if (numSimThreads == 0 || numSimThreads > numDomains) panic("Need 1-%d weave threads, %d given", numDomains, numSimThreads);
+
+    zinfo = gm_calloc<GlobSimInfo>();
+    zinfo->phaseLength = (phases.size() > 1)? phases[1].limit - phases[0].limit : phases[0].limit;
+    zinfo->maxPhaseLength = zinfo->phaseLength;
+    for (uint32_t p = 1; p < phases.size(); p++) {
+        zinfo->maxPhaseLength = MAX(zinfo->maxPhaseLength, (uint32_t)(phases[p].limit - phases[p-1].limit));
+    }
+    zinfo->numCores = 1;
+    zinfo->cores = gm_calloc<Core*>(1);
+    g_string coreName("replay");
+    zinfo->cores[0] = new ReplayCore(coreName);
+
+    zinfo->rootStat = new AggregateStat();
+    zinfo->rootStat->init("root", "Stats");
+    zinfo->contentionSim = new ContentionSim(numDomains, numSimThreads, stealing, false, 0);
+    zinfo->contentionSim->initStats(zinfo->rootStat);
+    zinfo->contentionSim->postInit();
+
+    domReplay = gm_calloc<DomainReplay>(numDomains);
+    for (uint32_t d = 0; d < numDomains; d++) {
+        domReplay[d].evRec = new EventRecorder();
+        domReplay[d].waiting = new unordered_map<uint64_t, TimingEvent*>();
+    }
+    rootEvRec = new EventRecorder();
+
+    //Captures may start past cycle 0 (e.g., after fast-forwarding)
+    if (phases[0].limit > zinfo->phaseLength) zinfo->contentionSim->simulatePhase(phases[0].limit - zinfo->phaseLength);
+
+    uint64_t weaveNs = 0;
+    uint64_t skippedRoots = 0;
+    for (Phase& phase : phases) {
+        for (auto& root : phase.roots) {
+            const EventRec& rec = recs[root.first];
+            if (!rec.valid) {
+                skippedRoots++;
+                continue;
+            }
+            uint64_t cycle = MAX(root.second, zinfo->contentionSim->getCurCycle(rec.domain));
+            TimingEvent* ev = materialize(root.first, rec.domain, rootEvRec);
+            if (rec.kind == WC_XING) ((ReplayCrossingEvent*)ev)->start(cycle);
+            else if (rec.kind == WC_GENERIC) ((ReplayEvent*)ev)->start(cycle);
+            else panic("Root %ld is of kind %d, which the weave never enqueues", root.first, rec.kind);
+        }
+
+        uint64_t startNs = getNs();
+        zinfo->contentionSim->simulatePhase(phase.limit);
+        weaveNs += getNs() - startNs;
+        zinfo->numPhases++;
+        zinfo->globPhaseCycles = phase.limit;
+    }
+
+    AggregateStat* csStat = dynamic_cast<AggregateStat*>(zinfo->rootStat->get(0));
+    assert(csStat);
+    uint64_t totalEvents = 0;
+    info("%8s %12s %10s %10s %10s", "Domain", "Events", "Time (ms)", "Xings", "XingHolds");
+    for (uint32_t d = 0; d < numDomains; d++) {
+        AggregateStat* domStat = dynamic_cast<AggregateStat*>(csStat->get(d));
+        assert(domStat);
+        info("%8d %12ld %10.1f %10ld %10ld", d, domReplay[d].events, findStat(domStat, "time")->get()/1e6,
+                findStat(domStat, "xings")->get(), findStat(domStat, "xingHolds")->get());
+        totalEvents += domReplay[d].events;
+    }
+    if (skippedRoots) warn("Skipped %ld roots that did not finish during the capture", skippedRoots);
+    info("%ld events, %ld phases, %d weave threads%s: %.3f s, %.2f Mevents/s",
+            totalEvents, phases.size(), numSimThreads, stealing? " (stealing)" : "", weaveNs/1e9, totalEvents*1e3/weaveNs);
+
+    zinfo->contentionSim->finish();
+    return 0;
+}
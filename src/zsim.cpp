@@ -41,6 +41,7 @@
 #include <sys/time.h>
 #include <unistd.h>
 #include "access_tracing.h"
+#include "bbl_cache.h"
 #include "constants.h"
 #include "contention_sim.h"
 #include "core.h"
@@ -48,13 +49,17 @@
 #include "cpuid.h"
 #include "debug_zsim.h"
 #include "event_queue.h"
+#include "filter_cache.h"
 #include "galloc.h"
 #include "init.h"
 #include "log.h"
+#include "phase_ctrl.h"
 #include "pin.H"
 #include "pin_cmd.h"
 #include "process_tree.h"
 #include "profile_stats.h"
+#include "sampler.h"
+#include "snapshot.h"
 #include "scheduler.h"
 #include "stats.h"
 #include "trace_driver.h"
@@ -189,6 +194,43 @@ VOID PIN_FAST_ANALYSIS_CALL IndirectPredStoreSingle(THREADID tid, ADDRINT addr,
     fPtrs[tid].predStorePtr(tid, addr, pred);
 }
 
+/* Batched memory operands (sim.batchMemOps): Loads and stores of batched
+ * basic blocks just append to the thread's batch. These routines have no
+ * calls or control flow, so Pin inlines them. Every basic block then starts by
+ * flushing the previous block's batch to the core, before its own bbl call.
+ */
+
+MemOpBatch memBatches[MAX_THREADS] ATTR_LINE_ALIGNED;
+
+VOID PIN_FAST_ANALYSIS_CALL BatchLoad(THREADID tid, ADDRINT addr) {
+    MemOpBatch& b = memBatches[tid];
+    b.ops[b.numOps++] = addr << 1;
+}
+
+VOID PIN_FAST_ANALYSIS_CALL BatchStore(THREADID tid, ADDRINT addr) {
+    MemOpBatch& b = memBatches[tid];
+    b.ops[b.numOps++] = (addr << 1) | 1;
+}
+
+//Must also be called before the thread stops running simulated code (leaves, changes fPtrs, or reads its core's state)
+static inline void FlushMemBatch(THREADID tid) {
+    MemOpBatch& b = memBatches[tid];
+    if (b.numOps) {
+        fPtrs[tid].memBatchPtr(tid, &b);
+        b.numOps = 0;
+    }
+}
+
+VOID PIN_FAST_ANALYSIS_CALL IndirectBasicBlockBatched(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
+    FlushMemBatch(tid);
+    fPtrs[tid].bblPtr(tid, bblAddr, bblInfo);
+}
+
+
+//Normal pointers of the thread's core, or its functional warming pointers if the process is between sampled units
+static inline InstrFuncPtrs GetCorePtrs(uint32_t tid) {
+    return unlikely(procTreeNode->isWarming())? cores[tid]->GetWarmFuncPtrs() : cores[tid]->GetFuncPtrs();
+}
 
 //Non-simulation variants of analysis functions
 
@@ -204,7 +246,7 @@ void Join(uint32_t tid) {
         SimEnd();
     }
 
-    fPtrs[tid] = cores[tid]->GetFuncPtrs(); //back to normal pointers
+    fPtrs[tid] = GetCorePtrs(tid); //back to normal pointers
 }
 
 VOID JoinAndLoadSingle(THREADID tid, ADDRINT addr) {
@@ -237,11 +279,17 @@ VOID JoinAndPredStoreSingle(THREADID tid, ADDRINT addr, BOOL pred) {
     fPtrs[tid].predStorePtr(tid, addr, pred);
 }
 
+VOID JoinAndMemBatch(THREADID tid, MemOpBatch* batch) {
+    Join(tid);
+    fPtrs[tid].memBatchPtr(tid, batch);
+}
+
 // NOP variants: Do nothing
 VOID NOPLoadStoreSingle(THREADID tid, ADDRINT addr) {}
 VOID NOPBasicBlock(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {}
 VOID NOPRecordBranch(THREADID tid, ADDRINT addr, BOOL taken, ADDRINT takenNpc, ADDRINT notTakenNpc) {}
 VOID NOPPredLoadStoreSingle(THREADID tid, ADDRINT addr, BOOL pred) {}
+VOID NOPMemBatch(THREADID tid, MemOpBatch* batch) {}
 
 // FF is basically NOP except for basic blocks
 VOID FFBasicBlock(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
@@ -250,6 +298,66 @@ VOID FFBasicBlock(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
     }
 }
 
+/* Fast-forward cache warming (sim.ffWarmRate): FF threads feed one in every
+ * ffWarmRate memory accesses straight into the caches, functionally (see
+ * FilterCache::warmUnowned). Threads in fast-forward are not on a core, so each
+ * thread warms a fixed core's data L1 and the private caches behind it; the
+ * shared levels, which take longest to warm up, see the accesses of all threads.
+ *
+ * Like the L1's filter array, a small per-thread direct-mapped filter of the
+ * lines last warmed skips repeated accesses to them, which would only update
+ * the L1's LRU state.
+ */
+
+#define FF_WARM_FILTER_LINES 32
+
+struct FFWarmState {
+    FilterCache* l1d; //picked on the thread's first warm access
+    uint32_t skip; //accesses left to skip before the next warm one
+    Address lines[FF_WARM_FILTER_LINES]; //(vLineAddr << 1) | isStore of the last line warmed in each slot
+} ATTR_LINE_ALIGNED;
+
+static FFWarmState ffWarmStates[MAX_THREADS];
+
+static FilterCache* FFWarmCache(THREADID tid) {
+    for (uint32_t i = 0; i < zinfo->numCores; i++) {
+        FilterCache* l1d = zinfo->ffWarmCaches[(procIdx + tid + i) % zinfo->numCores];
+        if (l1d) return l1d;
+    }
+    panic("No cores with caches to warm"); //checked on init
+}
+
+static inline void FFWarmAccess(THREADID tid, ADDRINT addr, bool isLoad) {
+    FFWarmState& st = ffWarmStates[tid];
+    Address vLineAddr = addr >> lineBits;
+    Address& line = st.lines[vLineAddr % FF_WARM_FILTER_LINES];
+    if ((line >> 1) == vLineAddr && (isLoad || (line & 1))) return;
+
+    if (likely(st.skip)) {
+        st.skip--;
+        return;
+    }
+    st.skip = zinfo->ffWarmRate - 1;
+    if (unlikely(!st.l1d)) {
+        st.l1d = FFWarmCache(tid);
+        for (Address& l : st.lines) l = -1L;
+    }
+    st.l1d->warmUnowned(procMask | vLineAddr, isLoad, zinfo->globPhaseCycles);
+    line = (vLineAddr << 1) | !isLoad;
+}
+
+VOID FFWarmLoad(THREADID tid, ADDRINT addr) {FFWarmAccess(tid, addr, true);}
+VOID FFWarmStore(THREADID tid, ADDRINT addr) {FFWarmAccess(tid, addr, false);}
+VOID FFWarmPredLoad(THREADID tid, ADDRINT addr, BOOL pred) {if (pred) FFWarmAccess(tid, addr, true);}
+VOID FFWarmPredStore(THREADID tid, ADDRINT addr, BOOL pred) {if (pred) FFWarmAccess(tid, addr, false);}
+
+VOID FFWarmMemBatch(THREADID tid, MemOpBatch* batch) {
+    for (uint32_t i = 0; i < batch->numOps; i++) {
+        uint64_t op = batch->ops[i];
+        FFWarmAccess(tid, MemOpBatch::addr(op), !MemOpBatch::isStore(op));
+    }
+}
+
 // FFI is instruction-based fast-forwarding
 /* FFI works as follows: when in fast-forward, we install a special FF BBL func
  * ptr that counts instructions and checks whether we have reached the switch
@@ -299,7 +407,7 @@ VOID FFITrackNFFInterval() {
         *_ffiPrevFFStartInstrs = *_ffiFFStartInstrs;
         *_ffiFFStartInstrs = zinfo->processStats->getProcessInstrs(p);
     };
-    zinfo->eventQueue->insert(makeAdaptiveEvent(ffiGet, ffiFire, 0, ffiInstrsLimit - ffiInstrsDone, MAX_IPC*zinfo->phaseLength));
+    zinfo->eventQueue->insert(makeAdaptiveEvent(ffiGet, ffiFire, 0, ffiInstrsLimit - ffiInstrsDone, MAX_IPC*zinfo->maxPhaseLength));
 
     ffiNFF = true;
 }
@@ -363,15 +471,20 @@ VOID FFIEntryBasicBlock(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
 }
 
 // Non-analysis pointer vars
-static const InstrFuncPtrs joinPtrs = {JoinAndLoadSingle, JoinAndStoreSingle, JoinAndBasicBlock, JoinAndRecordBranch, JoinAndPredLoadSingle, JoinAndPredStoreSingle, FPTR_JOIN};
-static const InstrFuncPtrs nopPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, NOPBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, FPTR_NOP};
-static const InstrFuncPtrs retryPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, NOPBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, FPTR_RETRY};
-static const InstrFuncPtrs ffPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, FFBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, FPTR_NOP};
+static const InstrFuncPtrs joinPtrs = {JoinAndLoadSingle, JoinAndStoreSingle, JoinAndBasicBlock, JoinAndRecordBranch, JoinAndPredLoadSingle, JoinAndPredStoreSingle, JoinAndMemBatch, FPTR_JOIN};
+static const InstrFuncPtrs nopPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, NOPBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, NOPMemBatch, FPTR_NOP};
+static const InstrFuncPtrs retryPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, NOPBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, NOPMemBatch, FPTR_RETRY};
+static const InstrFuncPtrs ffPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, FFBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, NOPMemBatch, FPTR_NOP};
 
-static const InstrFuncPtrs ffiPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, FFIBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, FPTR_NOP};
-static const InstrFuncPtrs ffiEntryPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, FFIEntryBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, FPTR_NOP};
+static const InstrFuncPtrs ffiPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, FFIBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, NOPMemBatch, FPTR_NOP};
+static const InstrFuncPtrs ffiEntryPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, FFIEntryBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, NOPMemBatch, FPTR_NOP};
+
+static const InstrFuncPtrs ffWarmPtrs = {FFWarmLoad, FFWarmStore, FFBasicBlock, NOPRecordBranch, FFWarmPredLoad, FFWarmPredStore, FFWarmMemBatch, FPTR_NOP};
+static const InstrFuncPtrs ffiWarmPtrs = {FFWarmLoad, FFWarmStore, FFIBasicBlock, NOPRecordBranch, FFWarmPredLoad, FFWarmPredStore, FFWarmMemBatch, FPTR_NOP};
+static const InstrFuncPtrs ffiEntryWarmPtrs = {FFWarmLoad, FFWarmStore, FFIEntryBasicBlock, NOPRecordBranch, FFWarmPredLoad, FFWarmPredStore, FFWarmMemBatch, FPTR_NOP};
 
 static const InstrFuncPtrs& GetFFPtrs() {
+    if (zinfo->ffWarmRate) return ffiEnabled? (ffiNFF? ffiEntryWarmPtrs : ffiWarmPtrs) : ffWarmPtrs;
     return ffiEnabled? (ffiNFF? ffiEntryPtrs : ffiPtrs) : ffPtrs;
 }
 
@@ -490,6 +603,9 @@ VOID EndOfPhaseActions() {
     CheckForTermination();
     zinfo->contentionSim->simulatePhase(zinfo->globPhaseCycles + zinfo->phaseLength);
     zinfo->eventQueue->tick();
+    if (zinfo->sampler) zinfo->sampler->endOfPhase();
+    if (zinfo->phaseCtrl) zinfo->phaseCtrl->endOfPhase();
+    if (unlikely(zinfo->snapshotPending)) TakeSnapshot();
     zinfo->profSimTime->transition(PROF_BOUND);
 }
 
@@ -511,8 +627,8 @@ uint32_t TakeBarrier(uint32_t tid, uint32_t cid) {
         zinfo->sched->leave(procIdx, tid, newCid);
         SimEnd(); //need to call this on a per-process basis...
     } else {
-        // Set fPtrs to those of the new core after possible context switch
-        fPtrs[tid] = cores[tid]->GetFuncPtrs();
+        // Set fPtrs to those of the new core after possible context switch (or to its warming pointers, if sampling)
+        fPtrs[tid] = GetCorePtrs(tid);
     }
 
     return newCid;
@@ -528,13 +644,24 @@ static void PrintIp(THREADID tid, ADDRINT ip) {
 }
 #endif
 
-VOID Instruction(INS ins) {
+//A basic block's memory operands can be batched if they fit and none is predicated (Pin treats REP string ops as predicated)
+static bool CanBatchMemOps(BBL bbl) {
+    uint32_t ops = 0;
+    for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins)) {
+        if (!INS_IsMemoryRead(ins) && !INS_IsMemoryWrite(ins)) continue;
+        if (INS_IsPredicated(ins) || INS_HasRealRep(ins)) return false;
+        ops += INS_IsMemoryRead(ins) + INS_HasMemoryRead2(ins) + INS_IsMemoryWrite(ins);
+    }
+    return ops <= MAX_BATCH_MEMOPS;
+}
+
+VOID Instruction(INS ins, bool batchMemOps) {
     //Uncomment to print an instruction trace
     //INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)PrintIp, IARG_THREAD_ID, IARG_REG_VALUE, REG_INST_PTR, IARG_END);
 
     if (!procTreeNode->isInFastForward() || !zinfo->ffReinstrument) {
-        AFUNPTR LoadFuncPtr = (AFUNPTR) IndirectLoadSingle;
-        AFUNPTR StoreFuncPtr = (AFUNPTR) IndirectStoreSingle;
+        AFUNPTR LoadFuncPtr = batchMemOps? (AFUNPTR) BatchLoad : (AFUNPTR) IndirectLoadSingle;
+        AFUNPTR StoreFuncPtr = batchMemOps? (AFUNPTR) BatchStore : (AFUNPTR) IndirectStoreSingle;
 
         AFUNPTR PredLoadFuncPtr = (AFUNPTR) IndirectPredLoadSingle;
         AFUNPTR PredStoreFuncPtr = (AFUNPTR) IndirectPredStoreSingle;
@@ -600,16 +727,19 @@ VOID Trace(TRACE trace, VOID *v) {
     if (!procTreeNode->isInFastForward() || !zinfo->ffReinstrument) {
         // Visit every basic block in the trace
         for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
-            BblInfo* bblInfo = Decoder::decodeBbl(bbl, zinfo->oooDecode);
-            BBL_InsertCall(bbl, IPOINT_BEFORE /*could do IPOINT_ANYWHERE if we redid load and store simulation in OOO*/, (AFUNPTR)IndirectBasicBlock, IARG_FAST_ANALYSIS_CALL,
+            BblInfo* bblInfo = zinfo->bblCache? zinfo->bblCache->get(bbl, zinfo->oooDecode) : Decoder::decodeBbl(bbl, zinfo->oooDecode);
+            //With batching, every bbl flushes the previous one's memory operands, even if its own are not batched
+            AFUNPTR BblFuncPtr = zinfo->batchMemOps? (AFUNPTR) IndirectBasicBlockBatched : (AFUNPTR) IndirectBasicBlock;
+            BBL_InsertCall(bbl, IPOINT_BEFORE /*could do IPOINT_ANYWHERE if we redid load and store simulation in OOO*/, BblFuncPtr, IARG_FAST_ANALYSIS_CALL,
                  IARG_THREAD_ID, IARG_ADDRINT, BBL_Address(bbl), IARG_PTR, bblInfo, IARG_END);
         }
     }
 
     //Instruction instrumentation now here to ensure proper ordering
     for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        bool batchMemOps = zinfo->batchMemOps && CanBatchMemOps(bbl);
         for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins)) {
-            Instruction(ins);
+            Instruction(ins, batchMemOps);
         }
     }
 }
@@ -903,6 +1033,7 @@ VOID SyscallEnter(THREADID tid, CONTEXT *ctxt, SYSCALL_STANDARD std, VOID *v) {
      * join).
      */
     if (fPtrs[tid].type != FPTR_JOIN && !zinfo->blockingSyscalls) {
+        FlushMemBatch(tid); //while we still have our core
         uint32_t cid = getCid(tid);
         // set an invalid cid, ours is property of the scheduler now!
         clearCid(tid);
@@ -924,7 +1055,7 @@ VOID SyscallExit(THREADID tid, CONTEXT *ctxt, SYSCALL_STANDARD std, VOID *v) {
         if (!zinfo->blockingSyscalls) {
             fPtrs[tid] = joinPtrs;
         } else {
-            fPtrs[tid] = cores[tid]->GetFuncPtrs(); //go back to normal pointers, directly
+            fPtrs[tid] = GetCorePtrs(tid); //go back to normal pointers, directly
         }
     } else if (ppa == PPA_USE_RETRY_PTRS) {
         fPtrs[tid] = retryPtrs;
@@ -1110,10 +1241,13 @@ VOID SimEnd() {
             info("All other processes done, terminating");
         }
 
+        zinfo->contentionSim->drainWeave();  // with a pipelined weave, the last phase may still be in flight
+
         info("Dumping termination stats");
         zinfo->trigger = 20000;
         for (StatsBackend* backend : *(zinfo->statsBackends)) backend->dump(false /*unbuffered, write out*/);
         for (AccessTraceWriter* t : *(zinfo->traceWriters)) t->dump(false);  // flushes trace writer
+        if (zinfo->bblCache) zinfo->bblCache->save();
 
         if (zinfo->sched) zinfo->sched->notifyTermination();
     }
@@ -1133,8 +1267,10 @@ VOID SimEnd() {
 #define ZSIM_MAGIC_OP_ROI_END           (1026)
 #define ZSIM_MAGIC_OP_REGISTER_THREAD   (1027)
 #define ZSIM_MAGIC_OP_HEARTBEAT         (1028)
+#define ZSIM_MAGIC_OP_SNAPSHOT          (1034)
 
 VOID HandleMagicOp(THREADID tid, ADDRINT op) {
+    FlushMemBatch(tid); //ops may change fPtrs or read core state
     switch (op) {
         case ZSIM_MAGIC_OP_ROI_BEGIN:
             if (!zinfo->ignoreHooks) {
@@ -1190,6 +1326,14 @@ VOID HandleMagicOp(THREADID tid, ADDRINT op) {
         case ZSIM_MAGIC_OP_HEARTBEAT:
             procTreeNode->heartbeat(); //heartbeats are per process for now
             return;
+        case ZSIM_MAGIC_OP_SNAPSHOT:
+            if (!zinfo->snapshotFile) {
+                warn("Thread %d: Ignoring SNAPSHOT magic op, sim.snapshotFile is not set", tid);
+            } else {
+                info("Thread %d: SNAPSHOT magic op, saving a snapshot at the end of this phase", tid);
+                zinfo->snapshotPending = true;
+            }
+            return;
 
         // HACK: Ubik magic ops
         case 1029:
@@ -1265,6 +1409,7 @@ VOID FakeCPUIDPost(THREADID tid, ADDRINT* eax, ADDRINT* ebx, ADDRINT* ecx, ADDRI
 VOID FakeRDTSCPost(THREADID tid, REG* eax, REG* edx) {
     if (fPtrs[tid].type == FPTR_NOP) return; //avoid virtualizing NOP threads.
 
+    FlushMemBatch(tid); //account for the accesses before rdtsc in this bbl
     uint32_t cid = getCid(tid);
     uint64_t curCycle = VirtGetPhaseRDTSC();
     if (cid < zinfo->numCores) {
@@ -1559,6 +1704,8 @@ int main(int argc, char *argv[]) {
             EndOfPhaseActions();
             zinfo->numPhases++;
             zinfo->globPhaseCycles += zinfo->phaseLength;
+            zinfo->phaseLength = zinfo->nextPhaseLength;
+            zinfo->nextPhaseLength = zinfo->pendingPhaseLength;
         }
         info("Finished trace-driven simulation");
         SimEnd();
@@ -48,6 +48,11 @@ class PortVirtualizer;
 class VectorCounter;
 class AccessTraceWriter;
 class TraceDriver;
+class PhaseLengthController;
+class BblCache;
+class Sampler;
+class FilterCache;
+class Cache;
 template <typename T> class g_vector;
 
 struct ClockDomainInfo {
@@ -93,7 +98,10 @@ struct GlobSimInfo {
     PAD();
 
     //World-readable
-    uint32_t phaseLength;
+    uint32_t phaseLength; //of the current phase; only changes with sim.adaptivePhases
+    uint32_t nextPhaseLength; //cores use it to find where the next phase ends before reaching the end-of-phase barrier
+    uint32_t pendingPhaseLength; //set by the phase length controller; becomes nextPhaseLength when this phase ends
+    uint32_t maxPhaseLength; //bound on all of the above
     uint32_t statsPhaseInterval;
     uint32_t freqMHz;
 
@@ -108,12 +116,14 @@ struct GlobSimInfo {
     bool blockingSyscalls;
     bool perProcessCpuEnum; //if true, cpus are enumerated according to per-process masks (e.g., a 16-core mask in a 64-core sim sees 16 cores)
     bool oooDecode; //if true, Decoder does OOO (instr->uop) decoding
+    bool batchMemOps; //if true, memory operands are delivered to cores once per basic block (see MemOpBatch)
+    BblCache* bblCache; //decoded bbls shared by all processes; nullptr if disabled
 
     PAD();
 
     //Writable, rarely read, unshared in a single phase
     uint64_t numPhases;
-    uint64_t globPhaseCycles; //just numPhases*phaseCycles. It behooves us to precompute it, since it is very frequently used in tracing code.
+    uint64_t globPhaseCycles; //sum of the lengths of past phases (numPhases*phaseLength with fixed-length phases). Very frequently used in tracing code.
 
     uint64_t procEventualDumps;
 
@@ -141,6 +151,8 @@ struct GlobSimInfo {
     ProcStats* procStats;
 
     TimeBreakdownStat* profSimTime;
+    PhaseLengthController* phaseCtrl; //nullptr unless sim.adaptivePhases
+    Sampler* sampler; //nullptr unless some process has samplingUnit set
     VectorCounter* profHeartbeats; //global b/c number of processes cannot be inferred at init time; we just size to max
 
     uint64_t trigger; //code with what triggered the current stats dump
@@ -169,6 +181,15 @@ struct GlobSimInfo {
 
     bool ffReinstrument; //true if we should reinstrument on ffwd, works fine with ST apps and it's faster since we run with basically no instrumentation, but it's not precise with MT apps
 
+    //Fast-forward cache warming: if non-zero, fast-forwarded threads functionally feed one in every ffWarmRate memory accesses into the caches
+    uint32_t ffWarmRate;
+    FilterCache** ffWarmCaches; //core's data L1s, nullptr for cores without caches
+
+    //Cache hierarchy snapshots (see snapshot.h)
+    g_vector<Cache*>* caches; //all caches, in config order
+    const char* snapshotFile; //nullptr if snapshots are disabled
+    volatile bool snapshotPending; //set by the snapshot magic op or instruction trigger, taken at the end of the phase
+
     //fftoggle stuff
     lock_t ffToggleLocks[256]; //f*ing Pin and its f*ing inability to handle external signals...
     lock_t pauseLocks[256]; //per-process pauses